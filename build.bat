@@ -31,6 +31,8 @@ set compiler_flags=/O2 /MTd /Zi %includeFlags% %warnFlags% /Femilton.exe /wd4217
 
 if "%1"=="test" (
    cl ..\src\unity_tests.cc %compiler_flags /SUBSYSTEM:Console
+) else if "%1"=="render" (
+   cl ..\src\unity_render.cc %compiler_flags% /SUBSYSTEM:Console /OUT:milton-render.exe
 ) else (
    cl Milton.res ..\src\unity.cc %compiler_flags%
 )
@@ -0,0 +1,153 @@
+// Copyright (c) 2015 Sergio Gonzalez. All rights reserved.
+// License: https://github.com/serge-rgb/milton#license
+
+#include "StrokeIndex.h"
+
+#include "stroke.h"
+
+static StrokeIndexNode*
+create_node(Arena* arena, i64 x, i64 y, i32 size_log2)
+{
+    StrokeIndexNode* node = arena_alloc_elem(arena, StrokeIndexNode);
+    node->x = x;
+    node->y = y;
+    node->size_log2 = size_log2;
+    node->bounds = rect_without_size();
+    return node;
+}
+
+static b32
+rects_overlap(Rect a, Rect b)
+{
+    b32 outside =   a.left   > b.right
+                 || a.top    > b.bottom
+                 || a.right  < b.left
+                 || a.bottom < b.top;
+    return !outside;
+}
+
+// Returns the child cell in which a rect would be stored. If the rect is too
+// big for the children of `node`, returns -1.
+static int
+child_for_rect(StrokeIndexNode* node, Rect rect)
+{
+    int result = -1;
+    if ( node->size_log2 > STROKE_INDEX_MIN_CELL_LOG2 && rect_is_valid(rect) ) {
+        i64 child_size = (i64)1 << (node->size_log2 - 1);
+        i64 extent = max((i64)rect.right - rect.left, (i64)rect.bottom - rect.top);
+        // Children are loose: they accept anything whose center falls in the
+        // cell and that is no larger than half the cell.
+        if ( extent <= child_size / 2 ) {
+            i64 cx = ((i64)rect.left + rect.right) / 2;
+            i64 cy = ((i64)rect.top + rect.bottom) / 2;
+            result = (cx >= node->x + child_size ? 1 : 0) |
+                     (cy >= node->y + child_size ? 2 : 0);
+        }
+    }
+    return result;
+}
+
+static StrokeIndexNode*
+get_or_create_child(Arena* arena, StrokeIndexNode* node, int child_i)
+{
+    if ( node->children[child_i] == NULL ) {
+        i64 child_size = (i64)1 << (node->size_log2 - 1);
+        node->children[child_i] = create_node(arena,
+                                              node->x + ((child_i & 1) ? child_size : 0),
+                                              node->y + ((child_i & 2) ? child_size : 0),
+                                              node->size_log2 - 1);
+    }
+    return node->children[child_i];
+}
+
+void
+stroke_index_insert(StrokeIndex* index, Stroke* stroke, i64 stroke_i)
+{
+    if ( index->root == NULL ) {
+        i64 half_size = (i64)1 << (STROKE_INDEX_ROOT_CELL_LOG2 - 1);
+        index->root = create_node(index->arena, -half_size, -half_size, STROKE_INDEX_ROOT_CELL_LOG2);
+    }
+
+    StrokeIndexEntry* entry = index->free_entries;
+    if ( entry ) {
+        index->free_entries = entry->next;
+    }
+    else {
+        entry = arena_alloc_elem(index->arena, StrokeIndexEntry);
+    }
+    entry->bounds = stroke->bounding_rect;
+    entry->stroke_i = stroke_i;
+    entry->stroke = stroke;
+
+    StrokeIndexNode* node = index->root;
+    node->bounds = rect_union(node->bounds, entry->bounds);
+    for ( int child_i = child_for_rect(node, entry->bounds);
+          child_i >= 0;
+          child_i = child_for_rect(node, entry->bounds) ) {
+        node = get_or_create_child(index->arena, node, child_i);
+        node->bounds = rect_union(node->bounds, entry->bounds);
+    }
+
+    entry->next = node->entries;
+    node->entries = entry;
+
+    index->count += 1;
+}
+
+void
+stroke_index_pop(StrokeIndex* index, Stroke* stroke, i64 stroke_i)
+{
+    mlt_assert(index->root);
+
+    StrokeIndexNode* node = index->root;
+    for ( int child_i = child_for_rect(node, stroke->bounding_rect);
+          child_i >= 0;
+          child_i = child_for_rect(node, stroke->bounding_rect) ) {
+        node = node->children[child_i];
+        mlt_assert(node);
+    }
+
+    // Node bounds are left as they are. They can only be larger than
+    // necessary, which is still correct for culling.
+    StrokeIndexEntry* entry = node->entries;
+    mlt_assert(entry && entry->stroke_i == stroke_i);
+    node->entries = entry->next;
+
+    entry->next = index->free_entries;
+    index->free_entries = entry;
+
+    index->count -= 1;
+}
+
+static void
+query_node(StrokeIndexNode* node, Rect bounds, DArray<StrokeIndexEntry*>* out)
+{
+    if ( node && rects_overlap(node->bounds, bounds) ) {
+        for ( StrokeIndexEntry* e = node->entries; e != NULL; e = e->next ) {
+            if ( rects_overlap(e->bounds, bounds) ) {
+                push(out, e);
+            }
+        }
+        for ( int i = 0; i < 4; ++i ) {
+            query_node(node->children[i], bounds, out);
+        }
+    }
+}
+
+static int
+compare_entries(const void* a, const void* b)
+{
+    i64 ia = (*(StrokeIndexEntry**)a)->stroke_i;
+    i64 ib = (*(StrokeIndexEntry**)b)->stroke_i;
+    return (ia > ib) - (ia < ib);
+}
+
+void
+stroke_index_query(StrokeIndex* index, Rect bounds, DArray<StrokeIndexEntry*>* out)
+{
+    reset(out);
+    query_node(index->root, bounds, out);
+    if ( out->count > 1 ) {
+        qsort(out->data, (size_t)out->count, sizeof(*out->data), compare_entries);
+    }
+}
@@ -0,0 +1,61 @@
+// Copyright (c) 2015 Sergio Gonzalez. All rights reserved.
+// License: https://github.com/serge-rgb/milton#license
+
+// StrokeIndex
+//
+// - Loose quadtree over the bounding rects of the strokes in a layer.
+// - Strokes are stored at the deepest cell that is comparable in size to
+//   their bounding rect. Every node keeps the union of the bounds in its
+//   subtree so that queries only descend into parts of the canvas that have
+//   something in them.
+// - Strokes are only ever added and removed at the end of a layer (new stroke,
+//   undo, redo), so removal always takes the head of a cell's entry list.
+
+
+#pragma once
+
+#include "DArray.h"
+#include "utils.h"
+
+struct Stroke;
+
+#define STROKE_INDEX_ROOT_CELL_LOG2 32  // The root cell spans the whole i32 canvas.
+#define STROKE_INDEX_MIN_CELL_LOG2  8
+
+struct StrokeIndexEntry
+{
+    Rect                bounds;
+    i64                 stroke_i;  // Position in the layer. Used to preserve draw order.
+    Stroke*             stroke;
+    StrokeIndexEntry*   next;
+};
+
+struct StrokeIndexNode
+{
+    i64                 x;  // Top-left corner of the cell.
+    i64                 y;
+    i32                 size_log2;
+
+    Rect                bounds;  // Union of all entries in this node and its children.
+    StrokeIndexEntry*   entries;
+
+    StrokeIndexNode*    children[4];
+};
+
+struct StrokeIndex
+{
+    StrokeIndexNode*    root;
+    StrokeIndexEntry*   free_entries;
+    i64                 count;
+
+    Arena*              arena;
+};
+
+void stroke_index_insert(StrokeIndex* index, Stroke* stroke, i64 stroke_i);
+
+// Removes the last stroke inserted into the index.
+void stroke_index_pop(StrokeIndex* index, Stroke* stroke, i64 stroke_i);
+
+// Fills `out` with the entries whose bounds intersect `bounds`, sorted by
+// stroke_i.
+void stroke_index_query(StrokeIndex* index, Rect bounds, DArray<StrokeIndexEntry*>* out);
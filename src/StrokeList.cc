@@ -17,21 +17,37 @@ create_bucket(Arena* arena)
     return bucket;
 }
 
+static void
+add_bucket(StrokeList* list)
+{
+    if ( list->num_buckets == list->buckets_capacity ) {
+        // Grow the directory. The old one stays in the arena; it is only a few pointers.
+        i64 new_capacity = list->buckets_capacity ? 2*list->buckets_capacity : 32;
+        StrokeBucket** new_buckets = arena_alloc_array(list->arena, new_capacity, StrokeBucket*);
+        if ( list->num_buckets > 0 ) {
+            memcpy(new_buckets, list->buckets, (size_t)list->num_buckets * sizeof(*new_buckets));
+        }
+        list->buckets = new_buckets;
+        list->buckets_capacity = new_capacity;
+    }
+
+    StrokeBucket* bucket = list->num_buckets == 0 ? &list->root : create_bucket(list->arena);
+    list->buckets[list->num_buckets++] = bucket;
+}
+
 void
 push(StrokeList* list, const Stroke& element)
 {
-    int bucket_i = list->count / STROKELIST_BUCKET_COUNT;
-    int i = list->count % STROKELIST_BUCKET_COUNT;
+    i64 bucket_i = list->count / STROKELIST_BUCKET_COUNT;
+    i64 i = list->count % STROKELIST_BUCKET_COUNT;
 
-    StrokeBucket* bucket = &list->root;
-    while ( bucket_i != 0 ) {
-        if ( !bucket->next ) {
-            bucket->next = create_bucket(list->arena);
-        }
-        bucket = bucket->next;
-        bucket_i -= 1;
+    // Buckets are never freed, so at most one new bucket is needed.
+    if ( bucket_i == list->num_buckets ) {
+        add_bucket(list);
     }
 
+    StrokeBucket* bucket = list->buckets[bucket_i];
+
     bucket->data[i] = element;
 
     bucket->bounding_rect = rect_union(bucket->bounding_rect, element.bounding_rect);
@@ -42,14 +58,10 @@ push(StrokeList* list, const Stroke& element)
 Stroke*
 get(StrokeList* list, i64 idx)
 {
-    int bucket_i = idx / STROKELIST_BUCKET_COUNT;
-    int i = idx % STROKELIST_BUCKET_COUNT;
-    StrokeBucket* bucket = &list->root;
-    while ( bucket_i != 0 ) {
-        bucket = bucket->next;
-        bucket_i -= 1;
-    }
-    return &bucket->data[i];
+    mlt_assert(idx >= 0 && idx / STROKELIST_BUCKET_COUNT < list->num_buckets);
+    i64 bucket_i = idx / STROKELIST_BUCKET_COUNT;
+    i64 i = idx % STROKELIST_BUCKET_COUNT;
+    return &list->buckets[bucket_i]->data[i];
 }
 
 Stroke
@@ -72,11 +84,9 @@ void
 reset(StrokeList* list)
 {
     list->count = 0;
-    StrokeBucket* bucket = &list->root;
 
-    while( bucket ) {
-        bucket->bounding_rect = rect_without_size();
-        bucket = bucket->next;
+    for ( i64 i = 0; i < list->num_buckets; ++i ) {
+        list->buckets[i]->bounding_rect = rect_without_size();
     }
 }
 
@@ -94,31 +104,82 @@ StrokeList::operator[] (i64 i)
     return e;
 }
 
+void
+strokelist_freeze(StrokeList* list, FrozenStrokeList* frozen, Arena* arena)
+{
+    frozen->count = list->count;
+    frozen->num_buckets = (list->count + STROKELIST_BUCKET_COUNT - 1) / STROKELIST_BUCKET_COUNT;
+    frozen->buckets = arena_alloc_array(arena, frozen->num_buckets, void*);
+    for ( i64 i = 0; i < frozen->num_buckets; ++i ) {
+        frozen->buckets[i] = list->buckets[i];
+    }
+}
+
+void
+strokelist_preserve(StrokeList* list, FrozenStrokeList* frozen, i64 idx)
+{
+    if ( idx < frozen->count ) {
+        i64 bucket_i = idx / STROKELIST_BUCKET_COUNT;
+        StrokeBucket* bucket = list->buckets[bucket_i];
+        if ( SDL_AtomicGetPtr(&frozen->buckets[bucket_i]) == bucket ) {
+            StrokeBucket* copy = (StrokeBucket*)mlt_calloc(1, sizeof(StrokeBucket), "Persist");
+            memcpy(copy, bucket, sizeof(StrokeBucket));
+            // Publish the copy before the caller writes to the live bucket.
+            SDL_AtomicSetPtr(&frozen->buckets[bucket_i], copy);
+        }
+    }
+}
+
+void
+strokelist_unfreeze(StrokeList* list, FrozenStrokeList* frozen)
+{
+    for ( i64 i = 0; i < frozen->num_buckets; ++i ) {
+        StrokeBucket* bucket = (StrokeBucket*)SDL_AtomicGetPtr(&frozen->buckets[i]);
+        if ( bucket != list->buckets[i] ) {
+            mlt_free(bucket, "Persist");
+        }
+    }
+    frozen->num_buckets = 0;
+    frozen->count = 0;
+}
+
+Stroke
+strokelist_frozen_get(FrozenStrokeList* frozen, i64 idx)
+{
+    mlt_assert(idx < frozen->count);
+    i64 bucket_i = idx / STROKELIST_BUCKET_COUNT;
+    i64 i = idx % STROKELIST_BUCKET_COUNT;
+
+    StrokeBucket* bucket = (StrokeBucket*)SDL_AtomicGetPtr(&frozen->buckets[bucket_i]);
+    Stroke result = bucket->data[i];
+
+    // If the bucket was preserved while we were reading it, the live slot
+    // might have been overwritten. The copy was made before that, so read it
+    // again from there.
+    StrokeBucket* current = (StrokeBucket*)SDL_AtomicGetPtr(&frozen->buckets[bucket_i]);
+    if ( current != bucket ) {
+        result = current->data[i];
+    }
+    return result;
+}
+
 struct StrokeIterator
 {
-    StrokeBucket* cur_bucket;
-    int i;
-    int count;
+    StrokeList* list;
+    i64 i;
 };
 
-Stroke* stroke_iter_init_at(StrokeList* list, StrokeIterator* iter, u64 stroke_i)
+Stroke* stroke_iter_init_at(StrokeList* list, StrokeIterator* iter, i64 stroke_i)
 {
     Stroke* result = NULL;
 
-    iter->cur_bucket = &list->root;
-    iter->count = list->count;
-    iter->i = 0;
-
-    if (stroke_i < iter->count) {
-        iter->i = stroke_i;
-        for (u64 i = 0; i < stroke_i / STROKELIST_BUCKET_COUNT; ++i) {
-            iter->cur_bucket = iter->cur_bucket->next;
-        }
+    iter->list = list;
+    iter->i = stroke_i;
 
-        result = &iter->cur_bucket->data[iter->i % STROKELIST_BUCKET_COUNT];
+    if ( stroke_i >= 0 && stroke_i < list->count ) {
+        result = get(list, stroke_i);
     }
 
-
     return result;
 }
 
@@ -132,16 +193,9 @@ Stroke* stroke_iter_next(StrokeIterator* iter)
 {
     Stroke* result = NULL;
 
-    if (iter->cur_bucket) {
-        iter->i++;
-        if ((iter->i % STROKELIST_BUCKET_COUNT) == 0) {
-            iter->cur_bucket = iter->cur_bucket->next;
-        }
-
-        if (iter->i < iter->count) {
-            int bucket_i = iter->i % STROKELIST_BUCKET_COUNT;
-            result = &iter->cur_bucket->data[bucket_i];
-        }
+    iter->i++;
+    if ( iter->i < iter->list->count ) {
+        result = get(iter->list, iter->i);
     }
 
     return result;
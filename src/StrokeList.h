@@ -5,6 +5,8 @@
 //
 // - Works as a dynamically-sized array for Strokes.
 // - Pointers to elements in the StrokeList stay valid for the lifetime of the program.
+// - Buckets are found through a directory of bucket pointers, so indexing and
+//   pushing take constant time.
 
 
 #pragma once
@@ -18,7 +20,6 @@
 struct StrokeBucket
 {
     Stroke          data[STROKELIST_BUCKET_COUNT];
-    StrokeBucket*   next;
     Rect            bounding_rect;
 };
 
@@ -28,6 +29,11 @@ struct StrokeList
     i64             count;
     Stroke*         operator[](i64 i);
 
+    // Directory of buckets. buckets[0] is &root.
+    StrokeBucket**  buckets;
+    i64             num_buckets;
+    i64             buckets_capacity;
+
     Arena*          arena;
 };
 
@@ -40,6 +46,24 @@ Stroke* peek(StrokeList* list);
 void reset(StrokeList* list);
 i64 count(StrokeList* list);
 
+// Read-only view of a StrokeList as it was at some point, for the save thread.
+//
+// The owner keeps pushing and popping. Appends never touch slots the frozen
+// view can see, but a push after an undo overwrites one. Before that happens
+// the owner calls strokelist_preserve, which gives the frozen view a private
+// copy of the bucket.
+struct FrozenStrokeList
+{
+    i64     count;
+    i64     num_buckets;
+    void**  buckets;  // StrokeBucket*. Read and written with SDL atomics.
+};
+
+void   strokelist_freeze(StrokeList* list, FrozenStrokeList* frozen, Arena* arena);
+void   strokelist_preserve(StrokeList* list, FrozenStrokeList* frozen, i64 idx);
+void   strokelist_unfreeze(StrokeList* list, FrozenStrokeList* frozen);  // Frees preserved buckets.
+Stroke strokelist_frozen_get(FrozenStrokeList* frozen, i64 idx);
+
 struct StrokeIterator;
 
 Stroke* stroke_iter_init(StrokeList* list, StrokeIterator* iter);
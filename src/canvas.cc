@@ -2,6 +2,8 @@
 // License: https://github.com/serge-rgb/milton#license
 
 #include "canvas.h"
+#include "jobs.h"
+#include "renderer.h"
 #include "utils.h"
 
 v2l
@@ -172,6 +174,8 @@ canvas_rect_to_raster_rect(CanvasView* view, Rect canvas_rect)
 
 namespace layer
 {
+    static u64 g_layer_version;
+
     i64
     count_strokes(Layer* root)
     {
@@ -184,6 +188,70 @@ namespace layer
         return count;
     }
 
+    struct ClippedCount
+    {
+        StrokeList*     strokes;
+        SDL_atomic_t    count;
+    };
+
+    // Job system callback.
+    static void
+    count_clipped_range(void* data, i64 begin, i64 end, i32 worker)
+    {
+        ClippedCount* c = (ClippedCount*)data;
+        int count = 0;
+        for ( i64 i = begin; i < end; ++i ) {
+            if ( gpu_stroke_is_cooked(get(c->strokes, i)->render_handle) ) {
+                ++count;
+            }
+        }
+        SDL_AtomicAdd(&c->count, count);
+    }
+
+    // Strokes with geometry in GPU memory. Each layer is split in up to
+    // `num_workers` ranges for the job system. With num_workers == 0 the
+    // strokes are counted on the calling thread, and with a negative number
+    // the job system picks the split.
+    i64
+    count_clipped_strokes(Layer* root, i32 num_workers)
+    {
+        i64 count = 0;
+        for ( Layer* layer = root; layer != NULL; layer = layer->next ) {
+            ClippedCount c = {};
+            c.strokes = &layer->strokes;
+            i64 num_strokes = layer->strokes.count;
+            if ( num_workers == 0 ) {
+                count_clipped_range(&c, 0, num_strokes, 0);
+            }
+            else {
+                i64 grain = num_workers > 0 ? (num_strokes + num_workers - 1) / num_workers : 4096;
+                parallel_for(num_strokes, grain, count_clipped_range, &c);
+            }
+            count += SDL_AtomicGet(&c.count);
+        }
+        return count;
+    }
+
+    // Hash of the layer list, ignoring strokes. A change means that the
+    // journal can't describe the canvas and we need a full save.
+    u64
+    hash_layers(Layer* root)
+    {
+        u64 h = 0;
+        for ( Layer* l = root; l != NULL; l = l->next ) {
+            h = h*31 + hash((char*)&l->id, sizeof(l->id));
+            h = h*31 + hash(l->name, strlen(l->name));
+            h = h*31 + hash((char*)&l->flags, sizeof(l->flags));
+            h = h*31 + hash((char*)&l->alpha, sizeof(l->alpha));
+            for ( LayerEffect* e = l->effects; e != NULL; e = e->next ) {
+                h = h*31 + hash((char*)&e->type, sizeof(e->type));
+                h = h*31 + hash((char*)&e->enabled, sizeof(e->enabled));
+                h = h*31 + hash((char*)&e->blur, sizeof(e->blur));
+            }
+        }
+        return h;
+    }
+
     Layer*
     get_topmost(Layer* root)
     {
@@ -209,8 +277,23 @@ namespace layer
     Stroke*
     layer_push_stroke(Layer* layer, Stroke stroke)
     {
+        if ( layer->frozen && layer->strokes.count < layer->frozen->count ) {
+            // Pushing after an undo. Don't overwrite what the save thread reads.
+            strokelist_preserve(&layer->strokes, layer->frozen, layer->strokes.count);
+        }
         push(&layer->strokes, stroke);
-        return peek(&layer->strokes);
+        Stroke* s = peek(&layer->strokes);
+        stroke_index_insert(&layer->stroke_index, s, layer->strokes.count - 1);
+        layer->version = ++g_layer_version;
+        return s;
+    }
+
+    Stroke
+    layer_pop_stroke(Layer* layer)
+    {
+        stroke_index_pop(&layer->stroke_index, peek(&layer->strokes), layer->strokes.count - 1);
+        layer->version = ++g_layer_version;
+        return pop(&layer->strokes);
     }
 
     b32
@@ -6,6 +6,7 @@
 
 #include "vector.h"
 #include "StrokeList.h"
+#include "StrokeIndex.h"
 
 #define MAX_LAYER_NAME_LEN          64
 
@@ -37,6 +38,8 @@ struct Layer
     i32 id;
 
     StrokeList strokes;
+    StrokeIndex stroke_index;  // Spatial index for strokes. Used for clipping.
+    FrozenStrokeList* frozen;  // Set while a snapshot of this layer is being saved.
     char    name[MAX_LAYER_NAME_LEN];
 
     i32     flags;  // LayerFlags
@@ -45,6 +48,10 @@ struct Layer
 
     LayerEffect* effects;
 
+    // Changes when strokes are pushed or popped. Unique among all layers,
+    // so that cached renders can't be mistaken for another canvas' layer.
+    u64 version;
+
     Layer* prev;
     Layer* next;
 };
@@ -122,8 +129,10 @@ namespace layer {
     void    layer_toggle_visibility (Layer* layer);
     b32     layer_has_blur_effect (Layer* layer);
     Stroke* layer_push_stroke (Layer* layer, Stroke stroke);
+    Stroke  layer_pop_stroke (Layer* layer);
     i32     number_of_layers (Layer* root);
     void    free_layers (Layer* root);
     i64     count_strokes (Layer* root);
+    u64     hash_layers (Layer* root);
     i64     count_clipped_strokes (Layer* root, i32 num_workers);
 }
@@ -25,12 +25,14 @@
     X(void,     glBindFramebufferEXT,     GLenum target, GLuint framebuffer)                      \
     X(void,     glBindTexture,            GLenum target, GLuint text) \
     X(void,     glBufferData,             GLenum target, GLsizeiptr size, const GLvoid *data, GLenum usage) \
+    X(void,     glBufferSubData,          GLenum target, GLintptr offset, GLsizeiptr size, const GLvoid *data) \
     X(void,     glCompileShader,          GLuint shader)                                          \
     X(void,     glEnable, GLenum cap )\
     X(void,     glFramebufferTexture2DEXT, GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level) \
     X(void,     glGenFramebuffersEXT,     GLsizei n, GLuint* framebuffers)                        \
     X(void,     glGenTextures,            GLsizei n, GLuint* textures) \
     X(void,     glAttachShader,           GLuint program, GLuint shader)                          \
+    X(void,     glBindAttribLocation,     GLuint program, GLuint index, const GLchar* name)       \
     X(GLboolean, glIsProgram,             GLuint program)                                         \
     X(GLboolean, glIsShader,              GLuint shader)                                          \
     X(GLuint,   glCreateShader,           GLenum type)                                            \
@@ -72,12 +74,16 @@
     X(void,     glClearColor, GLclampf red, GLclampf green, GLclampf blue, GLclampf alpha)\
     X(void,     glClearDepth,             GLclampd depth) \
     X(void,     glCopyTexImage2D,         GLenum target, GLint level, GLenum internalformat, GLint x, GLint y, GLsizei width, GLsizei height, GLint border)\
+    X(void,     glCopyTexSubImage2D,      GLenum target, GLint level, GLint xoffset, GLint yoffset, GLint x, GLint y, GLsizei width, GLsizei height)\
     X(void,     glDeleteBuffers,          GLsizei n, GLuint* buffers)                       \
     X(void,     glDeleteVertexArrays,     GLsizei n, GLuint* arrays)                        \
     X(void,     glDepthFunc,              GLenum func) \
     X(void,     glDisable,                GLenum cap) \
     X(void,     glDrawArrays, GLenum mode, GLint first, GLsizei count)\
+    X(void,     glFinish,                 void) \
     X(void,     glDrawElements,           GLenum mode, GLsizei count, GLenum type, const void *indices)\
+    X(void,     glDisableVertexAttribArray, GLuint index)                                         \
+    X(void,     glMultiDrawElements,      GLenum mode, const GLsizei *count, GLenum type, const void *const *indices, GLsizei drawcount)\
     X(void,     glEnableVertexAttribArray, GLuint index)                                          \
     X(void,     glPixelStorei,            GLenum pname, GLint param)\
     X(void,     glReadPixels,             GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, void *pixels)\
@@ -91,7 +97,14 @@
     X(void,     glDeleteShader,           GLuint shader)                                          \
     X(void, glPolygonMode,  GLenum face, GLenum mode) \
 
+// Core in GL 3.3. Loaded from ARB_instanced_arrays and ARB_draw_instanced
+// otherwise. See GLHelperFlags_INSTANCED_ARRAYS
+#define GL_FUNCTIONS_INSTANCED \
+    X(void,     glVertexAttribDivisor,    GLuint index, GLuint divisor)                           \
+    X(void,     glDrawArraysInstanced,    GLenum mode, GLint first, GLsizei count, GLsizei instancecount)
+
 #define GL_FUNCTIONS \
+    GL_FUNCTIONS_INSTANCED \
     GL_FUNCTIONS_GRAPHICS_DEBUG \
     GL_FUNCTIONS_DEBUG \
     GL_FUNCTIONS_CORE
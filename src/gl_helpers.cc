@@ -89,6 +89,44 @@ check_flags (int flags)
     return result;
 }
 
+// GL_MAJOR_VERSION is not available in 2.1 contexts.
+static void
+get_version (int* major, int* minor)
+{
+    *major = 0;
+    *minor = 0;
+    const char* version = (const char*)glGetString(GL_VERSION);
+    if ( version ) {
+        sscanf(version, "%d.%d", major, minor);
+    }
+}
+
+static bool
+has_extension (const char* name)
+{
+    bool found = false;
+    int major = 0;
+    int minor = 0;
+    get_version(&major, &minor);
+    if ( major >= 3 ) {
+        // GL_EXTENSIONS is not a valid glGetString argument in core profiles.
+        GLint num_extensions = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &num_extensions);
+        for ( GLint i = 0; !found && i < num_extensions; ++i ) {
+            const char* ext = (const char*)glGetStringi(GL_EXTENSIONS, (GLuint)i);
+            found = ext && strcmp(ext, name) == 0;
+        }
+    }
+    else {
+        const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+        size_t len = strlen(name);
+        for ( const char* s = extensions; !found && s && (s = strstr(s, name)) != NULL; s += len ) {
+            found = s[len] == ' ' || s[len] == '\0';
+        }
+    }
+    return found;
+}
+
 bool
 load ()
 {
@@ -99,6 +137,25 @@ load ()
     bool ok = true;
     // Extension checking.
 
+    {
+        int major = 0;
+        int minor = 0;
+        get_version(&major, &minor);
+        if ( major < 3 || (major == 3 && minor < 3) ) {
+            // Some drivers return non-null pointers for anything, so don't trust the core names.
+            glVertexAttribDivisor = NULL;
+            glDrawArraysInstanced = NULL;
+            if ( has_extension("GL_ARB_instanced_arrays") && has_extension("GL_ARB_draw_instanced") ) {
+                glVertexAttribDivisor = (decltype(glVertexAttribDivisor)) platform_get_gl_proc("glVertexAttribDivisorARB");
+                glDrawArraysInstanced = (decltype(glDrawArraysInstanced)) platform_get_gl_proc("glDrawArraysInstancedARB");
+            }
+        }
+        if ( glVertexAttribDivisor && glDrawArraysInstanced ) {
+            set_flags(GLHelperFlags_INSTANCED_ARRAYS);
+        }
+        milton_log("Instanced arrays: %s\n", check_flags(GLHelperFlags_INSTANCED_ARRAYS) ? "yes" : "no");
+    }
+
 #if defined(_WIN32)
 #pragma warning(push, 0)
     if ( !check_flags(GLHelperFlags_SAMPLE_SHADING) ) {
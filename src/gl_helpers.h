@@ -23,6 +23,7 @@ GL_DEBUG_CALLBACK(milton_gl_debug_callback);
 enum GLHelperFlags
 {
     GLHelperFlags_SAMPLE_SHADING        = 1<<0,
+    GLHelperFlags_INSTANCED_ARRAYS      = 1<<1,  // glVertexAttribDivisor and glDrawArraysInstanced
 };
 
 namespace gl {
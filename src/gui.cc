@@ -815,6 +815,13 @@ milton_imgui_tick(MiltonInput* input, PlatformState* platform,  Milton* milton,
                     milton->settings->peek_out_increment = (peek_out_percent / 100.0f) * peek_range;
                 }
 
+                bool compress = milton->settings->compress_canvas;
+                if ( ImGui::Checkbox(loc(TXT_compress_canvas_files), &compress) ) {
+                    milton->settings->compress_canvas = compress;
+                }
+
+                ImGui::SliderInt(loc(TXT_stroke_memory_mb), &milton->settings->stroke_memory_mb, 64, 4096);
+
                 ImGui::Separator();
 
                 MiltonBindings* bs = &milton->settings->bindings;
@@ -1002,6 +1009,48 @@ milton_imgui_tick(MiltonInput* input, PlatformState* platform,  Milton* milton,
                      gpu_get_num_clipped_strokes(milton->canvas->root_layer));
             ImGui::Text(msg);
 
+            GpuStrokeMemory stroke_memory;
+            gpu_get_stroke_memory(milton->renderer, &stroke_memory);
+            snprintf(msg, array_count(msg),
+                     "Stroke geometry: %.2f of %.2f MB, %d segments\n"
+                     "%d bytes per point %s (%d with quads)\n"
+                     "Resident: %d strokes, %.2f of %.2f MB budget\n"
+                     "Hits: %d Misses: %d Evictions: %d\n",
+                     stroke_memory.used_bytes / (1024.0*1024.0),
+                     stroke_memory.reserved_bytes / (1024.0*1024.0),
+                     (int)stroke_memory.num_segments,
+                     (int)stroke_memory.bytes_per_segment,
+                     stroke_memory.instanced ? "instanced" : "indexed",
+                     (int)stroke_memory.bytes_per_segment_quads,
+                     (int)stroke_memory.num_strokes,
+                     stroke_memory.used_bytes / (1024.0*1024.0),
+                     stroke_memory.budget_bytes / (1024.0*1024.0),
+                     (int)stroke_memory.hits,
+                     (int)stroke_memory.misses,
+                     (int)stroke_memory.evictions);
+            ImGui::Text(msg);
+
+            LatencyPercentiles to_render = latency_percentiles(milton->latency, LatencyStage_RENDER);
+            LatencyPercentiles to_swap = latency_percentiles(milton->latency, LatencyStage_SWAP);
+            snprintf(msg, array_count(msg),
+                     "Input latency, last %d samples (p50 / p95 / p99)\n"
+                     "  To render: %.2f / %.2f / %.2f ms\n"
+                     "  To swap:   %.2f / %.2f / %.2f ms\n",
+                     (int)to_swap.count,
+                     to_render.p50, to_render.p95, to_render.p99,
+                     to_swap.p50, to_swap.p95, to_swap.p99);
+            ImGui::Text(msg);
+            if ( ImGui::Button("Export latency CSV") ) {
+                PATH_CHAR fname[MAX_PATH] = TO_PATH_STR("milton_latency.csv");
+                platform_fname_at_config(fname, MAX_PATH);
+                if ( latency_export_csv(milton->latency, fname) ) {
+                    milton_log("Wrote latency samples to %s\n", fname);
+                }
+                else {
+                    milton_log("Could not write %s\n", fname);
+                }
+            }
+
             float hist[] = { poll, update, raster, GL, system };
             ImGui::PlotHistogram("Graph",
                             (const float*)hist, array_count(hist));
@@ -1470,7 +1519,10 @@ b32
 gui_consume_input(MiltonGui* gui, MiltonInput const* input)
 {
     b32 accepts = false;
-    v2i point = VEC2I(input->points[0]);
+    v2i point = {};
+    if ( input->input_count > 0 ) {
+        point = VEC2I(input->points[0]);
+    }
     if ( gui->visible ) {
         accepts = gui_point_hovers(gui, point);
         if ( !picker_is_active(&gui->picker) &&
@@ -0,0 +1,332 @@
+// Copyright (c) 2015 Sergio Gonzalez. All rights reserved.
+// License: https://github.com/serge-rgb/milton#license
+
+
+#include "jobs.h"
+
+#include "DArray.h"
+#include "platform.h"
+#include "profiler.h"
+
+struct JobGroup;
+
+// A piece of a parallel_for range.
+struct JobTask
+{
+    JobGroup*   group;
+    i64         begin;
+    i64         end;
+};
+
+// One call to parallel_for. Lives on the stack of the caller.
+struct JobGroup
+{
+    JobRangeFunc*   func;
+    void*           data;
+    i64             grain;
+    SDL_atomic_t    remaining;  // Items that haven't run yet.
+};
+
+// The owner pushes and pops at the bottom, thieves take from the top. Tasks
+// are few and short-lived, so a spinlock is enough.
+struct JobDeque
+{
+    SDL_SpinLock        lock;
+    DArray<JobTask>     tasks;
+    i64                 top;  // Tasks before `top` were stolen.
+};
+
+struct MainJob
+{
+    JobMainFunc*    func;
+    void*           data;
+};
+
+struct JobSystem
+{
+    i32                 num_workers;
+    PlatformThread*     threads[JOBS_MAX_WORKERS];
+
+    // deques[0] is for the main thread and worker i uses deques[i + 1]. The
+    // last one is for the other threads, one at a time. See other_slot.
+    JobDeque            deques[JOBS_MAX_WORKERS + 2];
+    PlatformSemaphore*  other_slot;
+
+    PlatformSemaphore*  work_available;
+    SDL_atomic_t        sleeping;  // Workers waiting on work_available, or about to.
+    SDL_atomic_t        quit;
+
+    SDL_SpinLock        main_lock;
+    DArray<MainJob>     main_jobs;
+    DArray<MainJob>     main_running;  // Main thread only.
+};
+
+static JobSystem g_jobs;
+
+// 0 for the main thread, i + 1 for worker i and -1 for any other thread. A
+// thread holding other_slot gets num_workers + 1 until its parallel_for returns.
+static thread_local i32 t_job_thread = -1;
+
+static void
+deque_push(JobDeque* q, JobTask task)
+{
+    SDL_AtomicLock(&q->lock);
+    push(&q->tasks, task);
+    SDL_AtomicUnlock(&q->lock);
+}
+
+// Takes the newest task of `group`, or the newest task if group is NULL.
+static b32
+deque_pop(JobDeque* q, JobGroup* group, JobTask* out)
+{
+    b32 found = false;
+    SDL_AtomicLock(&q->lock);
+    for ( i64 i = q->tasks.count - 1; i >= q->top; --i ) {
+        if ( group == NULL || q->tasks.data[i].group == group ) {
+            *out = q->tasks.data[i];
+            for ( i64 j = i; j < q->tasks.count - 1; ++j ) {
+                q->tasks.data[j] = q->tasks.data[j + 1];
+            }
+            --q->tasks.count;
+            found = true;
+            break;
+        }
+    }
+    if ( q->top == q->tasks.count ) {
+        reset(&q->tasks);
+        q->top = 0;
+    }
+    SDL_AtomicUnlock(&q->lock);
+    return found;
+}
+
+// Takes the oldest task, which tends to be the largest.
+static b32
+deque_steal(JobDeque* q, JobTask* out)
+{
+    b32 found = false;
+    SDL_AtomicLock(&q->lock);
+    if ( q->top < q->tasks.count ) {
+        *out = q->tasks.data[q->top++];
+        found = true;
+        if ( q->top == q->tasks.count ) {
+            reset(&q->tasks);
+            q->top = 0;
+        }
+    }
+    SDL_AtomicUnlock(&q->lock);
+    return found;
+}
+
+static void
+wake_worker()
+{
+    if ( SDL_AtomicGet(&g_jobs.sleeping) > 0 ) {
+        platform_semaphore_post(g_jobs.work_available);
+    }
+}
+
+// Splits the task until it is grain-sized, leaving the other halves in `q`,
+// and runs what is left.
+static void
+run_task(JobTask task, i32 worker, JobDeque* q)
+{
+    JobGroup* group = task.group;
+    while ( task.end - task.begin > group->grain ) {
+        i64 mid = task.begin + (task.end - task.begin) / 2;
+        deque_push(q, JobTask{ group, mid, task.end });
+        wake_worker();
+        task.end = mid;
+    }
+    group->func(group->data, task.begin, task.end, worker);
+    SDL_AtomicAdd(&group->remaining, -(int)(task.end - task.begin));
+}
+
+static b32
+find_task(i32 thread, JobTask* out)
+{
+    i32 num_deques = g_jobs.num_workers + 2;
+    b32 found = deque_pop(&g_jobs.deques[thread], NULL, out);
+    for ( i32 i = 1; !found && i < num_deques; ++i ) {
+        found = deque_steal(&g_jobs.deques[(thread + i) % num_deques], out);
+    }
+    return found;
+}
+
+static int
+job_worker(void* data)
+{
+    i32 thread = (i32)(i64)data;
+    t_job_thread = thread;
+#if MILTON_ENABLE_TRACING
+    char name[32];
+    snprintf(name, sizeof(name), "Job worker %d", thread - 1);
+    trace_set_thread_name(name);
+#endif
+    for ( ;; ) {
+        JobTask task = {};
+        b32 found = find_task(thread, &task);
+        if ( !found ) {
+            SDL_AtomicAdd(&g_jobs.sleeping, 1);
+            // Look again. Tasks pushed from now on will post work_available.
+            found = find_task(thread, &task);
+            if ( !found ) {
+                if ( SDL_AtomicGet(&g_jobs.quit) ) {
+                    break;
+                }
+                platform_semaphore_wait(g_jobs.work_available);
+            }
+            SDL_AtomicAdd(&g_jobs.sleeping, -1);
+        }
+        if ( found ) {
+            run_task(task, thread, &g_jobs.deques[thread]);
+        }
+    }
+    return 0;
+}
+
+void
+jobs_init(i32 num_workers)
+{
+    mlt_assert(g_jobs.num_workers == 0);
+
+#if MILTON_MULTITHREADED
+    if ( num_workers < 0 ) {
+        num_workers = platform_cpu_count() - 1;
+    }
+    num_workers = min(max(num_workers, 0), JOBS_MAX_WORKERS);
+#else
+    num_workers = 0;
+#endif
+
+    t_job_thread = 0;
+    g_jobs.work_available = platform_semaphore_create(0);
+    g_jobs.other_slot = platform_semaphore_create(1);
+    // Workers steal from every deque, so the count is set before they start.
+    g_jobs.num_workers = num_workers;
+    for ( i32 i = 0; i < num_workers; ++i ) {
+        g_jobs.threads[i] = platform_thread_create(job_worker, (void*)(i64)(i + 1));
+        if ( !g_jobs.threads[i] ) {
+            milton_log("Could not create job worker %d\n", i);
+        }
+    }
+}
+
+void
+jobs_release()
+{
+    SDL_AtomicSet(&g_jobs.quit, 1);
+    for ( i32 i = 0; i < g_jobs.num_workers; ++i ) {
+        platform_semaphore_post(g_jobs.work_available);
+    }
+    for ( i32 i = 0; i < g_jobs.num_workers; ++i ) {
+        if ( g_jobs.threads[i] ) {
+            platform_thread_join(g_jobs.threads[i]);
+        }
+    }
+    if ( g_jobs.work_available ) {
+        platform_semaphore_destroy(g_jobs.work_available);
+    }
+    if ( g_jobs.other_slot ) {
+        platform_semaphore_destroy(g_jobs.other_slot);
+    }
+    for ( i32 i = 0; i < JOBS_MAX_WORKERS + 2; ++i ) {
+        release(&g_jobs.deques[i].tasks);
+    }
+    release(&g_jobs.main_jobs);
+    release(&g_jobs.main_running);
+    g_jobs = {};
+}
+
+i32
+jobs_num_threads()
+{
+    return g_jobs.num_workers + 2;
+}
+
+void
+parallel_for(i64 count, i64 grain, JobRangeFunc* func, void* data)
+{
+    grain = max(grain, (i64)1);
+
+    // Threads that aren't workers take turns with the last slot, so that
+    // `worker` is unique across everything that runs at the same time.
+    // Nested calls keep the slot they have.
+    b32 claimed_slot = false;
+    if ( t_job_thread < 0 && g_jobs.other_slot ) {
+        platform_semaphore_wait(g_jobs.other_slot);
+        t_job_thread = g_jobs.num_workers + 1;
+        claimed_slot = true;
+    }
+    i32 thread = max(t_job_thread, 0);
+    if ( count <= grain || g_jobs.num_workers == 0 ) {
+        if ( count > 0 ) {
+            func(data, 0, count, thread);
+        }
+    }
+    else {
+        mlt_assert(count <= INT_MAX);
+        JobGroup group = {};
+        group.func = func;
+        group.data = data;
+        group.grain = grain;
+        SDL_AtomicSet(&group.remaining, (int)count);
+
+        // Only this group's tasks are taken from our own deque, so that an
+        // outer task of a nested parallel_for isn't run from here.
+        JobDeque* q = &g_jobs.deques[thread];
+        run_task(JobTask{ &group, 0, count }, thread, q);
+        while ( SDL_AtomicGet(&group.remaining) > 0 ) {
+            JobTask task = {};
+            if ( deque_pop(q, &group, &task) ) {
+                run_task(task, thread, q);
+            }
+            else {
+                // The rest was stolen.
+                if ( t_job_thread == 0 ) {
+                    jobs_main_run();
+                }
+                platform_thread_yield();
+            }
+        }
+    }
+
+    if ( claimed_slot ) {
+        t_job_thread = -1;
+        platform_semaphore_post(g_jobs.other_slot);
+    }
+}
+
+void
+jobs_main_push(JobMainFunc* func, void* data)
+{
+    SDL_AtomicLock(&g_jobs.main_lock);
+    push(&g_jobs.main_jobs, MainJob{ func, data });
+    SDL_AtomicUnlock(&g_jobs.main_lock);
+}
+
+void
+jobs_main_run()
+{
+    mlt_assert(t_job_thread <= 0);
+
+    // Jobs pushed while these run wait for the next call.
+    SDL_AtomicLock(&g_jobs.main_lock);
+    DArray<MainJob> jobs = g_jobs.main_jobs;
+    g_jobs.main_jobs = g_jobs.main_running;
+    g_jobs.main_running = {};
+    SDL_AtomicUnlock(&g_jobs.main_lock);
+
+    for ( i64 i = 0; i < jobs.count; ++i ) {
+        jobs.data[i].func(jobs.data[i].data);
+    }
+
+    // Keep the array for the next call, unless a job ran this recursively.
+    if ( g_jobs.main_running.data == NULL ) {
+        reset(&jobs);
+        g_jobs.main_running = jobs;
+    }
+    else {
+        release(&jobs);
+    }
+}
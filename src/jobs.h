@@ -0,0 +1,56 @@
+// Copyright (c) 2015 Sergio Gonzalez. All rights reserved.
+// License: https://github.com/serge-rgb/milton#license
+
+// Job system
+//
+// - A pool of worker threads, each with its own deque of tasks. A worker
+//   takes tasks from the bottom of its deque and, when it runs out, steals
+//   from the top of the others.
+// - parallel_for splits a range in halves until they are `grain` items long.
+//   The halves that aren't run right away are pushed to the deque of the
+//   thread doing the split, where idle workers can steal them.
+// - The thread calling parallel_for helps with its own tasks until the range
+//   is done.
+// - Threads that are neither the main thread nor workers, like the save
+//   thread, share one more slot and take turns with it.
+// - Work that must happen on the main thread, like GL calls, goes to the main
+//   queue, which runs in jobs_main_run.
+//
+// Threads come from the platform layer, so tools without SDL can use it.
+// Before jobs_init, and with no workers, parallel_for runs on the caller.
+
+
+#pragma once
+
+#include "common.h"
+
+#define JOBS_MAX_WORKERS 64
+
+// Runs items [begin, end). `worker` is in [0, jobs_num_threads()) and no
+// other thread uses the same value at the same time, so it can index
+// per-thread scratch memory. The main thread is 0, and the other threads
+// that aren't workers get jobs_num_threads() - 1.
+typedef void JobRangeFunc(void* data, i64 begin, i64 end, i32 worker);
+
+typedef void JobMainFunc(void* data);
+
+// Starts `num_workers` threads. If num_workers is negative, one per core is
+// started, minus the calling thread. The calling thread becomes the main
+// thread.
+void    jobs_init(i32 num_workers);
+void    jobs_release();
+
+// Worker threads, plus one for the main thread and one for the rest.
+i32     jobs_num_threads();
+
+// Calls `func` over [0, count) in chunks of at least `grain` items and
+// returns when all of them are done. Can be called from any thread, and from
+// within a job. Threads that aren't the main thread or a worker wait for each
+// other here.
+void    parallel_for(i64 count, i64 grain, JobRangeFunc* func, void* data);
+
+// Queues `func` to run on the main thread. Can be called from any thread.
+void    jobs_main_push(JobMainFunc* func, void* data);
+// Runs the queued main thread work. The main thread also runs it while
+// waiting in parallel_for.
+void    jobs_main_run();
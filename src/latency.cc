@@ -0,0 +1,122 @@
+// Copyright (c) 2015 Sergio Gonzalez. All rights reserved.
+// License: https://github.com/serge-rgb/milton#license
+
+
+#include "latency.h"
+
+// Frames that are rendered but never swapped, like in tests, don't pile up.
+#define LATENCY_MAX_RENDERED LATENCY_HISTORY
+
+void
+latency_input(LatencyStats* stats, u64 input_time)
+{
+    push(&stats->pending, input_time);
+}
+
+void
+latency_rendered(LatencyStats* stats, b32 drawn, b32 in_progress, u64 time)
+{
+    if ( drawn ) {
+        if ( stats->rendered.count + stats->pending.count > LATENCY_MAX_RENDERED ) {
+            reset(&stats->rendered);
+        }
+        for ( i64 i = 0; i < stats->pending.count; ++i ) {
+            LatencySample s = {};
+            s.input = stats->pending.data[i];
+            s.render = time;
+            push(&stats->rendered, s);
+        }
+        reset(&stats->pending);
+    }
+    else if ( !in_progress ) {
+        reset(&stats->pending);
+    }
+}
+
+void
+latency_presented(LatencyStats* stats, u64 time)
+{
+    for ( i64 i = 0; i < stats->rendered.count; ++i ) {
+        LatencySample s = stats->rendered.data[i];
+        s.swap = time;
+        stats->history[stats->count % LATENCY_HISTORY] = s;
+        stats->count += 1;
+    }
+    reset(&stats->rendered);
+}
+
+static f32
+latency_ms(LatencySample* s, LatencyStage stage)
+{
+    u64 end = stage == LatencyStage_RENDER ? s->render : s->swap;
+    // Clock readings from different cores can be slightly out of order.
+    return end > s->input ? perf_count_to_sec(end - s->input) * 1000.0f : 0.0f;
+}
+
+static int
+compare_f32(const void* a, const void* b)
+{
+    f32 fa = *(f32*)a;
+    f32 fb = *(f32*)b;
+    return (fa > fb) - (fa < fb);
+}
+
+LatencyPercentiles
+latency_percentiles(LatencyStats* stats, LatencyStage stage)
+{
+    LatencyPercentiles result = {};
+    i64 n = min(stats->count, (i64)LATENCY_HISTORY);
+    if ( n > 0 ) {
+        f32* sorted = (f32*)mlt_calloc((size_t)n, sizeof(f32), "Latency");
+        for ( i64 i = 0; i < n; ++i ) {
+            sorted[i] = latency_ms(&stats->history[i], stage);
+        }
+        qsort(sorted, (size_t)n, sizeof(f32), compare_f32);
+
+        // Nearest rank.
+        auto rank = [sorted, n](i64 percent) {
+            i64 r = (percent * n + 99) / 100;
+            return sorted[max(r, (i64)1) - 1];
+        };
+        result.count = n;
+        result.p50 = rank(50);
+        result.p95 = rank(95);
+        result.p99 = rank(99);
+
+        mlt_free(sorted, "Latency");
+    }
+    return result;
+}
+
+b32
+latency_export_csv(LatencyStats* stats, const PATH_CHAR* path)
+{
+    FILE* fd = platform_fopen(path, TO_PATH_STR("wb"));
+    if ( !fd ) {
+        return false;
+    }
+    i64 n = min(stats->count, (i64)LATENCY_HISTORY);
+    i64 first = stats->count - n;
+    u64 start = n > 0 ? stats->history[first % LATENCY_HISTORY].input : 0;
+
+    fprintf(fd, "sample,input_ms,input_to_render_ms,input_to_swap_ms\n");
+    for ( i64 i = first; i < stats->count; ++i ) {
+        LatencySample* s = &stats->history[i % LATENCY_HISTORY];
+        f32 input_ms = s->input > start ? perf_count_to_sec(s->input - start) * 1000.0f : 0.0f;
+        fprintf(fd, "%" PRIi64 ",%.3f,%.3f,%.3f\n",
+                i, input_ms, latency_ms(s, LatencyStage_RENDER), latency_ms(s, LatencyStage_SWAP));
+    }
+
+    b32 ok = !ferror(fd);
+    if ( fclose(fd) != 0 ) {
+        ok = false;
+    }
+    return ok;
+}
+
+void
+latency_release(LatencyStats* stats)
+{
+    release(&stats->pending);
+    release(&stats->rendered);
+}
@@ -0,0 +1,70 @@
+// Copyright (c) 2015 Sergio Gonzalez. All rights reserved.
+// License: https://github.com/serge-rgb/milton#license
+
+// Latency
+//
+// Input-to-photon latency of drawing. Each pointer sample that is added to
+// the working stroke is followed until the first frame that draws it, and
+// then until that frame is swapped. The last LATENCY_HISTORY samples are
+// kept for percentiles and CSV export.
+//
+// Times are perf_counter(). A sample's time is when its event was queued by
+// the system, as far as SDL tells. See push_input_sample
+
+
+#pragma once
+
+#include "common.h"
+#include "DArray.h"
+#include "platform.h"
+
+#define LATENCY_HISTORY 4096
+
+enum LatencyStage
+{
+    LatencyStage_RENDER,  // Input to the end of the gpu_render that drew it.
+    LatencyStage_SWAP,    // Input to SDL_GL_SwapWindow returning.
+
+    LatencyStage_COUNT,
+};
+
+struct LatencySample
+{
+    u64 input;
+    u64 render;
+    u64 swap;
+};
+
+struct LatencyStats
+{
+    DArray<u64>             pending;   // Input times of samples that no frame has drawn.
+    DArray<LatencySample>   rendered;  // Drawn, waiting for the swap.
+
+    LatencySample           history[LATENCY_HISTORY];
+    i64                     count;  // Samples measured since the start.
+};
+
+struct LatencyPercentiles
+{
+    i64 count;  // Samples they were taken from.
+    f32 p50;    // In milliseconds.
+    f32 p95;
+    f32 p99;
+};
+
+// A sample was added to the working stroke.
+void    latency_input(LatencyStats* stats, u64 input_time);
+// Called after gpu_render. `drawn` is true if the samples added so far are on
+// screen, in the working stroke or in the stroke it just became. Samples that
+// weren't drawn wait for a later frame while `in_progress`, and are dropped
+// otherwise.
+void    latency_rendered(LatencyStats* stats, b32 drawn, b32 in_progress, u64 time);
+// Called after the swap.
+void    latency_presented(LatencyStats* stats, u64 time);
+
+LatencyPercentiles latency_percentiles(LatencyStats* stats, LatencyStage stage);
+
+// One row per sample, oldest first. Returns false if the file can't be written.
+b32     latency_export_csv(LatencyStats* stats, const PATH_CHAR* path);
+
+void    latency_release(LatencyStats* stats);
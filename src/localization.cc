@@ -101,6 +101,8 @@ init_localization()
         EN(TXT_OPENBRACKET_default_canvas_CLOSE_BRACKET, "[Default canvas]");
         EN(TXT_could_not_delete_default_canvas, "Could not delete default canvas. Contents will be still there when you create a new canvas.");
         EN(TXT_peek_out_increment_percent, "Peek-out increment percentage");
+        EN(TXT_compress_canvas_files, "Compress canvas files (smaller, slower to open)");
+        EN(TXT_stroke_memory_mb, "GPU memory for strokes (MB)");
         EN(TXT_opacity_pressure, "Use pressure for opacity");
         EN(TXT_soft_brush, "Soft brush");
         EN(TXT_minimum, "Minimum");
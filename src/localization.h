@@ -84,6 +84,8 @@ enum Texts
     TXT_background_COLON,
     TXT_could_not_delete_default_canvas,
     TXT_peek_out_increment_percent,
+    TXT_compress_canvas_files,
+    TXT_stroke_memory_mb,
     TXT_opacity_pressure,
     TXT_soft_brush,
     TXT_minimum,
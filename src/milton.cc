@@ -390,7 +390,7 @@ peek_out_interpolation(Milton* milton)
 {
     float interp = 0.0f;
 
-    WallTime time = platform_get_walltime();
+    WallTime time = milton_clock_walltime(milton);
     u64 ms = difference_in_ms(milton->peek_out->begin_anim_time, time);
 
     if (ms < peek_out_duration_ms(milton)) {
@@ -466,6 +466,9 @@ milton_stroke_input(Milton* milton, MiltonInput const* input)
             pressure = 1.0f;
         }
 
+        if ( input->times && ws->num_points < STROKE_MAX_POINTS ) {
+            latency_input(milton->latency, input->times[input_i]);
+        }
         stroke_append_point(ws, canvas_point, pressure);
     }
 }
@@ -505,12 +508,19 @@ milton_set_canvas_file_(Milton* milton, PATH_CHAR* fname, b32 is_default)
         milton_log("milton_set_canvas_file: fname was too long %lu\n", len);
         fname = TO_PATH_STR("MiltonPersist.mlt");
     }
+    // The journal next to the new file, if any, doesn't describe this canvas.
+    // Done before changing the path so that a save in progress can finish with the old one.
+    milton_journal_reset_queue(milton);
+
     milton->persist->mlt_file_path = fname;
 
-    if ( !is_default ) {
-        milton_set_last_canvas_fname(fname);
-    } else {
-        milton_unset_last_canvas_fname();
+    // milton-render leaves alone the canvas that Milton opens next.
+    if ( !(milton->flags & MiltonStateFlags_HEADLESS) ) {
+        if ( !is_default ) {
+            milton_set_last_canvas_fname(fname);
+        } else {
+            milton_unset_last_canvas_fname();
+        }
     }
 }
 
@@ -614,6 +624,7 @@ settings_init(MiltonSettings* s)
 {
     s->background_color = v3f{1,1,1};
     s->peek_out_increment = DEFAULT_PEEK_OUT_INCREMENT_LOG;
+    s->stroke_memory_mb = DEFAULT_STROKE_MEMORY_MB;
 }
 
 int milton_save_thread(void* state_);  // forward
@@ -633,6 +644,10 @@ milton_init(Milton* milton, i32 width, i32 height, f32 ui_scale, PATH_CHAR* file
     b32 init_graphics = !(init_flags & MiltonInit_FOR_TEST);
     b32 read_from_disk = !(init_flags & MiltonInit_FOR_TEST);
 
+    if ( init_flags & MiltonInit_HEADLESS ) {
+        milton->flags |= MiltonStateFlags_HEADLESS;
+    }
+
     init_localization();
 
     milton->canvas = arena_bootstrap(CanvasState, arena, 1024*1024);
@@ -658,9 +673,16 @@ milton_init(Milton* milton, i32 width, i32 height, f32 ui_scale, PATH_CHAR* file
     milton->drag_brush = arena_alloc_elem(&milton->root_arena, MiltonDragBrush);
     milton->drag_zoom = arena_alloc_elem(&milton->root_arena, MiltonDragZoom);
     milton->transform = arena_alloc_elem(&milton->root_arena, TransformMode);
+    milton->latency = arena_alloc_elem(&milton->root_arena, LatencyStats);
 
     milton->persist->target_MB_per_sec = 0.2f;
 
+#if MILTON_SAVE_ASYNC
+    // Created before anything touches the journal queue.
+    milton->save_mutex = SDL_CreateMutex();
+    milton->save_cond = SDL_CreateCond();
+#endif
+
     gui_init(&milton->root_arena, milton->gui, ui_scale);
     settings_init(milton->settings);
 
@@ -756,8 +778,6 @@ milton_init(Milton* milton, i32 width, i32 height, f32 ui_scale, PATH_CHAR* file
 #endif
 
 #if MILTON_SAVE_ASYNC
-    milton->save_mutex = SDL_CreateMutex();
-    milton->save_cond = SDL_CreateCond();
     milton->save_thread = SDL_CreateThread(milton_save_thread, "Save thread", (void*)milton);
 #endif
 }
@@ -814,10 +834,14 @@ milton_reset_canvas(Milton* milton)
     milton->persist->mlt_binary_version = MILTON_MINOR_VERSION;
     milton->persist->last_save_time = {};
 
+    // Queued journal records point into the canvas arena.
+    milton_journal_reset_queue(milton);
+
     // Clear history
     release(&canvas->history);
     release(&canvas->redo_stack);
     release(&canvas->stroke_graveyard);
+    platform_unmap_file(&canvas->mapped_file);
 
     size_t size = canvas->arena.min_block_size;
     arena_free(&canvas->arena);  // Note: This destroys the canvas
@@ -918,14 +942,215 @@ milton_try_quit(Milton* milton)
     milton->flags &= ~MiltonStateFlags_RUNNING;
 }
 
+u64
+milton_clock_ms(Milton* milton)
+{
+    return milton->clock.fixed ? milton->clock.ms : (u64)SDL_GetTicks();
+}
+
+WallTime
+milton_clock_walltime(Milton* milton)
+{
+    if ( !milton->clock.fixed ) {
+        return platform_get_walltime();
+    }
+    WallTime t = milton->clock.start;
+    u64 ms = t.ms + milton->clock.ms;
+    u64 s = t.s + ms / 1000;
+    u64 m = t.m + s / 60;
+    u64 h = t.h + m / 60;
+    t.ms = (i32)(ms % 1000);
+    t.s = (i32)(s % 60);
+    t.m = (i32)(m % 60);
+    t.h = (i32)(h % 24);
+    return t;
+}
+
 void
-milton_save_postlude(Milton* milton)
+milton_clock_set(Milton* milton, WallTime start, u64 ms)
+{
+    milton->clock.fixed = true;
+    milton->clock.start = start;
+    milton->clock.ms = ms;
+}
+
+void
+milton_lock_save(Milton* milton)
+{
+#if MILTON_SAVE_ASYNC
+    SDL_LockMutex(milton->save_mutex);
+#endif
+}
+
+void
+milton_unlock_save(Milton* milton)
+{
+#if MILTON_SAVE_ASYNC
+    SDL_UnlockMutex(milton->save_mutex);
+#endif
+}
+
+void
+milton_journal_push(Milton* milton, JournalRecord record)
+{
+    milton_lock_save(milton);
+    push(&milton->persist->journal_queue, record);
+    milton_unlock_save(milton);
+}
+
+// Frees the active snapshot once the save thread is done with it.
+static void
+milton_collect_snapshot(Milton* milton)
+{
+    MiltonPersist* p = milton->persist;
+    if ( p->active_snapshot && SDL_AtomicGet(&p->active_snapshot->done) ) {
+        milton_free_snapshot(p->active_snapshot);
+        p->active_snapshot = NULL;
+    }
+}
+
+// Drops queued records and makes the next save a full one.
+void
+milton_journal_reset_queue(Milton* milton)
+{
+    MiltonPersist* p = milton->persist;
+    milton_lock_save(milton);
+    reset(&p->journal_queue);
+    reset(&p->journal_carry);
+    p->compaction_requested = true;
+    p->journal_bytes = 0;
+    p->epoch += 1;
+    if ( p->pending_snapshot ) {
+        // Never reached the save thread.
+        SDL_AtomicSet(&p->pending_snapshot->done, 1);
+        p->pending_snapshot = NULL;
+    }
+    milton_unlock_save(milton);
+
+    // The caller might be about to free the canvas.
+    while ( SDL_AtomicGet(&p->save_in_progress) ) {
+        SDL_Delay(1);
+    }
+    milton_collect_snapshot(milton);
+    mlt_assert(p->active_snapshot == NULL);
+}
+
+// Request a full save if the journal got too big, or if something changed
+// that the journal can't express. Takes a snapshot for the save thread if
+// there is a request and no snapshot is being written.
+static void
+milton_update_compaction_request(Milton* milton, b32 force)
+{
+    MiltonPersist* p = milton->persist;
+    milton_collect_snapshot(milton);
+
+    u64 layers_hash = layer::hash_layers(milton->canvas->root_layer);
+    b32 take_snapshot = false;
+    milton_lock_save(milton);
+    {
+        if ( force || layers_hash != p->layers_hash || milton_journal_needs_compaction(p) ) {
+            p->compaction_requested = true;
+        }
+        take_snapshot = p->compaction_requested && p->active_snapshot == NULL;
+    }
+    milton_unlock_save(milton);
+    p->layers_hash = layers_hash;
+
+    if ( take_snapshot ) {
+        CanvasSnapshot* snapshot = milton_canvas_snapshot(milton, /*attach*/true);
+        milton_lock_save(milton);
+        {
+            // The snapshot contains everything in the queue.
+            reset(&p->journal_queue);
+            p->compaction_requested = false;
+            p->pending_snapshot = snapshot;
+        }
+        milton_unlock_save(milton);
+        p->active_snapshot = snapshot;
+    }
+}
+
+// Writes the records queued since the last save. If there is a pending
+// snapshot, writes it and starts a new journal.
+static u64
+milton_save_pending(Milton* milton, b32 allow_compaction)
 {
+    TRACE_FUNCTION();
     MiltonPersist* p = milton->persist;
-    p->last_save_time = platform_get_walltime();
-    p->last_save_stroke_count = layer::count_strokes(milton->canvas->root_layer);
 
-    milton->flags &= ~MiltonStateFlags_LAST_SAVE_FAILED;
+    DArray<JournalRecord> records = {};
+    DArray<JournalRecord> carry = {};
+    CanvasSnapshot* snapshot = NULL;
+
+    milton_lock_save(milton);
+    {
+        records = p->journal_queue;
+        p->journal_queue = {};
+        if ( p->pending_snapshot ) {
+            if ( allow_compaction ) {
+                snapshot = p->pending_snapshot;
+                p->pending_snapshot = NULL;
+                carry = p->journal_carry;
+                p->journal_carry = {};
+            }
+            else {
+                // These go to the old journal now, and to the new one after
+                // the snapshot is written.
+                for ( i64 i = 0; i < records.count; ++i ) {
+                    push(&p->journal_carry, records[i]);
+                }
+            }
+        }
+        SDL_AtomicSet(&p->save_in_progress, 1);
+    }
+    milton_unlock_save(milton);
+
+    u64 bytes_written = 0;
+    if ( snapshot ) {
+        bytes_written = milton_save_snapshot(milton, snapshot);
+
+        milton_lock_save(milton);
+        milton_commit_snapshot(milton, snapshot);
+        if ( !snapshot->saved ) {
+            p->compaction_requested = true;
+        }
+        milton_unlock_save(milton);
+
+        if ( snapshot->saved ) {
+            bytes_written += milton_journal_append(milton, carry.data, carry.count);
+        }
+        // If the snapshot failed, the old journal still matches the file on disk.
+        bytes_written += milton_journal_append(milton, records.data, records.count);
+
+        SDL_AtomicSet(&snapshot->done, 1);
+    }
+    else {
+        bytes_written = milton_journal_append(milton, records.data, records.count);
+    }
+
+    milton_lock_save(milton);
+    p->bytes_written += bytes_written;
+    milton_unlock_save(milton);
+
+    SDL_AtomicSet(&p->save_in_progress, 0);
+
+    release(&carry);
+    release(&records);
+    return bytes_written;
+}
+
+// Journal failures are reported by the save thread, and go to milton->flags
+// here, on the main thread.
+static void
+milton_update_save_flags(Milton* milton)
+{
+    MiltonPersist* p = milton->persist;
+    milton_lock_save(milton);
+    if ( p->journal_failed ) {
+        milton->flags |= MiltonStateFlags_LAST_SAVE_FAILED;
+        p->journal_failed = false;
+    }
+    milton_unlock_save(milton);
 }
 
 #if MILTON_SAVE_ASYNC
@@ -960,27 +1185,43 @@ milton_save_thread(void* state_)
     Milton* milton = (Milton*)state_;
     MiltonPersist* p = milton->persist;
 
+#if MILTON_ENABLE_TRACING
+    trace_set_thread_name("Save thread");
+#endif
+
     b32 running = true;
     float time_to_wait_s = 0.0f;
     u64 wait_begin_us = perf_counter();
 
     while ( running ) {
         bool do_save = false;
+        bool allow_compaction = false;
         SDL_LockMutex(milton->save_mutex);
 
-        SDL_CondWait(milton->save_cond, milton->save_mutex); // Wait for a frame tick.
+        // Wait for a frame tick. A kill may have come while we were saving, or
+        // before the thread got here, and its signal is gone.
+        if ( milton->save_flag != SaveEnum_KILL ) {
+            SDL_CondWait(milton->save_cond, milton->save_mutex);
+        }
 
         if ( milton->save_flag == SaveEnum_KILL ) {
             running = false;
         }
         else {
             float time_waited_s = perf_count_to_sec(perf_counter() - wait_begin_us);
-            if (time_waited_s <= time_to_wait_s) {
+            bool throttled = time_waited_s <= time_to_wait_s;
+            if ( throttled ) {
                 time_to_wait_s -= time_waited_s;
             }
             else {
-                if ( milton->save_flag == SaveEnum_SAVE_REQUESTED ) {
-                    do_save = true;
+                time_to_wait_s = 0.0f;
+            }
+            if ( milton->save_flag == SaveEnum_SAVE_REQUESTED ) {
+                // Journal records are small and always go out right away.
+                // Compaction waits until we are below the target bandwidth.
+                do_save = true;
+                allow_compaction = !throttled;
+                if ( allow_compaction || p->pending_snapshot == NULL ) {
                     milton->save_flag = SaveEnum_WAITING;
                 }
             }
@@ -991,7 +1232,7 @@ milton_save_thread(void* state_)
         if ( do_save ) {
             // Wait. Either one frame, or the time to stay below bandwidth.
             u64 begin_us = perf_counter();
-            u64 bytes_written = milton_save(milton);
+            u64 bytes_written = milton_save_pending(milton, allow_compaction);
             u64 duration_us = perf_counter() - begin_us;
 
             // Sleep, if necessary.
@@ -1028,6 +1269,7 @@ milton_new_layer_with_id(Milton* milton, i32 new_id)
         layer->id = new_id;
         layer->flags = LayerFlags_VISIBLE;
         layer->strokes.arena = &canvas->arena;
+        layer->stroke_index.arena = &canvas->arena;
         layer->alpha = 1.0f;
         strokelist_init_bucket(&layer->strokes.root);
     }
@@ -1180,7 +1422,7 @@ peek_out_trigger_start(Milton* milton, int peek_out_flags)
     milton->peek_out->low_scale = milton_render_scale(milton);
     milton->peek_out->high_scale = peek_out_target_scale(milton);
     milton->peek_out->peek_out_ended = false;
-    milton->peek_out->begin_anim_time = platform_get_walltime();
+    milton->peek_out->begin_anim_time = milton_clock_walltime(milton);
     milton->peek_out->flags = peek_out_flags;
 
     if (milton->current_mode != MiltonMode::PEEK_OUT) {
@@ -1197,7 +1439,7 @@ peek_out_trigger_stop(Milton* milton)
         i64 scale = milton_render_scale(milton);
         milton->peek_out->high_scale = scale;
         milton->peek_out->low_scale = milton->view->scale;
-        milton->peek_out->begin_anim_time = platform_get_walltime();
+        milton->peek_out->begin_anim_time = milton_clock_walltime(milton);
         milton->peek_out->peek_out_ended = true;
         milton->peek_out->end_pan = raster_to_canvas_with_scale(milton->view, v2i_to_v2l(milton->platform->pointer), scale);
     }
@@ -1227,7 +1469,7 @@ peek_out_tick(Milton* milton, MiltonInput const* input)
             milton->view->zoom_center = milton->view->screen_size / 2;
             gpu_update_canvas(milton->renderer, milton->canvas, milton->view);
 
-            if ( difference_in_ms(peek->begin_anim_time, platform_get_walltime()) > peek_out_duration_ms(milton) ) {
+            if ( difference_in_ms(peek->begin_anim_time, milton_clock_walltime(milton)) > peek_out_duration_ms(milton) ) {
                 milton_leave_mode(milton);
             }
         }
@@ -1389,15 +1631,18 @@ transform_tick(Milton* milton, MiltonInput const* input)
 void
 milton_update_and_render(Milton* milton, MiltonInput const* input)
 {
+    TRACE_FUNCTION();
     imm_begin_frame(milton->renderer);
 
     PROFILE_GRAPH_BEGIN(update);
 
     b32 end_stroke = (input->flags & MiltonInputFlags_END_STROKE) || (milton->flags & MiltonStateFlags_FINISH_CURRENT_STROKE);
+    b32 stroke_committed = false;  // The working stroke was pushed to its layer.
 
     milton->flags &= ~MiltonStateFlags_FINISH_CURRENT_STROKE;
 
-    milton->render_settings.do_full_redraw = false;
+    // Keep drawing the strokes that the last frame didn't get to.
+    milton->render_settings.do_full_redraw = milton->render_settings.render_in_progress;
 
     b32 brush_outline_should_draw = false;
     int render_flags = RenderBackendFlags_NONE;
@@ -1417,8 +1662,6 @@ milton_update_and_render(Milton* milton, MiltonInput const* input)
         milton->render_settings.do_full_redraw = true;
     }
 
-    i32 now = (i32)SDL_GetTicks();
-
     // Set GUI visibility
     {
         size_t idx = get_gui_visibility_index(milton);
@@ -1462,8 +1705,8 @@ milton_update_and_render(Milton* milton, MiltonInput const* input)
         gpu_update_scale(milton->renderer, milton->view->scale);
     }
     else if ( (input->flags & MiltonInputFlags_PANNING) ) {
-        // If we are *not* zooming and we are panning, we can copy most of the
-        // framebuffer
+        // If we are *not* zooming and we are panning, the layer caches are
+        // shifted and only the strips that come into view are drawn.
         if ( !(input->pan_delta == v2l{}) ) {
             milton->render_settings.do_full_redraw = true;
         }
@@ -1483,9 +1726,9 @@ milton_update_and_render(Milton* milton, MiltonInput const* input)
                 // found a thing to undo.
                 if ( l ) {
                     if ( l->strokes.count > 0 ) {
-                        Stroke* stroke_ptr = peek(&l->strokes);
-                        Stroke stroke = pop(&l->strokes);
+                        Stroke stroke = layer::layer_pop_stroke(l);
                         push(&milton->canvas->stroke_graveyard, stroke);
+                        milton_journal_push(milton, { JournalRecord_STROKE_POP, l->id, l->strokes.count });
                         push(&milton->canvas->redo_stack, h);
 
                         milton->render_settings.do_full_redraw = true;
@@ -1503,8 +1746,9 @@ milton_update_and_render(Milton* milton, MiltonInput const* input)
                     if ( l && count(&milton->canvas->stroke_graveyard) > 0 ) {
                         Stroke stroke = pop(&milton->canvas->stroke_graveyard);
                         if ( stroke.layer_id == h.layer_id ) {
-                            push(&l->strokes, stroke);
+                            layer::layer_push_stroke(l, stroke);
                             push(&milton->canvas->history, h);
+                            milton_journal_push(milton, { JournalRecord_STROKE_ADD, l->id, l->strokes.count - 1, stroke });
 
                             milton->render_settings.do_full_redraw = true;
 
@@ -1577,14 +1821,18 @@ milton_update_and_render(Milton* milton, MiltonInput const* input)
         }
         else if ( !milton->gui->owns_user_input
                   && (milton->canvas->working_layer->flags & LayerFlags_VISIBLE) ) {
-            if ( milton->current_mode == MiltonMode::PRIMITIVE_LINE ) {
-                milton_primitive_line_input(milton, input, end_stroke);
-            }
-            else if ( milton->current_mode == MiltonMode::PRIMITIVE_RECTANGLE ) {
-                milton_primitive_rectangle_input(milton, input, end_stroke);
-            }
-            else if ( milton->current_mode == MiltonMode::PRIMITIVE_GRID ) {
-                milton_primitive_grid_input(milton, input, end_stroke);
+            if ( mode_is_for_primitives(milton->current_mode) ) {
+                if ( milton->current_mode == MiltonMode::PRIMITIVE_LINE ) {
+                    milton_primitive_line_input(milton, input, end_stroke);
+                }
+                else if ( milton->current_mode == MiltonMode::PRIMITIVE_RECTANGLE ) {
+                    milton_primitive_rectangle_input(milton, input, end_stroke);
+                }
+                else if ( milton->current_mode == MiltonMode::PRIMITIVE_GRID ) {
+                    milton_primitive_grid_input(milton, input, end_stroke);
+                }
+                // Primitives move points that were already drawn.
+                gpu_reset_stroke(milton->renderer, milton->working_stroke.render_handle);
             }
             else if ( milton->current_mode != MiltonMode::DRAG_BRUSH_SIZE )  {  // Input for eraser and pen
                 Stroke* ws = &milton->working_stroke;
@@ -1683,7 +1931,11 @@ milton_update_and_render(Milton* milton, MiltonInput const* input)
                 HistoryElement h = { HistoryElement_STROKE_ADD, milton->canvas->working_layer->id };
                 push(&milton->canvas->history, h);
 
+                Layer* l = milton->canvas->working_layer;
+                milton_journal_push(milton, { JournalRecord_STROKE_ADD, l->id, l->strokes.count - 1, *stroke });
+
                 reset_working_stroke(milton);
+                stroke_committed = true;
 
                 clear_stroke_redo(milton);
 
@@ -1776,16 +2028,27 @@ milton_update_and_render(Milton* milton, MiltonInput const* input)
     }
 
     if ( should_save ) {
+        b32 full_save = !(milton->flags & MiltonStateFlags_RUNNING) ||
+                        (input->flags & MiltonInputFlags_OPEN_FILE) ||
+                        (input->flags & MiltonInputFlags_SAVE_FILE);
         if ( !(milton->flags & MiltonStateFlags_RUNNING) ) {
-            // Always save synchronously when exiting.
-            milton_save(milton);
+            // Let the save thread finish what it's writing.
+            milton_kill_save_thread(milton);
+        }
+        milton_update_compaction_request(milton, full_save);
+
+        // Always save synchronously when exiting.
+        if (    !(milton->flags & MiltonStateFlags_RUNNING)
+             || (milton->flags & MiltonStateFlags_SYNC_SAVES) ) {
+            milton_save_pending(milton, true);
         } else {
 #if MILTON_SAVE_ASYNC
             trigger_async_save(milton);
 #else
-            milton_save(milton);
+            milton_save_pending(milton, true);
 #endif
         }
+        milton_update_save_flags(milton);
         // We're about to close and the last save failed and the drawing changed.
         if (    !(milton->flags & MiltonStateFlags_RUNNING)
              && (milton->flags & MiltonStateFlags_LAST_SAVE_FAILED)
@@ -1829,7 +2092,6 @@ milton_update_and_render(Milton* milton, MiltonInput const* input)
 
         // About to quit.
         if ( !(milton->flags & MiltonStateFlags_RUNNING) ) {
-            milton_kill_save_thread(milton);
             // Release resources
             milton_reset_canvas(milton);
             gpu_release_data(milton->renderer);
@@ -1858,7 +2120,6 @@ milton_update_and_render(Milton* milton, MiltonInput const* input)
 
     gpu_reset_render_flags(milton->renderer, render_flags);
 
-    ClipFlags clip_flags = ClipFlags_JUST_CLIP;
 
 #if REDRAW_EVERY_FRAME
     milton->render_settings.do_full_redraw = true;
@@ -1903,10 +2164,6 @@ milton_update_and_render(Milton* milton, MiltonInput const* input)
     if ( milton->render_settings.do_full_redraw ) {
         view_width = milton->view->screen_size.w;
         view_height = milton->view->screen_size.h;
-        // Only update GPU data if we are redrawing the full screen. This means
-        // that the size of the screen will be used to determine if each stroke
-        // should be freed from GPU memory.
-        clip_flags = ClipFlags_UPDATE_GPU_DATA;
         scale_of_last_full_redraw = milton_render_scale(milton);
         angle_of_last_full_redraw = milton->view->angle;
     }
@@ -1924,12 +2181,26 @@ milton_update_and_render(Milton* milton, MiltonInput const* input)
 
     i64 render_scale = milton_render_scale(milton);
 
-    gpu_clip_strokes_and_update(&milton->root_arena, milton->renderer, milton->view, render_scale,
-                                milton->canvas->root_layer, &milton->working_stroke,
-                                view_x, view_y, view_width, view_height, clip_flags);
+    // Without graphics, as in headless replays, there is nothing to draw to.
+    if ( milton->gl ) {
+        gpu_set_stroke_budget(milton->renderer, (i64)milton->settings->stroke_memory_mb << 20);
+        gpu_clip_strokes_and_update(&milton->root_arena, milton->renderer, milton->view, render_scale,
+                                    milton->canvas->root_layer, &milton->working_stroke,
+                                    view_x, view_y, view_width, view_height,
+                                    (ClipFlags)(ClipFlags_LAYER_CACHES | ClipFlags_DRAW_ITERATIVELY));
+    }
     PROFILE_GRAPH_END(clipping);
 
-    gpu_render(milton->renderer, view_x, view_y, view_width, view_height);
+    milton->render_settings.render_in_progress = milton->gl && gpu_render_in_progress(milton->renderer);
+
+    if ( milton->gl ) {
+        gpu_render(milton->renderer, view_x, view_y, view_width, view_height);
+    }
+
+    latency_rendered(milton->latency,
+                     gpu_working_stroke_clipped(milton->renderer) || stroke_committed,
+                     milton->working_stroke.num_points > 0,
+                     perf_counter());
 
     ARENA_VALIDATE(&milton->root_arena);
 }
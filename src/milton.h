@@ -8,12 +8,12 @@
 #include "system_includes.h"
 #include "canvas.h"
 #include "DArray.h"
+#include "latency.h"
 #include "profiler.h"
 
 #define STROKE_MAX_POINTS           2048
 #define MILTON_DEFAULT_SCALE        (1 << 10)
 #define NO_PRESSURE_INFO            -1.0f
-#define MAX_INPUT_BUFFER_ELEMS      32
 #define MILTON_MAX_BRUSH_SIZE       300
 #define MILTON_MAX_GRID_SIZE        32
 #define HOVER_FLASH_THRESHOLD_MS    500  // How long does the hidden brush hover show when it has changed size.
@@ -72,6 +72,7 @@ struct RenderBackend;
 struct CanvasView;
 struct Layer;
 struct MiltonPersist;
+struct JournalRecord;
 struct MiltonBindings;
 
 // Stuff than can be reset when unloading a canvas
@@ -89,6 +90,8 @@ struct CanvasState
     DArray<Stroke>         stroke_graveyard;
 
     i32         stroke_id_count;
+
+    PlatformFileMapping mapped_file;  // Loaded strokes may point into it. Unmapped on reset.
 };
 
 enum PrimitiveFSM
@@ -105,6 +108,10 @@ struct MiltonSettings
     float peek_out_increment;
 
     MiltonBindings bindings;
+
+    b32 compress_canvas;  // Smaller .mlt files. Loading can't use the point data in place.
+
+    i32 stroke_memory_mb;  // GPU memory budget for strokes. See gpu_set_stroke_budget
 };
 #pragma pack(pop)
 
@@ -142,6 +149,7 @@ struct PeekOut
 struct RenderSettings
 {
     b32 do_full_redraw;
+    b32 render_in_progress;  // A full redraw is being drawn over several frames.
 };
 
 struct MiltonDragBrush
@@ -170,6 +178,16 @@ struct TransformMode
     v2f last_point;
 };
 
+// Time as seen by the update. The system clock, unless `fixed` is set. Input
+// recordings set it to the frame time, so that replays see the same times.
+// See replay.h
+struct MiltonClock
+{
+    b32         fixed;
+    WallTime    start;  // Wall time when ms was 0.
+    u64         ms;
+};
+
 struct Milton
 {
     u32 flags;  // See MiltonStateFlags
@@ -232,6 +250,9 @@ struct Milton
     MiltonDragZoom* drag_zoom;
     PeekOut* peek_out;
     TransformMode* transform;
+    LatencyStats* latency;
+
+    MiltonClock clock;
 
     // Primitives
     i32 grid_rows;
@@ -247,7 +268,7 @@ enum MiltonStateFlags
 {
     MiltonStateFlags_RUNNING                = 1 << 0,
     MiltonStateFlags_FINISH_CURRENT_STROKE  = 1 << 1,
-                                            // 1 << 2 unused
+    MiltonStateFlags_SYNC_SAVES             = 1 << 2,  // Save on the main thread, so that saves don't depend on timing.
     MiltonStateFlags_JUST_SAVED             = 1 << 3,
     MiltonStateFlags_NEW_CANVAS             = 1 << 4,
     MiltonStateFlags_DEFAULT_CANVAS         = 1 << 5,
@@ -257,6 +278,7 @@ enum MiltonStateFlags
     MiltonStateFlags_LAST_SAVE_FAILED       = 1 << 9,
     MiltonStateFlags_MOVE_FILE_FAILED       = 1 << 10,
     MiltonStateFlags_BRUSH_SMOOTHING        = 1 << 11,
+    MiltonStateFlags_HEADLESS               = 1 << 12,  // No one to answer dialogs. See MiltonInit_HEADLESS
 };
 
 enum MiltonInputFlags
@@ -283,8 +305,10 @@ struct MiltonInput
     int flags;  // MiltonInputFlags
     MiltonMode mode_to_set;
 
-    v2l  points[MAX_INPUT_BUFFER_ELEMS];
-    f32  pressures[MAX_INPUT_BUFFER_ELEMS];
+    // Pointer samples since the last frame, oldest first. See InputRing
+    v2l* points;
+    f32* pressures;
+    u64* times;  // perf_counter()
     i32  input_count;
 
     v2i  click;
@@ -304,6 +328,7 @@ enum MiltonInitFlags
 {
     MiltonInit_DEFAULT = 0,
     MiltonInit_FOR_TEST = 1<<0,  // No graphics layer. No reading from disk
+    MiltonInit_HEADLESS = 1<<1,  // Used with FOR_TEST by milton-render. Opens file_to_open without remembering it, and logs dialogs.
 };
 void milton_init(Milton* milton, i32 width, i32 height, f32 ui_scale, PATH_CHAR* file_to_open, MiltonInitFlags init_flags = MiltonInit_DEFAULT);
 
@@ -313,7 +338,14 @@ void milton_set_default_canvas_file(Milton* milton);
 void milton_set_last_canvas_fname(PATH_CHAR* last_fname);
 void milton_unset_last_canvas_fname();
 
-void milton_save_postlude(Milton* milton);
+// Take save_mutex, with MILTON_SAVE_ASYNC. See the fields of MiltonPersist
+// that it guards.
+void milton_lock_save(Milton* milton);
+void milton_unlock_save(Milton* milton);
+
+// Queue stroke changes for the journal. See persist.h
+void milton_journal_push(Milton* milton, JournalRecord record);
+void milton_journal_reset_queue(Milton* milton);
 
 
 void milton_reset_canvas(Milton* milton);
@@ -347,6 +379,11 @@ void milton_update_and_render(Milton* milton, MiltonInput const* input);
 
 void milton_try_quit(Milton* milton);
 
+// Use these instead of the system clock in anything the update does.
+u64      milton_clock_ms(Milton* milton);
+WallTime milton_clock_walltime(Milton* milton);
+void     milton_clock_set(Milton* milton, WallTime start, u64 ms);
+
 void milton_new_layer(Milton* milton);
 void milton_new_layer_with_id(Milton* milton, i32 new_id);
 void milton_set_working_layer(Milton* milton, Layer* layer);
@@ -4,7 +4,7 @@
 #pragma once
 
 #define MILTON_MAJOR_VERSION 1
-#define MILTON_MINOR_VERSION 10
+#define MILTON_MINOR_VERSION 11
 #define MILTON_MICRO_VERSION 1
 
 
@@ -16,6 +16,7 @@
 // Debug settings
 
 #define MILTON_ENABLE_PROFILING 0
+#define MILTON_ENABLE_TRACING 1  // Cheap when no capture is running. See profiler.h
 #define REDRAW_EVERY_FRAME 0
 #define GRAPHICS_DEBUG 0
 #define MILTON_ZOOM_DEBUG 0
@@ -50,6 +51,8 @@
 
 #define DEFAULT_PEEK_OUT_INCREMENT_LOG 2.0
 
+#define DEFAULT_STROKE_MEMORY_MB 512  // GPU memory for stroke geometry before strokes get evicted.
+
 #define PEEK_OUT_SPEED 20  // ms / increment
 
 // No support for system cursor on linux or macos for now
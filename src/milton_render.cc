@@ -0,0 +1,336 @@
+// Copyright (c) 2015 Sergio Gonzalez. All rights reserved.
+// License: https://github.com/serge-rgb/milton#license
+
+// milton-render
+//
+// Renders .mlt files to PNG or JPEG without a display or a GPU, using the CPU
+// rasterizer. Files are loaded one after the other; each image is rendered by
+// all the workers.
+//
+//   milton-render [options] <input.mlt> [<input.mlt> ...]
+//
+// The output of each input is the same path with the extension replaced,
+// unless -o or a --list output is given.
+
+#undef main  // SDL does things we don't want
+
+#define RENDER_MAX_PIXELS ((i64)1 << 28)
+
+static void
+render_usage()
+{
+    fprintf(stderr,
+            "Usage: milton-render [options] <input.mlt> [<input.mlt> ...]\n"
+            "\n"
+            "  -o <file>           Output file. Only with a single input.\n"
+            "  --list <file>       Also render the inputs listed in <file>, one per line.\n"
+            "                      An output path may follow the input, after a tab.\n"
+            "  --format png|jpg    Format of the outputs that are not given. Default: png\n"
+            "  --rect <left> <top> <right> <bottom>\n"
+            "                      Canvas rectangle to render. Default: everything drawn.\n"
+            "  --scale <n>         Canvas units per pixel. Default: fit --size.\n"
+            "  --size <n>          Longest side of the image when there is no --scale. Default: 1024\n"
+            "  --workers <n>       Threads for loading and rendering. Default: one per core.\n"
+            "  --transparent       Transparent background.\n"
+            "  --trace <file>      Write a Chrome trace of the run to <file>.\n"
+            "  --replay <file>     Play an input recording on each input before rendering it,\n"
+            "                      and report its frame times. The inputs are not changed.\n");
+}
+
+struct RenderJob
+{
+    PATH_CHAR input[MAX_PATH];
+    PATH_CHAR output[MAX_PATH];
+
+    // For messages.
+    char input_name[MAX_PATH];
+    char output_name[MAX_PATH];
+};
+
+struct RenderOptions
+{
+    b32 has_rect;
+    Rect rect;
+    i64 scale;  // 0 to fit `size`.
+    i64 size;
+    i32 num_workers;
+    f32 background_alpha;
+    char* format;
+    char* trace_path;
+    char* replay_path;
+};
+
+static void
+push_render_job(DArray<RenderJob>* jobs, char* input, char* output, char* format)
+{
+    RenderJob* job = push(jobs, RenderJob{});
+    strncpy(job->input_name, input, MAX_PATH - 1);
+    str_to_path_char(job->input_name, job->input, sizeof(job->input));
+
+    char* out = job->output_name;
+    if ( output ) {
+        strncpy(out, output, MAX_PATH - 1);
+    }
+    else {
+        strncpy(out, input, MAX_PATH - 1);
+        // Drop the extension of the file name, if it has one.
+        char* dot = NULL;
+        for ( char* c = out; *c; ++c ) {
+            if ( *c == '.' ) {
+                dot = c;
+            }
+            else if ( *c == '/' || *c == '\\' ) {
+                dot = NULL;
+            }
+        }
+        if ( dot ) {
+            *dot = '\0';
+        }
+        strncat(out, ".", MAX_PATH - 1 - strlen(out));
+        strncat(out, format, MAX_PATH - 1 - strlen(out));
+    }
+    str_to_path_char(out, job->output, sizeof(job->output));
+}
+
+static b32
+read_render_list(DArray<RenderJob>* jobs, char* list_path, char* format)
+{
+    FILE* fd = fopen(list_path, "rb");
+    if ( !fd ) {
+        return false;
+    }
+    char line[2*MAX_PATH];
+    while ( fgets(line, sizeof(line), fd) ) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if ( line[0] == '\0' ) {
+            continue;
+        }
+        char* output = strchr(line, '\t');
+        if ( output ) {
+            *output++ = '\0';
+        }
+        push_render_job(jobs, line, output, format);
+    }
+    fclose(fd);
+    return true;
+}
+
+// Union of the bounds of the strokes in visible layers.
+static Rect
+drawing_bounds(Layer* root_layer)
+{
+    Rect bounds = rect_without_size();
+    for ( Layer* l = root_layer; l != NULL; l = l->next ) {
+        if ( (l->flags & LayerFlags_VISIBLE) && l->stroke_index.root ) {
+            bounds = rect_union(bounds, l->stroke_index.root->bounds);
+        }
+    }
+    return bounds;
+}
+
+static b32
+render_file(Milton* milton, RenderStack* stack, RenderJob* job, RenderOptions* opt)
+{
+    TRACE_FUNCTION();
+    milton->persist->mlt_file_path = job->input;
+    if ( !milton_load(milton) ) {
+        fprintf(stderr, "Could not load %s\n", job->input_name);
+        return false;
+    }
+    if ( opt->replay_path ) {
+        // Saves during the replay go to a copy next to the input, which is
+        // deleted afterwards. The first save writes the whole canvas.
+        PATH_CHAR save_path[MAX_PATH] = {};
+        PATH_CHAR save_journal[MAX_PATH] = {};
+        PATH_SNPRINTF(save_path, MAX_PATH, TO_PATH_STR("%s.replay_tmp_%d"), job->input, (int)getpid());
+        journal_fname(save_journal, save_path);
+        milton_set_canvas_file(milton, save_path);
+
+        PATH_CHAR replay_path[MAX_PATH] = {};
+        str_to_path_char(opt->replay_path, replay_path, sizeof(replay_path));
+        ReplayReport report = {};
+        b32 replayed = replay_run(milton, replay_path, ReplaySpeed_FULL, &report);
+
+        milton_set_canvas_file(milton, job->input);
+        PATH_REMOVE(save_path);
+        PATH_REMOVE(save_journal);
+
+        if ( !replayed ) {
+            fprintf(stderr, "%s: could not replay %s\n", job->input_name, opt->replay_path);
+            return false;
+        }
+        replay_log_report(&report);
+    }
+
+    Rect rect = opt->rect;
+    if ( !opt->has_rect ) {
+        rect = drawing_bounds(milton->canvas->root_layer);
+        if ( !rect_is_valid(rect) ) {
+            // Nothing drawn. Render what was on screen when the file was saved.
+            CanvasView* v = milton->view;
+            rect = raster_to_canvas_bounding_rect(v, 0, 0, v->screen_size.x, v->screen_size.y, v->scale);
+        }
+    }
+    i64 rect_w = max(rect.right - rect.left, (i64)1);
+    i64 rect_h = max(rect.bottom - rect.top, (i64)1);
+
+    i64 scale = opt->scale;
+    if ( scale == 0 ) {
+        scale = max((max(rect_w, rect_h) + opt->size - 1) / opt->size, (i64)1);
+    }
+    i64 w = (rect_w + scale - 1) / scale;
+    i64 h = (rect_h + scale - 1) / scale;
+    if ( w * h > RENDER_MAX_PIXELS ) {
+        fprintf(stderr, "%s: a %" PRIi64 "x%" PRIi64 " image is too large. Use a larger --scale.\n",
+                job->input_name, w, h);
+        return false;
+    }
+
+    // Pixel (0,0) starts at the top-left corner of the rectangle.
+    CanvasView view = *milton->view;
+    view.screen_size = { (i32)w, (i32)h };
+    view.scale = scale;
+    view.zoom_center = {};
+    view.pan_center = rect.top_left;
+    view.angle = 0.0f;
+
+    u32* pixels = (u32*)mlt_calloc((size_t)(w*h), sizeof(u32), "Bitmap");
+    cpu_render_canvas(stack, &view, milton->canvas->root_layer, pixels, opt->background_alpha);
+    char* error = milton_write_buffer_to_file(job->output, (u8*)pixels, (i32)w, (i32)h);
+    mlt_free(pixels, "Bitmap");
+
+    if ( error ) {
+        fprintf(stderr, "%s: %s\n", job->output_name, error);
+    }
+    return error == NULL;
+}
+
+int
+main(int argc, char** argv)
+{
+    RenderOptions opt = {};
+    opt.size = 1024;
+    opt.num_workers = -1;
+    opt.background_alpha = 1.0f;
+    opt.format = "png";
+
+    char* output = NULL;
+    char* list_path = NULL;
+    DArray<char*> inputs = {};
+
+    b32 ok = true;
+    for ( int i = 1; ok && i < argc; ++i ) {
+        char* arg = argv[i];
+        int remaining = argc - i - 1;
+        if ( !strcmp(arg, "-o") && remaining >= 1 ) {
+            output = argv[++i];
+        }
+        else if ( !strcmp(arg, "--list") && remaining >= 1 ) {
+            list_path = argv[++i];
+        }
+        else if ( !strcmp(arg, "--format") && remaining >= 1 ) {
+            opt.format = argv[++i];
+            ok = !strcmp(opt.format, "png") || !strcmp(opt.format, "jpg");
+        }
+        else if ( !strcmp(arg, "--rect") && remaining >= 4 ) {
+            opt.has_rect = true;
+            opt.rect.left = strtoll(argv[++i], NULL, 10);
+            opt.rect.top = strtoll(argv[++i], NULL, 10);
+            opt.rect.right = strtoll(argv[++i], NULL, 10);
+            opt.rect.bottom = strtoll(argv[++i], NULL, 10);
+            ok = opt.rect.right > opt.rect.left && opt.rect.bottom > opt.rect.top;
+        }
+        else if ( !strcmp(arg, "--scale") && remaining >= 1 ) {
+            opt.scale = strtoll(argv[++i], NULL, 10);
+            ok = opt.scale > 0;
+        }
+        else if ( !strcmp(arg, "--size") && remaining >= 1 ) {
+            opt.size = strtoll(argv[++i], NULL, 10);
+            ok = opt.size > 0;
+        }
+        else if ( !strcmp(arg, "--workers") && remaining >= 1 ) {
+            opt.num_workers = atoi(argv[++i]);
+            ok = opt.num_workers > 0;
+            opt.num_workers -= 1;  // The main thread renders too.
+        }
+        else if ( !strcmp(arg, "--transparent") ) {
+            opt.background_alpha = 0.0f;
+        }
+        else if ( !strcmp(arg, "--trace") && remaining >= 1 ) {
+            opt.trace_path = argv[++i];
+        }
+        else if ( !strcmp(arg, "--replay") && remaining >= 1 ) {
+            opt.replay_path = argv[++i];
+        }
+        else if ( arg[0] != '-' ) {
+            push(&inputs, arg);
+        }
+        else {
+            ok = false;
+        }
+    }
+
+    DArray<RenderJob> jobs = {};
+    if ( ok ) {
+        ok = !output || (inputs.count == 1 && !list_path);
+    }
+    if ( ok ) {
+        for ( i64 i = 0; i < inputs.count; ++i ) {
+            push_render_job(&jobs, inputs[i], output, opt.format);
+        }
+        if ( list_path && !read_render_list(&jobs, list_path, opt.format) ) {
+            fprintf(stderr, "Could not read %s\n", list_path);
+            return 1;
+        }
+    }
+    if ( !ok || jobs.count == 0 ) {
+        render_usage();
+        return 1;
+    }
+
+    // Loading decodes on the job system too.
+    jobs_init(opt.num_workers);
+
+    if ( opt.trace_path ) {
+#if MILTON_ENABLE_TRACING
+        trace_set_thread_name("Main");
+        trace_capture_start();
+#else
+        fprintf(stderr, "Tracing is disabled in this build.\n");
+#endif
+    }
+
+    Milton* milton = (Milton*)mlt_calloc(1, sizeof(Milton), "Setup");
+    milton_init(milton, 0, 0, 1, jobs[0].input,
+                (MiltonInitFlags)(MiltonInit_FOR_TEST | MiltonInit_HEADLESS));
+
+    RenderStack stack = {};
+    cpu_render_stack_init(&stack, true);
+
+    i64 num_failed = 0;
+    for ( i64 i = 0; i < jobs.count; ++i ) {
+        if ( !render_file(milton, &stack, &jobs[i], &opt) ) {
+            ++num_failed;
+        }
+    }
+
+    cpu_render_stack_release(&stack);
+    jobs_release();
+
+#if MILTON_ENABLE_TRACING
+    if ( opt.trace_path ) {
+        PATH_CHAR trace_path[MAX_PATH] = {};
+        str_to_path_char(opt.trace_path, trace_path, sizeof(trace_path));
+        if ( !trace_capture_stop(trace_path) ) {
+            fprintf(stderr, "Could not write %s\n", opt.trace_path);
+            ok = false;
+        }
+    }
+    trace_release();
+#endif
+
+    if ( num_failed ) {
+        fprintf(stderr, "%" PRIi64 " of %" PRIi64 " files failed.\n", num_failed, jobs.count);
+    }
+    return (num_failed || !ok) ? 1 : 0;
+}
@@ -7,6 +7,7 @@
 
 #include "common.h"
 #include "gui.h"
+#include "jobs.h"
 #include "memory.h"
 #include "milton.h"
 #include "platform.h"
@@ -14,6 +15,10 @@
 
 
 #define MILTON_MAGIC_NUMBER 0X11DECAF3
+#define MILTON_JOURNAL_MAGIC_NUMBER 0X11DECAF4
+
+// Compact when the journal grows past this, or past a quarter of the .mlt file.
+#define JOURNAL_MIN_COMPACTION_BYTES (4*1024*1024)
 
 static u64 g_bytes_written = 0;
 
@@ -25,6 +30,39 @@ void save_debug_log(char* message, ...)
     va_end(args);
 }
 
+// MLT 11 files are split into sections, listed in a table at the end of the
+// file. Layer and stroke block entries carry a stroke count and a bounding
+// box, so a reader can find what it needs without parsing the strokes.
+enum MltSectionType
+{
+    MltSection_CANVAS       = 1,  // View, picker, brushes, history, grid.
+    MltSection_LAYER        = 2,  // Name, id, flags, alpha, effects.
+    MltSection_STROKE_BLOCK = 3,  // Up to MLT_STROKES_PER_BLOCK consecutive strokes of a layer.
+    MltSection_PACKED_STROKE_BLOCK = 4,  // Same, with delta-encoded points. See encode_packed_stroke.
+};
+
+#define MLT_STROKES_PER_BLOCK 256
+
+// Packed blocks are encoded on the job system this many at a time, which
+// bounds the memory they take before they are written.
+#define MLT_ENCODE_BLOCKS 64
+
+// Pressures in packed blocks are stored as multiples of 1/MLT_PRESSURE_STEPS.
+// A power of two, so that 0, 1/2, 1 and so on are exact.
+#define MLT_PRESSURE_STEPS (1 << 15)
+
+struct MltSection
+{
+    u32     type;  // MltSectionType
+    i32     layer_id;
+    u64     offset;
+    u64     size;
+    i64     first_stroke;  // STROKE_BLOCK: index of the first stroke in the layer.
+    i32     num_strokes;   // LAYER: strokes in the layer. STROKE_BLOCK: strokes in the block.
+    i64     num_points;    // Blocks: points in the block, so that decoded data can be allocated up front.
+    Rect    bounds;        // Union of the stroke bounds. Canvas space.
+};
+
 #pragma pack(push, 1)
 struct PersistStrokePoint
 {
@@ -73,10 +111,602 @@ read_brushes(Brush* brushes, i32 num_brushes, FILE* fd)
     return ok;
 }
 
-void
+static void
+journal_fname(PATH_CHAR* out, PATH_CHAR* mlt_file_path)
+{
+    PATH_SNPRINTF(out, MAX_PATH, TO_PATH_STR("%s.journal"), mlt_file_path);
+}
+
+// Reads a stroke in the current format. Used by the journal.
+static b32
+read_stroke(Arena* arena, Stroke* stroke, FILE* fd)
+{
+    b32 ok = read_brushes(&stroke->brush, 1, fd) &&
+             fread_checked(&stroke->flags, sizeof(stroke->flags), 1, fd) &&
+             fread_checked(&stroke->num_points, sizeof(i32), 1, fd);
+
+    if ( ok && (stroke->num_points <= 0 || stroke->num_points > STROKE_MAX_POINTS) ) {
+        ok = false;
+    }
+    if ( ok ) {
+        stroke->points = arena_alloc_array(arena, stroke->num_points, v2l);
+        stroke->pressures = arena_alloc_array(arena, stroke->num_points, f32);
+#if STROKE_DEBUG_VIZ
+        stroke->debug_flags = arena_alloc_array(arena, stroke->num_points, int);
+#endif
+        ok = fread_checked(stroke->points, sizeof(v2l), (size_t)stroke->num_points, fd) &&
+             fread_checked(stroke->pressures, sizeof(f32), (size_t)stroke->num_points, fd) &&
+             fread_checked(&stroke->layer_id, sizeof(i32), 1, fd);
+    }
+    if ( ok ) {
+        stroke->bounding_rect = bounding_box_for_stroke(stroke);
+    }
+    return ok;
+}
+
+// Removes the most recent history element for a layer.
+static void
+pop_history_for_layer(CanvasState* canvas, i32 layer_id)
+{
+    for ( i64 i = canvas->history.count - 1; i >= 0; --i ) {
+        if ( canvas->history.data[i].layer_id == layer_id ) {
+            for ( i64 j = i; j < canvas->history.count - 1; ++j ) {
+                canvas->history.data[j] = canvas->history.data[j + 1];
+            }
+            pop(&canvas->history);
+            break;
+        }
+    }
+}
+
+// Applies the journal on top of a freshly loaded snapshot. If there is no
+// journal for this snapshot, or it ends in a partial record, a compaction is
+// requested so that new records are not appended to a bad journal.
+static void
+journal_replay(Milton* milton)
+{
+    TRACE_FUNCTION();
+    MiltonPersist* p = milton->persist;
+    CanvasState* canvas = milton->canvas;
+
+    PATH_CHAR fname[MAX_PATH] = {};
+    journal_fname(fname, p->mlt_file_path);
+
+    b32 valid = false;
+    i64 num_records = 0;
+
+    FILE* fd = platform_fopen(fname, TO_PATH_STR("rb"));
+    if ( fd ) {
+        u32 magic = 0;
+        u32 version = 0;
+        u64 snapshot_id = 0;
+        if (    fread_checked(&magic, sizeof(magic), 1, fd)
+             && fread_checked(&version, sizeof(version), 1, fd)
+             && fread_checked(&snapshot_id, sizeof(snapshot_id), 1, fd)
+             && magic == MILTON_JOURNAL_MAGIC_NUMBER
+             && version == MILTON_MINOR_VERSION
+             && snapshot_id != 0
+             && snapshot_id == p->snapshot_id ) {
+            valid = true;
+        }
+
+        while ( valid ) {
+            JournalRecord record = {};
+            size_t read = fread(&record.type, sizeof(record.type), 1, fd);
+            if ( read == 0 && feof(fd) ) {
+                break;  // Clean end of journal.
+            }
+            if (    read != 1
+                 || !fread_checked(&record.layer_id, sizeof(record.layer_id), 1, fd)
+                 || !fread_checked(&record.stroke_i, sizeof(record.stroke_i), 1, fd) ) {
+                valid = false;
+                break;
+            }
+
+            Layer* layer = layer::get_by_id(canvas->root_layer, record.layer_id);
+
+            if ( record.type == JournalRecord_STROKE_ADD ) {
+                if ( !read_stroke(&canvas->arena, &record.stroke, fd) ) {
+                    valid = false;
+                    break;
+                }
+                if ( layer && record.stroke_i <= layer->strokes.count ) {
+                    while ( layer->strokes.count > record.stroke_i ) {
+                        layer::layer_pop_stroke(layer);
+                        pop_history_for_layer(canvas, layer->id);
+                    }
+                    record.stroke.id = canvas->stroke_id_count++;
+                    layer::layer_push_stroke(layer, record.stroke);
+                    HistoryElement h = { HistoryElement_STROKE_ADD, layer->id };
+                    push(&canvas->history, h);
+                }
+                else {
+                    milton_log("Journal: skipping stroke for layer %d\n", record.layer_id);
+                }
+            }
+            else if ( record.type == JournalRecord_STROKE_POP ) {
+                while ( layer && layer->strokes.count > record.stroke_i ) {
+                    layer::layer_pop_stroke(layer);
+                    pop_history_for_layer(canvas, layer->id);
+                }
+            }
+            else {
+                valid = false;
+                break;
+            }
+            ++num_records;
+        }
+
+        if ( valid ) {
+            p->journal_bytes = (u64)ftell(fd);
+        }
+        fclose(fd);
+    }
+
+    if ( num_records > 0 ) {
+        milton_log("Replayed %d journal records.\n", num_records);
+    }
+
+    if ( !valid ) {
+        p->journal_bytes = 0;
+        p->compaction_requested = true;
+    }
+}
+
+static b32
+read_section_table(FILE* fd, DArray<MltSection>* table)
+{
+    u64 table_offset = 0;
+    u32 num_sections = 0;
+    b32 ok = fread_checked(&table_offset, sizeof(table_offset), 1, fd) &&
+             fread_checked(&num_sections, sizeof(num_sections), 1, fd) &&
+             num_sections > 0 &&
+             fseek(fd, (long)table_offset, SEEK_SET) == 0;
+    for ( u32 i = 0; ok && i < num_sections; ++i ) {
+        MltSection s = {};
+        ok = fread_checked(&s.type, sizeof(s.type), 1, fd) &&
+             fread_checked(&s.layer_id, sizeof(s.layer_id), 1, fd) &&
+             fread_checked(&s.offset, sizeof(s.offset), 1, fd) &&
+             fread_checked(&s.size, sizeof(s.size), 1, fd) &&
+             fread_checked(&s.first_stroke, sizeof(s.first_stroke), 1, fd) &&
+             fread_checked(&s.num_strokes, sizeof(s.num_strokes), 1, fd) &&
+             fread_checked(&s.num_points, sizeof(s.num_points), 1, fd) &&
+             fread_checked(&s.bounds, sizeof(s.bounds), 1, fd);
+        if ( ok && (s.offset > table_offset || s.size > table_offset - s.offset) ) {
+            milton_log("Corrupt file. Section %d is out of bounds.\n", (int)i);
+            ok = false;
+        }
+        if ( ok ) {
+            push(table, s);
+        }
+    }
+    return ok;
+}
+
+static b32
+read_canvas_section(Milton* milton, FILE* fd, i32* layer_guid)
+{
+    MiltonGui* gui = milton->gui;
+    v2i saved_size = milton->view->screen_size;
+
+    *milton->view = {};
+    b32 ok = fread_checked(&milton->view->size, sizeof(u32), 1, fd) &&
+             milton->view->size <= sizeof(CanvasView) &&
+             fread_checked((u8*)milton->view + offsetof(CanvasView, screen_size), milton->view->size - sizeof(u32), 1, fd);
+    milton->view->size = sizeof(CanvasView);
+    milton->view->screen_size = saved_size;
+
+    v3f rgb = {};
+    i32 button_count = 0;
+    ok = ok &&
+         fread_checked(layer_guid, sizeof(i32), 1, fd) &&
+         fread_checked(&rgb, sizeof(rgb), 1, fd) &&
+         fread_checked(&button_count, sizeof(i32), 1, fd);
+    if ( ok ) {
+        gui_picker_from_rgb(&gui->picker, rgb);
+        ColorButton* btn = gui->picker.color_buttons;
+        for ( i32 i = 0; ok && i < button_count; ++i ) {
+            v4f rgba = {};
+            ok = fread_checked(&rgba, sizeof(v4f), 1, fd);
+            if ( btn ) {
+                btn->rgba = rgba;
+                btn = btn->next;
+            }
+        }
+    }
+
+    u16 num_brushes = 0;
+    ok = ok && fread_checked(&num_brushes, sizeof(u16), 1, fd);
+    if ( ok && num_brushes > BrushEnum_COUNT ) {
+        milton_log("Error loading file: too many brushes: %d\n", num_brushes);
+        ok = false;
+    }
+    ok = ok &&
+         read_brushes(milton->brushes, num_brushes, fd) &&
+         fread_checked(&milton->brush_sizes, sizeof(i32), num_brushes, fd);
+
+    i32 history_count = 0;
+    ok = ok && fread_checked(&history_count, sizeof(history_count), 1, fd) && history_count >= 0;
+    if ( ok ) {
+        reset(&milton->canvas->history);
+        reserve(&milton->canvas->history, history_count);
+        ok = fread_checked(milton->canvas->history.data, sizeof(*milton->canvas->history.data), (size_t)history_count, fd);
+        milton->canvas->history.count = history_count;
+    }
+
+    ok = ok &&
+         fread_checked(&milton->grid_rows, sizeof(milton->grid_rows), 1, fd) &&
+         fread_checked(&milton->grid_columns, sizeof(milton->grid_columns), 1, fd) &&
+         fread_checked(&milton->persist->snapshot_id, sizeof(u64), 1, fd);
+    return ok;
+}
+
+static b32
+read_layer_section(Milton* milton, FILE* fd)
+{
+    milton_new_layer(milton);
+    Layer* layer = milton->canvas->working_layer;
+
+    i32 len = 0;
+    i32 num_blocks = 0;
+    i64 num_effects = 0;
+    b32 ok = fread_checked(&len, sizeof(i32), 1, fd);
+    if ( ok && (len <= 0 || len > MAX_LAYER_NAME_LEN) ) {
+        milton_log("Corrupt file. Layer name is too long.\n");
+        ok = false;
+    }
+    ok = ok &&
+         fread_checked(layer->name, sizeof(char), (size_t)len, fd) &&
+         fread_checked(&layer->id, sizeof(i32), 1, fd) &&
+         fread_checked(&layer->flags, sizeof(layer->flags), 1, fd) &&
+         fread_checked(&layer->alpha, sizeof(layer->alpha), 1, fd) &&
+         fread_checked(&num_blocks, sizeof(num_blocks), 1, fd) &&
+         fread_checked(&num_effects, sizeof(num_effects), 1, fd);
+    if ( ok ) {
+        layer->name[len - 1] = '\0';
+    }
+
+    LayerEffect** e = &layer->effects;
+    for ( i64 i = 0; ok && i < num_effects; ++i ) {
+        *e = arena_alloc_elem(&milton->canvas->arena, LayerEffect);
+        ok = fread_checked(&(*e)->type, sizeof((*e)->type), 1, fd) &&
+             fread_checked(&(*e)->enabled, sizeof((*e)->enabled), 1, fd);
+        if ( ok && (*e)->type == LayerEffectType_BLUR ) {
+            ok = fread_checked(&(*e)->blur.original_scale, sizeof((*e)->blur.original_scale), 1, fd) &&
+                 fread_checked(&(*e)->blur.kernel_size, sizeof((*e)->blur.kernel_size), 1, fd);
+        }
+        e = &(*e)->next;
+    }
+    return ok;
+}
+
+static u8*
+align_pointer(u8* ptr, u64 alignment)
+{
+    u8* result = (u8*)(((u64)ptr + alignment - 1) & ~(alignment - 1));
+    return result;
+}
+
+// A stroke block waiting to be decoded. Decoding only touches the block,
+// `strokes`, and for packed blocks `points` and `pressures`, so blocks can be
+// decoded on any thread.
+struct BlockDecode
+{
+    MltSection* section;
+    u8*         block;
+    Stroke*     strokes;    // section->num_strokes entries.
+    v2l*        points;     // Packed blocks: section->num_points entries.
+    f32*        pressures;  // Packed blocks: section->num_points entries.
+    i32         first_id;
+    b32         ok;
+};
+
+// Reads the header that starts every stroke in a block. Advances `at` past it.
+static b32
+read_block_stroke_header(u8* block, u64 size, u64* at, Stroke* stroke)
+{
+    i32 size_of_brush = 0;
+    u64 header_size = sizeof(i32);
+    b32 ok = *at + header_size <= size;
+    if ( ok ) {
+        memcpy(&size_of_brush, block + *at, sizeof(i32));
+        header_size += (u64)size_of_brush + sizeof(stroke->flags) + 2 * sizeof(i32);
+        ok = size_of_brush > 0 && size_of_brush <= sizeof(Brush) && *at + header_size <= size;
+    }
+    if ( ok ) {
+        u8* p = block + *at + sizeof(i32);
+        stroke->brush = default_brush();
+        memcpy(&stroke->brush, p, (size_t)size_of_brush);  p += size_of_brush;
+        memcpy(&stroke->flags, p, sizeof(stroke->flags));    p += sizeof(stroke->flags);
+        memcpy(&stroke->num_points, p, sizeof(i32));        p += sizeof(i32);
+        memcpy(&stroke->layer_id, p, sizeof(i32));
+        *at += header_size;
+        ok = stroke->num_points > 0 && stroke->num_points <= STROKE_MAX_POINTS;
+    }
+    return ok;
+}
+
+// Strokes in a block point into `block`, which must outlive them and be
+// 8-byte aligned. See write_block_stroke for the layout.
+static void
+decode_stroke_block(BlockDecode* job)
+{
+    MltSection* s = job->section;
+    u8* block = job->block;
+    u64 at = 0;
+    b32 ok = ((u64)block & 7) == 0;
+    for ( i32 stroke_i = 0; ok && stroke_i < s->num_strokes; ++stroke_i ) {
+        Stroke stroke = {};
+        ok = read_block_stroke_header(block, s->size, &at, &stroke);
+        if ( ok ) {
+            at = (at + 7) & ~(u64)7;
+            ok = at + (u64)stroke.num_points * (sizeof(v2l) + sizeof(f32)) <= s->size;
+        }
+        if ( ok ) {
+            stroke.points = (v2l*)(block + at);
+            at += (u64)stroke.num_points * sizeof(v2l);
+            stroke.pressures = (f32*)(block + at);
+            at += (u64)stroke.num_points * sizeof(f32);
+            stroke.id = job->first_id + stroke_i;
+            stroke.bounding_rect = bounding_box_for_stroke(&stroke);
+            job->strokes[stroke_i] = stroke;
+        }
+    }
+    job->ok = ok && at == s->size;
+}
+
+static b32
+read_varint(u8* data, u64 size, u64* at, u64* value)
+{
+    u64 result = 0;
+    b32 ok = false;
+    for ( int shift = 0; shift < 64 && *at < size; shift += 7 ) {
+        u8 byte = data[(*at)++];
+        result |= (u64)(byte & 0x7f) << shift;
+        if ( !(byte & 0x80) ) {
+            ok = true;
+            break;
+        }
+    }
+    *value = result;
+    return ok;
+}
+
+static i64
+unzigzag(u64 value)
+{
+    return (i64)(value >> 1) ^ -(i64)(value & 1);
+}
+
+// Decodes into job->points and job->pressures. See encode_packed_stroke.
+static void
+decode_packed_stroke_block(BlockDecode* job)
+{
+    MltSection* s = job->section;
+    u8* block = job->block;
+    u64 at = 0;
+    i64 points_used = 0;
+    b32 ok = true;
+    for ( i32 stroke_i = 0; ok && stroke_i < s->num_strokes; ++stroke_i ) {
+        Stroke stroke = {};
+        ok = read_block_stroke_header(block, s->size, &at, &stroke) &&
+             points_used + stroke.num_points <= s->num_points;
+        if ( ok ) {
+            stroke.points = job->points + points_used;
+            stroke.pressures = job->pressures + points_used;
+            points_used += stroke.num_points;
+
+            v2l prev = {};
+            for ( i32 i = 0; ok && i < stroke.num_points; ++i ) {
+                u64 dx = 0;
+                u64 dy = 0;
+                ok = read_varint(block, s->size, &at, &dx) && read_varint(block, s->size, &at, &dy);
+                prev.x += unzigzag(dx);
+                prev.y += unzigzag(dy);
+                stroke.points[i] = prev;
+            }
+            ok = ok && at + (u64)stroke.num_points * sizeof(u16) <= s->size;
+        }
+        if ( ok ) {
+            for ( i32 i = 0; i < stroke.num_points; ++i ) {
+                u16 q = (u16)(block[at] | (block[at + 1] << 8));
+                stroke.pressures[i] = (f32)q / MLT_PRESSURE_STEPS;
+                at += sizeof(u16);
+            }
+            stroke.id = job->first_id + stroke_i;
+            stroke.bounding_rect = bounding_box_for_stroke(&stroke);
+            job->strokes[stroke_i] = stroke;
+        }
+    }
+    job->ok = ok && at == s->size && points_used == s->num_points;
+}
+
+// Job system callback.
+static void
+decode_blocks(void* data, i64 begin, i64 end, i32 worker)
+{
+    TRACE_FUNCTION();
+    BlockDecode* jobs = (BlockDecode*)data;
+    for ( i64 i = begin; i < end; ++i ) {
+        BlockDecode* job = jobs + i;
+        if ( job->section->type == MltSection_PACKED_STROKE_BLOCK ) {
+            decode_packed_stroke_block(job);
+        } else {
+            decode_stroke_block(job);
+        }
+    }
+}
+
+// Loads an MLT 11 file. `fd` is positioned after the magic number and version.
+//
+// Runs in three steps. Canvas and layer sections are read and block data is
+// found, in file order. Blocks are then decoded in parallel, which is where
+// the time goes: bounds for every point. Finally, strokes are pushed to
+// their layers in order.
+static b32
+read_mlt_sections(Milton* milton, FILE* fd, i32* layer_guid)
+{
+    CanvasState* canvas = milton->canvas;
+    DArray<MltSection> table = {};
+    DArray<BlockDecode> jobs = {};
+    DArray<Layer*> job_layers = {};
+    Stroke* decoded = NULL;
+
+    b32 ok = read_section_table(fd, &table);
+    if ( ok ) {
+        milton->persist->snapshot_bytes = (u64)ftell(fd);
+    }
+
+    // The canvas section comes first in the table. Layers are created in table order.
+    Layer* layer = NULL;
+    i64 layer_strokes = 0;
+    i64 layer_strokes_in_blocks = 0;
+    i64 total_strokes = 0;
+    i32 saved_working_layer_id = 0;
+    for ( i64 i = 0; ok && i < table.count; ++i ) {
+        MltSection* s = &table[i];
+        b32 check_size = true;
+        ok = fseek(fd, (long)s->offset, SEEK_SET) == 0;
+        if ( !ok ) {
+            break;
+        }
+        switch ( s->type ) {
+            case MltSection_CANVAS: {
+                ok = i == 0 && read_canvas_section(milton, fd, layer_guid);
+                // Creating layers changes working_layer_id.
+                saved_working_layer_id = milton->view->working_layer_id;
+            } break;
+            case MltSection_LAYER: {
+                ok = i > 0 && layer_strokes_in_blocks == layer_strokes;
+                if ( ok ) {
+                    ok = read_layer_section(milton, fd);
+                    layer = canvas->working_layer;
+                    layer_strokes = s->num_strokes;
+                    layer_strokes_in_blocks = 0;
+                }
+            } break;
+            case MltSection_STROKE_BLOCK:
+            case MltSection_PACKED_STROKE_BLOCK: {
+                b32 packed = s->type == MltSection_PACKED_STROKE_BLOCK;
+                // Every stroke takes more than 16 bytes, and a packed point at least 4.
+                ok = layer && layer->id == s->layer_id &&
+                     s->first_stroke == layer_strokes_in_blocks &&
+                     s->num_strokes >= 0 && (u64)s->num_strokes <= s->size / 16 &&
+                     s->num_points >= 0 && (u64)s->num_points <= s->size / 4;
+                BlockDecode job = {};
+                job.section = s;
+                if ( ok && canvas->mapped_file.data ) {
+                    job.block = canvas->mapped_file.data + s->offset;
+                }
+                else if ( ok ) {
+                    // One read per block. Strokes point into the copy.
+                    job.block = align_pointer(arena_alloc_array(&canvas->arena, s->size + 7, u8), 8);
+                    ok = fread_checked(job.block, (size_t)s->size, 1, fd);
+                }
+                if ( ok && packed ) {
+                    job.points = arena_alloc_array(&canvas->arena, max(s->num_points, 1), v2l);
+                    job.pressures = arena_alloc_array(&canvas->arena, max(s->num_points, 1), f32);
+                }
+                if ( ok ) {
+                    job.first_id = canvas->stroke_id_count + (i32)total_strokes;
+                    push(&jobs, job);
+                    push(&job_layers, layer);
+                    layer_strokes_in_blocks += s->num_strokes;
+                    total_strokes += s->num_strokes;
+                }
+                check_size = false;
+            } break;
+            default: {
+                // Unknown sections are skipped.
+                milton_log("Skipping section of type %d\n", s->type);
+                check_size = false;
+            } break;
+        }
+        if ( ok && check_size && (u64)ftell(fd) != s->offset + s->size ) {
+            milton_log("Corrupt file. Section %d has the wrong size.\n", (int)i);
+            ok = false;
+        }
+    }
+    if ( ok && layer_strokes_in_blocks != layer_strokes ) {
+        ok = false;
+    }
+
+    if ( ok && jobs.count > 0 ) {
+        decoded = (Stroke*)mlt_calloc((size_t)total_strokes, sizeof(Stroke), "Persist");
+        i64 offset = 0;
+        for ( i64 i = 0; i < jobs.count; ++i ) {
+            jobs[i].strokes = decoded + offset;
+            offset += jobs[i].section->num_strokes;
+        }
+
+        parallel_for(jobs.count, 1, decode_blocks, jobs.data);
+
+        for ( i64 i = 0; ok && i < jobs.count; ++i ) {
+            BlockDecode* job = &jobs[i];
+            if ( !job->ok ) {
+                milton_log("Corrupt file. Stroke block %d could not be decoded.\n", (int)i);
+                ok = false;
+                break;
+            }
+            for ( i32 stroke_i = 0; stroke_i < job->section->num_strokes; ++stroke_i ) {
+#if STROKE_DEBUG_VIZ
+                job->strokes[stroke_i].debug_flags = arena_alloc_array(&canvas->arena, job->strokes[stroke_i].num_points, int);
+#endif
+                layer::layer_push_stroke(job_layers[i], job->strokes[stroke_i]);
+            }
+        }
+        canvas->stroke_id_count += (i32)total_strokes;
+    }
+
+    milton->view->working_layer_id = saved_working_layer_id;
+
+    if ( ok ) {
+        // Set the flags of the working layer to the last stroke of the working layer.
+        Layer* working = layer::get_by_id(canvas->root_layer, milton->view->working_layer_id);
+        if ( working && working->strokes.count > 0 ) {
+            milton->working_stroke.flags = peek(&working->strokes)->flags;
+        }
+    }
+
+    if ( decoded ) {
+        mlt_free(decoded, "Persist");
+    }
+    release(&job_layers);
+    release(&jobs);
+    release(&table);
+    return ok;
+}
+
+// milton-render has no one to answer dialogs. Messages go to the log, and
+// the file is loaded as if the user said yes.
+static void
+load_dialog(Milton* milton, char* info, char* title)
+{
+    if ( milton->flags & MiltonStateFlags_HEADLESS ) {
+        milton_log("%s: %s\n", title, info);
+    } else {
+        platform_dialog(info, title);
+    }
+}
+
+static b32
+load_dialog_yesno(Milton* milton, char* info, char* title)
+{
+    b32 yes = true;
+    if ( milton->flags & MiltonStateFlags_HEADLESS ) {
+        milton_log("%s: %s\n", title, info);
+    } else {
+        yes = platform_dialog_yesno(info, title);
+    }
+    return yes;
+}
+
+b32
 milton_load(Milton* milton)
 {
+    TRACE_FUNCTION();
     // Declare variables here to silence compiler warnings about using GOTO.
+    b32 loaded = false;
     i32 history_count = 0;
     i32 num_layers = 0;
     i32 saved_working_layer_id = 0;
@@ -109,7 +739,7 @@ milton_load(Milton* milton)
 
         if (ok) {
             if ( milton_binary_version < MILTON_MINOR_VERSION ) {
-                if ( platform_dialog_yesno ("This file will be updated to the new version of Milton. Older versions won't be able to open it. Is this OK?", "File format change") ) {
+                if ( load_dialog_yesno(milton, "This file will be updated to the new version of Milton. Older versions won't be able to open it. Is this OK?", "File format change") ) {
                     milton->persist->mlt_binary_version = MILTON_MINOR_VERSION;
                     milton_log("Updating this file to latest mlt version.\n");
                 } else {
@@ -123,7 +753,7 @@ milton_load(Milton* milton)
         }
 
         if ( milton_binary_version > MILTON_MINOR_VERSION ) {
-            platform_dialog("This file was created with a newer version of Milton.", "Could not open.");
+            load_dialog(milton, "This file was created with a newer version of Milton.", "Could not open.");
 
             // Stop loading, but exit without prompting.
             ok = false;
@@ -131,6 +761,25 @@ milton_load(Milton* milton)
             goto END;
         }
 
+        if ( milton_binary_version >= 11 ) {
+            if ( milton_magic != MILTON_MAGIC_NUMBER ) {
+                load_dialog(milton, "MLT file could not be loaded. Magic number mismatch.", "Problem");
+                if ( !(milton->flags & MiltonStateFlags_HEADLESS) ) {
+                    milton_unset_last_canvas_fname();
+                }
+                ok = false;
+            } else {
+                // Stroke data is used in place if the file can be mapped.
+                platform_map_file(milton->persist->mlt_file_path, &canvas->mapped_file);
+                ok = read_mlt_sections(milton, fd, &layer_guid);
+            }
+            err = fclose(fd);
+            if ( err != 0 ) {
+                ok = false;
+            }
+            goto END;
+        }
+
         if ( milton_binary_version >= 9 ) {
             // Defaults
             *milton->view = {};
@@ -176,8 +825,10 @@ milton_load(Milton* milton)
         saved_working_layer_id = milton->view->working_layer_id;
 
         if ( milton_magic != MILTON_MAGIC_NUMBER ) {
-            platform_dialog("MLT file could not be loaded. Magic number mismatch.", "Problem");
-            milton_unset_last_canvas_fname();
+            load_dialog(milton, "MLT file could not be loaded. Magic number mismatch.", "Problem");
+            if ( !(milton->flags & MiltonStateFlags_HEADLESS) ) {
+                milton_unset_last_canvas_fname();
+            }
             ok = false;
             goto END;
         }
@@ -407,6 +1058,16 @@ milton_load(Milton* milton)
           READ(&milton->grid_columns, sizeof(milton->grid_columns), 1, fd);
         }
 
+        // Snapshot id for the journal. Optional trailing data, so files
+        // written without it still load.
+        milton->persist->snapshot_id = 0;
+        if ( milton_binary_version >= 10 ) {
+            if ( !fread_checked(&milton->persist->snapshot_id, sizeof(u64), 1, fd) ) {
+                milton->persist->snapshot_id = 0;
+            }
+        }
+        milton->persist->snapshot_bytes = (u64)ftell(fd);
+
         err = fclose(fd);
         if ( err != 0 ) {
             ok = false;
@@ -416,7 +1077,7 @@ END:
         // Finished loading
         if ( !ok ) {
             if ( !handled ) {
-                platform_dialog("Tried to load a corrupt Milton file or there was an error reading from disk.", "Error");
+                load_dialog(milton, "Tried to load a corrupt Milton file or there was an error reading from disk.", "Error");
             }
             milton_reset_canvas_and_set_default(milton);
         } else {
@@ -433,14 +1094,21 @@ END:
             }
             milton->canvas->layer_guid = layer_guid;
 
+            milton->persist->compaction_requested = false;
+            milton->persist->journal_bytes = 0;
+            journal_replay(milton);
+            milton->persist->layers_hash = layer::hash_layers(milton->canvas->root_layer);
+
             // Update GPU
             milton->flags |= MiltonStateFlags_JUST_SAVED;
+            loaded = true;
         }
     } else {
         milton_log("milton_load: Could not open file!\n");
         milton_reset_canvas_and_set_default(milton);
     }
 #undef READ
+    return loaded;
 }
 
 static bool
@@ -469,228 +1137,558 @@ end_data_tracking()
     return g_bytes_written;
 }
 
-u64
-milton_save(Milton* milton)
+static bool
+write_stroke(Stroke* stroke, FILE* fd)
 {
-    begin_data_tracking();
-    // Declaring variables here to silence compiler warnings about GOTO jumping declarations.
-    i32 history_count = 0;
-    u32 milton_binary_version = 0;
-    milton->flags |= MiltonStateFlags_LAST_SAVE_FAILED;  // Assume failure. Remove flag on success.
+    i32 size_of_brush = sizeof(Brush);
+    bool ok = write_data(&size_of_brush, sizeof(i32), 1, fd) &&
+              write_data(&stroke->brush, sizeof(Brush), 1, fd) &&
+              write_data(&stroke->flags, sizeof(stroke->flags), 1, fd) &&
+              write_data(&stroke->num_points, sizeof(i32), 1, fd) &&
+              write_data(stroke->points, sizeof(v2l), (size_t)stroke->num_points, fd) &&
+              write_data(stroke->pressures, sizeof(f32), (size_t)stroke->num_points, fd) &&
+              write_data(&stroke->layer_id, sizeof(i32), 1, fd);
+    return ok;
+}
 
-    int pid = (int)getpid();
-    PATH_CHAR tmp_fname[MAX_PATH] = {};
-    PATH_SNPRINTF(tmp_fname, MAX_PATH, TO_PATH_STR("%s.mlt_tmp_%d"), milton->persist->mlt_file_path, pid);
+static bool
+write_journal_records(JournalRecord* records, i64 count, FILE* fd)
+{
+    bool ok = true;
+    for ( i64 i = 0; ok && i < count; ++i ) {
+        JournalRecord* r = records + i;
+        ok = write_data(&r->type, sizeof(r->type), 1, fd) &&
+             write_data(&r->layer_id, sizeof(r->layer_id), 1, fd) &&
+             write_data(&r->stroke_i, sizeof(r->stroke_i), 1, fd);
+        if ( ok && r->type == JournalRecord_STROKE_ADD ) {
+            ok = write_stroke(&r->stroke, fd);
+        }
+    }
+    return ok;
+}
 
-    FILE* fd = platform_fopen(tmp_fname, TO_PATH_STR("wb"));
+// The id must differ from whatever journal is already on disk, which might
+// belong to another canvas if we are saving over an existing file.
+static u64
+journal_next_snapshot_id(PATH_CHAR* mlt_file_path, u64 id)
+{
+    PATH_CHAR fname[MAX_PATH] = {};
+    journal_fname(fname, mlt_file_path);
+    FILE* fd = platform_fopen(fname, TO_PATH_STR("rb"));
+    if ( fd ) {
+        u32 header[2] = {};
+        u64 journal_id = 0;
+        if ( fread_checked(header, sizeof(header), 1, fd) &&
+             fread_checked(&journal_id, sizeof(journal_id), 1, fd) ) {
+            id = max(id, journal_id);
+        }
+        fclose(fd);
+    }
+    return id + 1;
+}
 
-    b32 could_write_milton_state = false;
+// Starts an empty journal for the snapshot that was just written.
+static b32
+journal_reset(PATH_CHAR* mlt_file_path, u64 snapshot_id)
+{
+    PATH_CHAR fname[MAX_PATH] = {};
+    journal_fname(fname, mlt_file_path);
 
+    b32 ok = false;
+    FILE* fd = platform_fopen(fname, TO_PATH_STR("wb"));
     if ( fd ) {
-        u32 milton_magic = MILTON_MAGIC_NUMBER;
+        u32 magic = MILTON_JOURNAL_MAGIC_NUMBER;
+        u32 version = MILTON_MINOR_VERSION;
+        ok = write_data(&magic, sizeof(magic), 1, fd) &&
+             write_data(&version, sizeof(version), 1, fd) &&
+             write_data(&snapshot_id, sizeof(snapshot_id), 1, fd);
+        if ( fclose(fd) != 0 ) {
+            ok = false;
+        }
+    }
+    if ( !ok ) {
+        milton_log("Could not create journal. Next save will rewrite the whole file.\n");
+    }
+    return ok;
+}
 
-        if ( write_data(&milton_magic, sizeof(u32), 1, fd) ) {
-            milton_binary_version = milton->persist->mlt_binary_version;
-            i32 num_layers = layer::number_of_layers(milton->canvas->root_layer);
+u64
+milton_journal_append(Milton* milton, JournalRecord* records, i64 count)
+{
+    TRACE_FUNCTION();
+    MiltonPersist* p = milton->persist;
+    u64 bytes = 0;
+    PATH_CHAR fname[MAX_PATH] = {};
+    b32 has_journal = false;
+    u64 epoch = 0;
+    milton_lock_save(milton);
+    {
+        // journal_bytes is zero when the journal on disk does not match the
+        // .mlt file. A compaction is pending in that case and will include these records.
+        has_journal = p->journal_bytes > 0;
+        epoch = p->epoch;
+        journal_fname(fname, p->mlt_file_path);
+    }
+    milton_unlock_save(milton);
 
-            mlt_assert(sizeof(CanvasView) == milton->view->size);
+    if ( count > 0 && has_journal ) {
+        u64 prev_bytes = g_bytes_written;
+        FILE* fd = platform_fopen(fname, TO_PATH_STR("ab"));
+        b32 ok = false;
+        if ( fd ) {
+            ok = write_journal_records(records, count, fd);
+            if ( fclose(fd) != 0 ) {
+                ok = false;
+            }
+        }
+        bytes = g_bytes_written - prev_bytes;
 
-            if ( write_data(&milton_binary_version, sizeof(u32), 1, fd) &&
-                 write_data(milton->view, sizeof(CanvasView), 1, fd) &&
-                 write_data(&num_layers, sizeof(i32), 1, fd) &&
-                 write_data(&milton->canvas->layer_guid, sizeof(i32), 1, fd) ) {
+        milton_lock_save(milton);
+        // If the canvas or its file changed meanwhile, the journal was reset
+        // and these records are not part of it.
+        if ( epoch == p->epoch ) {
+            if ( ok ) {
+                p->journal_bytes += bytes;
+                p->last_save_time = milton_clock_walltime(milton);
+            } else {
+                milton_log("Could not append to journal. Next save will rewrite the whole file.\n");
+                p->journal_failed = true;
+                p->journal_bytes = 0;
+                p->compaction_requested = true;
+            }
+        }
+        milton_unlock_save(milton);
+    }
+    return bytes;
+}
 
-                //
-                // Layer contents
-                //
+b32
+milton_journal_needs_compaction(MiltonPersist* p)
+{
+    u64 limit = max((u64)JOURNAL_MIN_COMPACTION_BYTES, p->snapshot_bytes / 4);
+    b32 result = p->journal_bytes > limit;
+    return result;
+}
 
-                bool could_write_layer_contents = true;
+CanvasSnapshot*
+milton_canvas_snapshot(Milton* milton, b32 attach)
+{
+    CanvasSnapshot* s = arena_bootstrap(CanvasSnapshot, arena, 64*1024);
+    MiltonPersist* p = milton->persist;
+
+    PATH_STRNCPY(s->mlt_file_path, p->mlt_file_path, MAX_PATH);
+    s->epoch = p->epoch;
+    s->mlt_binary_version = p->mlt_binary_version;
+    s->snapshot_id = p->snapshot_id;
+
+    mlt_assert(sizeof(CanvasView) == milton->view->size);
+    s->view = *milton->view;
+    s->layer_guid = milton->canvas->layer_guid;
+
+    //
+    // Layers. Strokes are not copied.
+    //
+    s->num_layers = layer::number_of_layers(milton->canvas->root_layer);
+    s->layers = arena_alloc_array(&s->arena, s->num_layers, SnapshotLayer);
+    i32 layer_i = 0;
+    for ( Layer* layer = milton->canvas->root_layer; layer != NULL; layer = layer->next ) {
+        SnapshotLayer* sl = s->layers + layer_i++;
+        sl->layer = layer;
+        sl->id = layer->id;
+        strncpy(sl->name, layer->name, MAX_LAYER_NAME_LEN);
+        sl->flags = layer->flags;
+        sl->alpha = layer->alpha;
+
+        LayerEffect** tail = &sl->effects;
+        for ( LayerEffect* e = layer->effects; e != NULL; e = e->next ) {
+            *tail = arena_alloc_elem(&s->arena, LayerEffect);
+            **tail = *e;
+            (*tail)->next = NULL;
+            tail = &(*tail)->next;
+        }
 
-                for ( Layer* layer = milton->canvas->root_layer;
-                      could_write_layer_contents && layer;
-                      layer=layer->next  ) {
-                    if ( layer->strokes.count > INT_MAX ) {
-                        milton_die_gracefully("FATAL. Number of strokes in layer greater than can be stored in file format. ");
-                    }
-                    i32 num_strokes = (i32)layer->strokes.count;
-                    char* name = layer->name;
-                    i32 len = (i32)(strlen(name) + 1);
-
-                    bool could_write_strokes = true;
-                    bool could_write_effects = true;
-
-                    if ( write_data(&len, sizeof(i32), 1, fd) &&
-                         write_data(name, sizeof(char), (size_t)len, fd) &&
-                         write_data(&layer->id, sizeof(i32), 1, fd) &&
-                         write_data(&layer->flags, sizeof(layer->flags), 1, fd) &&
-                         write_data(&num_strokes, sizeof(i32), 1, fd) ) {
-                        for ( i32 stroke_i = 0;
-                              could_write_strokes && stroke_i < num_strokes;
-                              ++stroke_i ) {
-                            Stroke* stroke = get(&layer->strokes, stroke_i);
-                            mlt_assert(stroke->num_points > 0);
-                            if ( stroke->num_points > 0 && stroke->num_points <= STROKE_MAX_POINTS ) {
-                                i32 size_of_brush = sizeof(Brush);
-                                if ( !write_data(&size_of_brush, sizeof(i32), 1, fd ) ||
-                                     !write_data(&stroke->brush, sizeof(Brush), 1, fd) ||
-                                     !write_data(&stroke->flags, sizeof(stroke->flags), 1, fd) ||
-                                     !write_data(&stroke->num_points, sizeof(i32), 1, fd) ||
-                                     !write_data(stroke->points, sizeof(v2l), (size_t)stroke->num_points, fd) ||
-                                     !write_data(stroke->pressures, sizeof(f32), (size_t)stroke->num_points, fd) ||
-                                     !write_data(&stroke->layer_id, sizeof(i32), 1, fd) ) {
-                                    could_write_strokes = false;
-                                    break;
-                                }
-                            } else {
-                                milton_log("WARNING: Trying to write a stroke of size %d\n", stroke->num_points);
-                            }
-                        }
-                    } else {
-                        could_write_strokes = false;
-                    }
+        strokelist_freeze(&layer->strokes, &sl->strokes, &s->arena);
+        s->num_strokes += sl->strokes.count;
+        if ( attach ) {
+            mlt_assert(layer->frozen == NULL);
+            layer->frozen = &sl->strokes;
+        }
+    }
+    s->attached = attach;
 
-                    if ( !could_write_strokes ) {
-                        could_write_effects = false;
-                    }
-                    else {
-                        i64 num_effects = 0;
-                        for ( LayerEffect* e = layer->effects; e != NULL; e = e->next ) {
-                            ++num_effects;
-                        }
-                        if ( write_data(&num_effects, sizeof(num_effects), 1, fd) ) {
-                            for ( LayerEffect* e = layer->effects; e != NULL; e = e->next ) {
-                                if ( write_data(&e->type, sizeof(e->type), 1, fd) &&
-                                     write_data(&e->enabled, sizeof(e->enabled), 1, fd) ) {
-                                    switch (e->type) {
-                                        case LayerEffectType_BLUR: {
-                                            if ( !write_data(&e->blur.original_scale, sizeof(e->blur.original_scale), 1, fd) ||
-                                                 !write_data(&e->blur.kernel_size, sizeof(e->blur.kernel_size), 1, fd) ) {
-                                                could_write_effects = false;
-                                            }
-                                        } break;
-                                    }
-                                }
-                                else {
-                                    could_write_effects = false;
-                                }
-                            }
-                        }
-                    }
-                    if (!could_write_strokes || !could_write_effects) {
-                        could_write_layer_contents = false;
-                    }
-                }
+    s->history_count = milton->canvas->history.count;
+    s->history = arena_alloc_array(&s->arena, max(s->history_count, 1), HistoryElement);
+    if ( s->history_count ) {
+        memcpy(s->history, milton->canvas->history.data, (size_t)s->history_count * sizeof(HistoryElement));
+    }
 
-                if ( could_write_layer_contents ) {
-                    b32 could_write_picker = true;
-                    if ( milton_binary_version >= 5 ) {
-                        v3f rgb = gui_get_picker_rgb(milton->gui);
-                        could_write_picker = write_data(&rgb, sizeof(rgb), 1, fd);
-                    }
-                    else {
-                        could_write_picker = write_data(&milton->gui->picker.data, sizeof(PickerData), 1, fd);
-                    }
+    s->picker_rgb = gui_get_picker_rgb(milton->gui);
+    s->picker_data = milton->gui->picker.data;
+    for ( ColorButton* b = milton->gui->picker.color_buttons; b != NULL; b = b->next ) {
+        ++s->num_buttons;
+    }
+    s->button_colors = arena_alloc_array(&s->arena, max(s->num_buttons, 1), v4f);
+    i32 button_i = 0;
+    for ( ColorButton* b = milton->gui->picker.color_buttons; b != NULL; b = b->next ) {
+        s->button_colors[button_i++] = b->rgba;
+    }
 
-                    //
-                    // Buttons
-                    //
-                    b32 could_write_buttons = true;
-
-                    if ( could_write_picker ) {
-                        i32 button_count = 0;
-                        MiltonGui* gui = milton->gui;
-                        // Count buttons
-                        for (ColorButton* b = gui->picker.color_buttons; b!= NULL; b = b->next, button_count++) { }
-                        // Write
-                        could_write_buttons = write_data(&button_count, sizeof(i32), 1, fd);
-                        if ( could_write_buttons ) {
-                            for ( ColorButton* b = gui->picker.color_buttons;
-                                  could_write_buttons && b!= NULL;
-                                  b = b->next ) {
-                                could_write_buttons = write_data(&b->rgba, sizeof(v4f), 1, fd);
-                            }
-                        }
-                    }
-                    else {
-                        could_write_buttons = false;
-                    }
+    memcpy(s->brushes, milton->brushes, sizeof(s->brushes));
+    memcpy(s->brush_sizes, milton->brush_sizes, sizeof(s->brush_sizes));
+    s->grid_rows = milton->grid_rows;
+    s->grid_columns = milton->grid_columns;
+    s->compress_strokes = milton->settings->compress_canvas;
 
-                    if ( could_write_buttons ) {
+    return s;
+}
 
-                        //
-                        // Brush
-                        //
-                        b32 could_write_brushes = true;
+void
+milton_free_snapshot(CanvasSnapshot* s)
+{
+    for ( i32 i = 0; i < s->num_layers; ++i ) {
+        SnapshotLayer* sl = s->layers + i;
+        if ( s->attached ) {
+            mlt_assert(sl->layer->frozen == &sl->strokes);
+            sl->layer->frozen = NULL;
+        }
+        strokelist_unfreeze(&sl->layer->strokes, &sl->strokes);
+    }
+    arena_free(&s->arena);  // Note: This destroys the snapshot.
+}
 
-                        i32 size_of_brush = sizeof(Brush);
+static bool
+write_section_data(MltSection* section, FILE* fd)
+{
+    bool ok = write_data(&section->type, sizeof(section->type), 1, fd) &&
+              write_data(&section->layer_id, sizeof(section->layer_id), 1, fd) &&
+              write_data(&section->offset, sizeof(section->offset), 1, fd) &&
+              write_data(&section->size, sizeof(section->size), 1, fd) &&
+              write_data(&section->first_stroke, sizeof(section->first_stroke), 1, fd) &&
+              write_data(&section->num_strokes, sizeof(section->num_strokes), 1, fd) &&
+              write_data(&section->num_points, sizeof(section->num_points), 1, fd) &&
+              write_data(&section->bounds, sizeof(section->bounds), 1, fd);
+    return ok;
+}
 
-                        u16 num_brushes = 3;  // Brush, eraser, primitive.
-                        if ( !write_data(&num_brushes, sizeof(num_brushes), 1, fd) ||
-                             !write_data(&size_of_brush, sizeof(i32), 1, fd) ||
-                             !write_data(&milton->brushes, sizeof(Brush), num_brushes, fd) ||
-                             !write_data(&milton->brush_sizes, sizeof(i32), num_brushes, fd) ) {
-                            could_write_brushes = false;
-                        }
+static void
+begin_section(MltSection* section, i32 type, i32 layer_id, FILE* fd)
+{
+    *section = {};
+    section->type = type;
+    section->layer_id = layer_id;
+    section->offset = (u64)ftell(fd);
+    section->bounds = rect_without_size();
+}
 
-                        if ( could_write_brushes ) {
-                            history_count = (i32)milton->canvas->history.count;
-                            if ( milton->canvas->history.count > INT_MAX ) {
-                                history_count = 0;
-                            }
+static void
+end_section(MltSection* section, FILE* fd)
+{
+    section->size = (u64)ftell(fd) - section->offset;
+}
 
-                            //
-                            // Undo history
-                            //
-
-                            if ( write_data(&history_count, sizeof(history_count), 1, fd) &&
-                                 write_data(milton->canvas->history.data, sizeof(*milton->canvas->history.data), (size_t)history_count, fd) ) {
-
-                                //
-                                // Layer alpha
-                                //
-                                b32 could_write_layer_alpha = true;
-
-                                if ( milton_binary_version >= 3 ) {
-                                    Layer* l = milton->canvas->root_layer;
-                                    for ( i64 i = 0;
-                                          could_write_layer_alpha && i < num_layers;
-                                          ++i ) {
-                                        mlt_assert(l);
-                                        if ( !write_data(&l->alpha, sizeof(l->alpha), 1, fd) ) {
-                                            could_write_layer_alpha = false;
-                                        }
-                                        l = l->next;
-                                    }
-                                }
-
-                                if ( could_write_layer_alpha ) {
-
-                                  //
-                                  // Grid Sizes
-                                  //
-
-                                  b32 could_write_grid_sizes = true;
-
-                                  if ( milton_binary_version >= 10 ) {
-                                    if ( !write_data(&milton->grid_rows, sizeof(milton->grid_rows), 1, fd) ||
-                                         !write_data(&milton->grid_columns, sizeof(milton->grid_columns), 1, fd) ) {
-                                      could_write_grid_sizes = false;
-                                    }
-                                  }
-
-                                  //
-                                  // Done.
-                                  //
-                                  if ( could_write_grid_sizes ) {
-                                    could_write_milton_state = true;
-                                  }
-                                }
-                            }
-                        }
+static bool
+write_padding(u64 alignment, FILE* fd)
+{
+    u8 zeros[8] = {};
+    u64 pos = (u64)ftell(fd);
+    u64 padding = (alignment - pos % alignment) % alignment;
+    bool ok = padding == 0 || write_data(zeros, 1, (size_t)padding, fd);
+    return ok;
+}
+
+// Stroke layout in a block. Point data is 8-byte aligned, so that a loader
+// can use it in place.
+//
+//   i32 size of brush, Brush, u32 flags, i32 num_points, i32 layer_id
+//   padding to 8 bytes
+//   v2l points[num_points], f32 pressures[num_points]
+//
+// Blocks start 8-byte aligned in the file.
+static bool
+write_block_stroke(Stroke* stroke, FILE* fd)
+{
+    i32 size_of_brush = sizeof(Brush);
+    bool ok = write_data(&size_of_brush, sizeof(i32), 1, fd) &&
+              write_data(&stroke->brush, sizeof(Brush), 1, fd) &&
+              write_data(&stroke->flags, sizeof(stroke->flags), 1, fd) &&
+              write_data(&stroke->num_points, sizeof(i32), 1, fd) &&
+              write_data(&stroke->layer_id, sizeof(i32), 1, fd) &&
+              write_padding(8, fd) &&
+              write_data(stroke->points, sizeof(v2l), (size_t)stroke->num_points, fd) &&
+              write_data(stroke->pressures, sizeof(f32), (size_t)stroke->num_points, fd);
+    return ok;
+}
+
+static void
+push_varint(DArray<u8>* out, u64 value)
+{
+    while ( value >= 0x80 ) {
+        push(out, (u8)(value | 0x80));
+        value >>= 7;
+    }
+    push(out, (u8)value);
+}
+
+static u64
+zigzag(i64 value)
+{
+    return ((u64)value << 1) ^ (u64)(value >> 63);
+}
+
+static void
+push_bytes(DArray<u8>* out, void* data, size_t size)
+{
+    for ( size_t i = 0; i < size; ++i ) {
+        push(out, ((u8*)data)[i]);
+    }
+}
+
+// Compressed stroke layout in a packed block.
+//
+//   i32 size of brush, Brush, u32 flags, i32 num_points, i32 layer_id
+//   points: zig-zag varints. x and y of the first point, then deltas from the previous point.
+//   pressures: u16 each, quantized to MLT_PRESSURE_STEPS.
+//
+// Neighboring points are close, so most coordinates take one or two bytes
+// instead of eight.
+static void
+encode_packed_stroke(Stroke* stroke, DArray<u8>* out)
+{
+    i32 size_of_brush = sizeof(Brush);
+    push_bytes(out, &size_of_brush, sizeof(i32));
+    push_bytes(out, &stroke->brush, sizeof(Brush));
+    push_bytes(out, &stroke->flags, sizeof(stroke->flags));
+    push_bytes(out, &stroke->num_points, sizeof(i32));
+    push_bytes(out, &stroke->layer_id, sizeof(i32));
+
+    v2l prev = {};
+    for ( i32 i = 0; i < stroke->num_points; ++i ) {
+        v2l p = stroke->points[i];
+        push_varint(out, zigzag(p.x - prev.x));
+        push_varint(out, zigzag(p.y - prev.y));
+        prev = p;
+    }
+    for ( i32 i = 0; i < stroke->num_points; ++i ) {
+        f32 pressure = clamp(stroke->pressures[i], 0.0f, 1.0f);
+        u16 q = (u16)(pressure * MLT_PRESSURE_STEPS + 0.5f);
+        push(out, (u8)(q & 0xff));
+        push(out, (u8)(q >> 8));
+    }
+}
+
+// A packed block, encoded before it is written. Only reads the snapshot, so
+// blocks can be encoded on any thread.
+struct BlockEncode
+{
+    FrozenStrokeList*   strokes;
+    i32                 first_stroke;
+    i32                 num_strokes;
+
+    DArray<u8>          bytes;
+    Rect                bounds;
+    i64                 num_points;
+};
+
+// Job system callback.
+static void
+encode_blocks(void* data, i64 begin, i64 end, i32 worker)
+{
+    TRACE_FUNCTION();
+    BlockEncode* blocks = (BlockEncode*)data;
+    for ( i64 i = begin; i < end; ++i ) {
+        BlockEncode* b = blocks + i;
+        reset(&b->bytes);
+        b->bounds = rect_without_size();
+        b->num_points = 0;
+        for ( i32 stroke_i = b->first_stroke; stroke_i < b->first_stroke + b->num_strokes; ++stroke_i ) {
+            Stroke stroke = strokelist_frozen_get(b->strokes, stroke_i);
+            mlt_assert(stroke.num_points > 0 && stroke.num_points <= STROKE_MAX_POINTS);
+            encode_packed_stroke(&stroke, &b->bytes);
+            b->bounds = rect_union(b->bounds, stroke.bounding_rect);
+            b->num_points += stroke.num_points;
+        }
+    }
+}
+
+static bool
+write_canvas_section(CanvasSnapshot* s, u64 snapshot_id, FILE* fd)
+{
+    i32 size_of_brush = sizeof(Brush);
+    u16 num_brushes = 3;  // Brush, eraser, primitive.
+    i32 history_count = (i32)s->history_count;
+    if ( s->history_count > INT_MAX ) {
+        history_count = 0;
+    }
+    bool ok = write_data(&s->view, sizeof(CanvasView), 1, fd) &&
+              write_data(&s->layer_guid, sizeof(i32), 1, fd) &&
+              write_data(&s->picker_rgb, sizeof(s->picker_rgb), 1, fd) &&
+              write_data(&s->num_buttons, sizeof(i32), 1, fd) &&
+              write_data(s->button_colors, sizeof(v4f), (size_t)s->num_buttons, fd) &&
+              write_data(&num_brushes, sizeof(num_brushes), 1, fd) &&
+              write_data(&size_of_brush, sizeof(i32), 1, fd) &&
+              write_data(&s->brushes, sizeof(Brush), num_brushes, fd) &&
+              write_data(&s->brush_sizes, sizeof(i32), num_brushes, fd) &&
+              write_data(&history_count, sizeof(history_count), 1, fd) &&
+              write_data(s->history, sizeof(*s->history), (size_t)history_count, fd) &&
+              write_data(&s->grid_rows, sizeof(s->grid_rows), 1, fd) &&
+              write_data(&s->grid_columns, sizeof(s->grid_columns), 1, fd) &&
+              write_data(&snapshot_id, sizeof(snapshot_id), 1, fd);
+    return ok;
+}
+
+static bool
+write_layer_section(SnapshotLayer* layer, i32 num_blocks, FILE* fd)
+{
+    i32 len = (i32)(strlen(layer->name) + 1);
+    i64 num_effects = 0;
+    for ( LayerEffect* e = layer->effects; e != NULL; e = e->next ) {
+        ++num_effects;
+    }
+    bool ok = write_data(&len, sizeof(i32), 1, fd) &&
+              write_data(layer->name, sizeof(char), (size_t)len, fd) &&
+              write_data(&layer->id, sizeof(i32), 1, fd) &&
+              write_data(&layer->flags, sizeof(layer->flags), 1, fd) &&
+              write_data(&layer->alpha, sizeof(layer->alpha), 1, fd) &&
+              write_data(&num_blocks, sizeof(num_blocks), 1, fd) &&
+              write_data(&num_effects, sizeof(num_effects), 1, fd);
+    for ( LayerEffect* e = layer->effects; ok && e != NULL; e = e->next ) {
+        ok = write_data(&e->type, sizeof(e->type), 1, fd) &&
+             write_data(&e->enabled, sizeof(e->enabled), 1, fd);
+        if ( ok && e->type == LayerEffectType_BLUR ) {
+            ok = write_data(&e->blur.original_scale, sizeof(e->blur.original_scale), 1, fd) &&
+                 write_data(&e->blur.kernel_size, sizeof(e->blur.kernel_size), 1, fd);
+        }
+    }
+    return ok;
+}
+
+// Writes the canvas in the sectioned format.
+//
+//   u32 magic, u32 version, u64 table offset, u32 number of sections
+//   section data...
+//   section table
+//
+// The table is at the end so that sections can be written in one pass. The
+// header is patched once the table offset is known.
+static bool
+write_mlt(CanvasSnapshot* s, u64 snapshot_id, FILE* fd)
+{
+    TRACE_FUNCTION();
+    DArray<MltSection> table = {};
+    BlockEncode encoded[MLT_ENCODE_BLOCKS] = {};
+
+    u32 milton_magic = MILTON_MAGIC_NUMBER;
+    u32 milton_binary_version = s->mlt_binary_version;
+    u64 table_offset = 0;
+    u32 num_sections = 0;
+    bool ok = write_data(&milton_magic, sizeof(u32), 1, fd) &&
+              write_data(&milton_binary_version, sizeof(u32), 1, fd) &&
+              write_data(&table_offset, sizeof(table_offset), 1, fd) &&
+              write_data(&num_sections, sizeof(num_sections), 1, fd);
+
+    if ( ok ) {
+        MltSection section = {};
+        begin_section(&section, MltSection_CANVAS, 0, fd);
+        ok = write_canvas_section(s, snapshot_id, fd);
+        end_section(&section, fd);
+        push(&table, section);
+    }
+
+    for ( i32 layer_i = 0; ok && layer_i < s->num_layers; ++layer_i ) {
+        SnapshotLayer* layer = s->layers + layer_i;
+        if ( layer->strokes.count > INT_MAX ) {
+            milton_die_gracefully("FATAL. Number of strokes in layer greater than can be stored in file format. ");
+        }
+        i32 num_strokes = (i32)layer->strokes.count;
+        i32 num_blocks = (num_strokes + MLT_STROKES_PER_BLOCK - 1) / MLT_STROKES_PER_BLOCK;
+
+        MltSection layer_section = {};
+        begin_section(&layer_section, MltSection_LAYER, layer->id, fd);
+        ok = write_layer_section(layer, num_blocks, fd);
+        end_section(&layer_section, fd);
+        layer_section.num_strokes = num_strokes;
+        i64 layer_table_i = table.count;
+        push(&table, layer_section);
+
+        for ( i32 block_i = 0; ok && block_i < num_blocks; ++block_i ) {
+            i32 first = block_i*MLT_STROKES_PER_BLOCK;
+            ok = write_padding(8, fd);
+            MltSection block = {};
+            begin_section(&block, s->compress_strokes ? MltSection_PACKED_STROKE_BLOCK : MltSection_STROKE_BLOCK, layer->id, fd);
+            block.first_stroke = first;
+            block.num_strokes = min(MLT_STROKES_PER_BLOCK, num_strokes - first);
+            if ( s->compress_strokes ) {
+                if ( block_i % MLT_ENCODE_BLOCKS == 0 ) {
+                    i32 count = min(MLT_ENCODE_BLOCKS, num_blocks - block_i);
+                    for ( i32 i = 0; i < count; ++i ) {
+                        encoded[i].strokes = &layer->strokes;
+                        encoded[i].first_stroke = first + i*MLT_STROKES_PER_BLOCK;
+                        encoded[i].num_strokes = min(MLT_STROKES_PER_BLOCK, num_strokes - encoded[i].first_stroke);
                     }
+                    parallel_for(count, 1, encode_blocks, encoded);
+                }
+                BlockEncode* e = encoded + block_i % MLT_ENCODE_BLOCKS;
+                ok = ok && write_data(e->bytes.data, 1, (size_t)e->bytes.count, fd);
+                block.bounds = e->bounds;
+                block.num_points = e->num_points;
+            }
+            else {
+                for ( i32 stroke_i = first; ok && stroke_i < first + block.num_strokes; ++stroke_i ) {
+                    Stroke stroke = strokelist_frozen_get(&layer->strokes, stroke_i);
+                    mlt_assert(stroke.num_points > 0 && stroke.num_points <= STROKE_MAX_POINTS);
+                    ok = write_block_stroke(&stroke, fd);
+                    block.bounds = rect_union(block.bounds, stroke.bounding_rect);
+                    block.num_points += stroke.num_points;
                 }
             }
+            end_section(&block, fd);
+            push(&table, block);
+            table[layer_table_i].bounds = rect_union(table[layer_table_i].bounds, block.bounds);
+        }
+    }
+
+    if ( ok ) {
+        table_offset = (u64)ftell(fd);
+        num_sections = (u32)table.count;
+        for ( i64 i = 0; ok && i < table.count; ++i ) {
+            ok = write_section_data(&table[i], fd);
         }
+    }
+    if ( ok ) {
+        // Patch the header.
+        u64 end = g_bytes_written;
+        ok = fseek(fd, 2 * sizeof(u32), SEEK_SET) == 0 &&
+             write_data(&table_offset, sizeof(table_offset), 1, fd) &&
+             write_data(&num_sections, sizeof(num_sections), 1, fd);
+        g_bytes_written = end;
+    }
+
+    for ( i32 i = 0; i < MLT_ENCODE_BLOCKS; ++i ) {
+        release(&encoded[i].bytes);
+    }
+    release(&table);
+    return ok;
+}
+
+// Writes a snapshot. Does not change MiltonPersist, so it can run on the save
+// thread. See milton_commit_snapshot.
+u64
+milton_save_snapshot(Milton* milton, CanvasSnapshot* s)
+{
+    TRACE_FUNCTION();
+    begin_data_tracking();
+    u64 snapshot_id = journal_next_snapshot_id(s->mlt_file_path, s->snapshot_id);
+    milton->flags |= MiltonStateFlags_LAST_SAVE_FAILED;  // Assume failure. Remove flag on success.
+    s->saved = false;
+
+    int pid = (int)getpid();
+    PATH_CHAR tmp_fname[MAX_PATH] = {};
+    PATH_SNPRINTF(tmp_fname, MAX_PATH, TO_PATH_STR("%s.mlt_tmp_%d"), s->mlt_file_path, pid);
+
+    FILE* fd = platform_fopen(tmp_fname, TO_PATH_STR("wb"));
+
+    if ( fd ) {
+        b32 could_write_milton_state = write_mlt(s, snapshot_id, fd);
 
         int file_error = ferror(fd);
         if ( file_error == 0 ) {
@@ -700,9 +1698,12 @@ milton_save(Milton* milton)
                     platform_dialog("Milton failed to write to the file!", "Save error.");
                 }
                 else {
-                    if ( platform_move_file(tmp_fname, milton->persist->mlt_file_path) ) {
+                    if ( platform_move_file(tmp_fname, s->mlt_file_path) ) {
                         //  \o/
-                        milton_save_postlude(milton);
+                        s->saved = true;
+                        s->snapshot_id = snapshot_id;
+                        s->snapshot_bytes = g_bytes_written;
+                        s->journal_ok = journal_reset(s->mlt_file_path, snapshot_id);
                     }
                     else {
                         milton_log("Could not move file. Moving on. Avoiding this save.\n");
@@ -727,6 +1728,39 @@ milton_save(Milton* milton)
     return bytes_written;
 }
 
+void
+milton_commit_snapshot(Milton* milton, CanvasSnapshot* s)
+{
+    MiltonPersist* p = milton->persist;
+    // The canvas or its file changed while the snapshot was being written.
+    if ( s->saved && s->epoch == p->epoch ) {
+        p->snapshot_id = s->snapshot_id;
+        p->snapshot_bytes = s->snapshot_bytes;
+        if ( s->journal_ok ) {
+            p->journal_bytes = sizeof(u32) + sizeof(u32) + sizeof(u64);
+        } else {
+            p->journal_bytes = 0;
+            p->compaction_requested = true;
+        }
+        p->last_save_time = milton_clock_walltime(milton);
+        p->last_save_stroke_count = s->num_strokes;
+        milton->flags &= ~MiltonStateFlags_LAST_SAVE_FAILED;
+    }
+}
+
+u64
+milton_save(Milton* milton)
+{
+    TRACE_FUNCTION();
+    CanvasSnapshot* snapshot = milton_canvas_snapshot(milton, /*attach*/false);
+    u64 bytes_written = milton_save_snapshot(milton, snapshot);
+    milton_lock_save(milton);
+    milton_commit_snapshot(milton, snapshot);
+    milton_unlock_save(milton);
+    milton_free_snapshot(snapshot);
+    return bytes_written;
+}
+
 PATH_CHAR*
 milton_get_last_canvas_fname()
 {
@@ -786,9 +1820,10 @@ write_func(void* context, void* data, int size)
     }
 }
 
-void
-milton_save_buffer_to_file(PATH_CHAR* fname, u8* buffer, i32 w, i32 h)
+char*
+milton_write_buffer_to_file(PATH_CHAR* fname, u8* buffer, i32 w, i32 h)
 {
+    char* error = NULL;
     int len = 0;
     {
         size_t sz = PATH_STRLEN(fname);
@@ -838,31 +1873,41 @@ milton_save_buffer_to_file(PATH_CHAR* fname, u8* buffer, i32 w, i32 h)
                 tje_encode_with_func(write_func, &fd, 3, w, h, 4, buffer);
             }
             else {
-                platform_dialog("File extension not handled by Milton\n", "Info");
+                error = "File extension not handled by Milton";
             }
 
             // !! fd might have been set to NULL if write_func failed.
             if ( fd ) {
                 if ( ferror(fd) ) {
-                    platform_dialog("Unknown error when writing to file :(", "Unknown error");
-                }
-                else {
-                    platform_dialog("Image exported successfully!", "Success");
+                    error = "Unknown error when writing to file :(";
                 }
                 fclose(fd);
             }
             else {
-                platform_dialog("File created, but there was an error writing to it.", "Error");
+                error = "File created, but there was an error writing to it.";
             }
         }
         else {
-            platform_dialog ( "Could not open file", "Error" );
+            error = "Could not open file";
         }
     }
     else {
-        platform_dialog("File name missing extension!\n", "Error");
+        error = "File name missing extension!";
     }
     mlt_free(fname_copy, "Strings");
+    return error;
+}
+
+void
+milton_save_buffer_to_file(PATH_CHAR* fname, u8* buffer, i32 w, i32 h)
+{
+    char* error = milton_write_buffer_to_file(fname, buffer, w, h);
+    if ( error ) {
+        platform_dialog(error, "Error");
+    }
+    else {
+        platform_dialog("Image exported successfully!", "Success");
+    }
 }
 
 b32
@@ -926,8 +1971,9 @@ milton_settings_load(MiltonSettings* settings)
     if ( fd ) {
         u16 struct_size = 0;
         if ( fread(&struct_size, sizeof(u16), 1, fd) ) {
+            // Older files are shorter. Members added since keep their defaults.
             if (struct_size <= sizeof(*settings)) {
-                if ( fread(settings, sizeof(*settings), 1, fd) ) {
+                if ( fread(settings, struct_size, 1, fd) ) {
                     ok = true;
                 }
             }
@@ -4,10 +4,82 @@
 #pragma once
 
 #include "platform.h"
+#include "DArray.h"
+#include "stroke.h"
+#include "milton.h"
+#include "gui.h"
 
 struct Milton;
 struct MiltonSettings;
 
+// Stroke changes since the last full save are appended to a journal file next
+// to the .mlt file. Records store absolute positions in the layer, so
+// replaying a record that the snapshot already contains is harmless.
+enum JournalRecordType
+{
+    JournalRecord_STROKE_ADD = 1,  // New stroke or redo.
+    JournalRecord_STROKE_POP = 2,  // Undo.
+};
+
+struct JournalRecord
+{
+    i32     type;  // JournalRecordType
+    i32     layer_id;
+    i64     stroke_i;  // STROKE_ADD: index of the stroke. STROKE_POP: stroke count after the pop.
+    Stroke  stroke;    // Only used by STROKE_ADD.
+};
+
+// Frozen copy of everything that goes into a .mlt file. Built on the main
+// thread in time proportional to the number of layers, then written by the
+// save thread while painting continues. Stroke lists are shared with the
+// canvas; see FrozenStrokeList.
+struct SnapshotLayer
+{
+    Layer*              layer;  // While attached, layer->frozen points to `strokes`.
+    i32                 id;
+    char                name[MAX_LAYER_NAME_LEN];
+    i32                 flags;
+    float               alpha;
+    LayerEffect*        effects;  // Copy.
+    FrozenStrokeList    strokes;
+};
+
+struct CanvasSnapshot
+{
+    Arena           arena;
+
+    PATH_CHAR       mlt_file_path[MAX_PATH];
+    u64             epoch;  // MiltonPersist::epoch when the snapshot was taken.
+    u32             mlt_binary_version;
+
+    CanvasView      view;
+    i32             layer_guid;
+    i32             num_layers;
+    SnapshotLayer*  layers;
+    i64             num_strokes;
+    HistoryElement* history;
+    i64             history_count;
+
+    v3f             picker_rgb;
+    PickerData      picker_data;
+    i32             num_buttons;
+    v4f*            button_colors;
+    Brush           brushes[BrushEnum_COUNT];
+    i32             brush_sizes[BrushEnum_COUNT];
+    i32             grid_rows;
+    i32             grid_columns;
+    b32             compress_strokes;
+
+    b32             attached;  // Layers point back to this snapshot.
+
+    // Written by milton_save_snapshot.
+    SDL_atomic_t    done;
+    b32             saved;
+    u64             snapshot_id;
+    u64             snapshot_bytes;
+    b32             journal_ok;
+};
+
 struct MiltonPersist
 {
     // Persistence
@@ -21,13 +93,45 @@ struct MiltonPersist
     float target_MB_per_sec;
 
     sz bytes_to_last_block;
+
+    // Journal
+    DArray<JournalRecord> journal_queue;  // Records not yet written. Guarded by save_mutex with MILTON_SAVE_ASYNC.
+    b32 compaction_requested;             // Next save writes the whole file and starts a new journal.
+    u64 snapshot_id;                      // Stored at the end of the .mlt file and at the start of its journal.
+    u64 snapshot_bytes;
+    u64 journal_bytes;                    // Zero if there is no journal that matches the .mlt file. Guarded by save_mutex.
+    b32 journal_failed;                   // An append failed. Moved to milton->flags by the main thread. Guarded by save_mutex.
+    u64 layers_hash;                      // Layer state at the time of the last requested compaction.
+    u64 bytes_written;                    // By every save since startup. Guarded by save_mutex.
+
+    // Snapshots. With MILTON_SAVE_ASYNC, the main thread hands pending_snapshot to the
+    // save thread and frees active_snapshot once it is done.
+    CanvasSnapshot* pending_snapshot;     // Guarded by save_mutex.
+    CanvasSnapshot* active_snapshot;      // Main thread only.
+    DArray<JournalRecord> journal_carry;  // Records written to the old journal while a snapshot waits. Guarded by save_mutex.
+    u64 epoch;                            // Bumped when the canvas or its file changes. Guarded by save_mutex.
+    SDL_atomic_t save_in_progress;        // Set while the save thread is reading canvas memory.
 };
 
 PATH_CHAR* milton_get_last_canvas_fname();
 
-void milton_load(Milton* milton);
+// Returns false if the file could not be loaded. The canvas is then reset to the default.
+b32 milton_load(Milton* milton);
 u64 milton_save(Milton* milton);
 
+// Snapshots are attached when painting may continue while they are written.
+CanvasSnapshot* milton_canvas_snapshot(Milton* milton, b32 attach);
+u64  milton_save_snapshot(Milton* milton, CanvasSnapshot* snapshot);
+void milton_commit_snapshot(Milton* milton, CanvasSnapshot* snapshot);  // Updates MiltonPersist if the snapshot is still current. Call it inside milton_lock_save.
+void milton_free_snapshot(CanvasSnapshot* snapshot);
+
+u64 milton_journal_append(Milton* milton, JournalRecord* records, i64 count);
+b32 milton_journal_needs_compaction(MiltonPersist* persist);
+
+// Writes a PNG or a JPEG, depending on the extension. Returns NULL on
+// success, or a description of the error.
+char* milton_write_buffer_to_file(PATH_CHAR* fname, u8* buffer, i32 w, i32 h);
+// Same, reporting the result with a dialog.
 void milton_save_buffer_to_file(PATH_CHAR* fname, u8* buffer, i32 w, i32 h);
 
 b32  platform_settings_load(PlatformSettings* prefs);
@@ -42,6 +42,32 @@ struct SDL_Cursor;
 
 struct PlatformSpecific;
 
+// A pointer sample: a tablet packet or a mouse position.
+struct InputSample
+{
+    v2l point;     // In pixels.
+    f32 pressure;  // NO_PRESSURE_INFO for the mouse.
+    u64 time;      // perf_counter() when the event was handled.
+};
+
+#define INPUT_RING_SIZE 4096  // Power of two.
+
+// Lock-free queue with one producer and one consumer. Samples are pushed as
+// their events are handled and each frame takes all of them, so none are
+// lost when a frame is slow.
+struct InputRing
+{
+    InputSample     samples[INPUT_RING_SIZE];
+    SDL_atomic_t    head;     // Next sample to write. Only the producer moves it.
+    SDL_atomic_t    tail;     // Next sample to read. Only the consumer moves it.
+    SDL_atomic_t    dropped;  // Samples pushed while the ring was full.
+};
+
+// False when the ring is full.
+b32 input_ring_push(InputRing* ring, InputSample sample);
+// Takes up to `max_count` samples, oldest first. Returns how many.
+i64 input_ring_pop(InputRing* ring, InputSample* out, i64 max_count);
+
 struct PlatformState
 {
     i32 width;
@@ -63,8 +89,8 @@ struct PlatformState
     b32 should_quit;
     u32 window_id;
 
-    i32 num_pressure_results;
-    i32 num_point_results;
+    InputRing* input_ring;
+    b32 drop_samples;  // The samples pushed so far are not for the canvas.
     b32 stopped_panning;
 
     b32 force_next_frame;  // Used for IMGUI, since some operations take 1+ frames.
@@ -97,11 +123,13 @@ typedef enum HistoryDebug
 typedef struct MiltonStartupFlags
 {
     HistoryDebug history_debug;
+    char*        history_file;     // Input recording to write or play. See replay.h
+    b32          replay_realtime;  // Otherwise frames are replayed back to back.
 } MiltonStartupFlags;
 
 typedef struct TabletState_s TabletState;
 
-int milton_main(bool is_fullscreen, char* file_to_open);
+int milton_main(bool is_fullscreen, char* file_to_open, MiltonStartupFlags startup_flags = {});
 
 void    platform_init(PlatformState* platform, SDL_SysWMinfo* sysinfo);
 void    platform_deinit(PlatformState* platform);
@@ -171,6 +199,16 @@ struct PlatformSettings
 // Defined in platform_windows.cc
 FILE*   platform_fopen(const PATH_CHAR* fname, const PATH_CHAR* mode);
 
+// Read-only mapping of a whole file.
+struct PlatformFileMapping
+{
+    u8* data;
+    u64 size;
+};
+// Returns false if the file can't be mapped. Callers should fall back to reading it.
+b32     platform_map_file(const PATH_CHAR* fname, PlatformFileMapping* mapping);
+void    platform_unmap_file(PlatformFileMapping* mapping);
+
 // Returns a 0-terminated string with the full path of the target file.
 // If the user cancels the operation it returns NULL.
 PATH_CHAR*   platform_open_dialog(FileKind kind);
@@ -224,6 +262,25 @@ i32 platform_monitor_refresh_hz();
 u64 perf_counter();
 float perf_count_to_sec(u64 counter);
 
+// Largest resident size of the process so far.
+u64 platform_peak_memory_bytes();
+
+// Threads and semaphores that don't need SDL. See jobs.h
+struct PlatformThread;
+struct PlatformSemaphore;
+typedef int PlatformThreadFunc(void* data);
+
+// Returns NULL if the thread can't be created.
+PlatformThread*     platform_thread_create(PlatformThreadFunc* func, void* data);
+void                platform_thread_join(PlatformThread* thread);
+void                platform_thread_yield();
+i32                 platform_cpu_count();
+
+PlatformSemaphore*  platform_semaphore_create(i32 value);
+void                platform_semaphore_destroy(PlatformSemaphore* sem);
+void                platform_semaphore_wait(PlatformSemaphore* sem);
+void                platform_semaphore_post(PlatformSemaphore* sem);
+
     
 #if defined(__cplusplus)
 }
@@ -23,14 +23,14 @@ perf_counter()
 {
     // http://stackoverflow.com/a/2660610/4717805
     timespec tp;
-    int res = clock_gettime(CLOCK_REALTIME, &tp);
+    int res = clock_gettime(CLOCK_MONOTONIC, &tp);
 
     // TODO: Check errno and provide more information
     if ( res ) {
         milton_log("Something went wrong with clock_gettime\n");
     }
 
-    return tp.tv_nsec;
+    return (u64)tp.tv_sec * 1000000000 + (u64)tp.tv_nsec;
 }
 
 void
@@ -241,14 +241,14 @@ perf_counter()
     // clock_gettime() on macOS is only supported on macOS Sierra and later.
     // For older macOS operating systems, mach_absolute_time() will be need to be used.
     timespec tp;
-    int res = clock_gettime(CLOCK_REALTIME, &tp);
+    int res = clock_gettime(CLOCK_MONOTONIC, &tp);
 
     // TODO: Check errno and provide more information
     if ( res ) {
         milton_log("Something went wrong with clock_gettime\n");
     }
 
-    return tp.tv_nsec;
+    return (u64)tp.tv_sec * 1000000000 + (u64)tp.tv_nsec;
 }
 
 b32
@@ -5,6 +5,12 @@
 #include "platform.h"
 #include "platform_unix.h"
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
 static FILE* g_unix_logfile;
 
 void
@@ -99,6 +105,143 @@ platform_deallocate_internal(void** ptr)
     munmap(*ptr, size);
 }
 
+b32
+platform_map_file(const PATH_CHAR* fname, PlatformFileMapping* mapping)
+{
+    b32 ok = false;
+    int fd = open(fname, O_RDONLY);
+    if ( fd >= 0 ) {
+        struct stat st = {};
+        if ( fstat(fd, &st) == 0 && st.st_size > 0 ) {
+            void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if ( data != MAP_FAILED ) {
+                mapping->data = (u8*)data;
+                mapping->size = (u64)st.st_size;
+                ok = true;
+            }
+        }
+        // The mapping stays valid after closing the descriptor. Saves replace
+        // the file with a rename, so the mapped data doesn't change under us.
+        close(fd);
+    }
+    return ok;
+}
+
+void
+platform_unmap_file(PlatformFileMapping* mapping)
+{
+    if ( mapping->data ) {
+        munmap(mapping->data, (size_t)mapping->size);
+        *mapping = {};
+    }
+}
+
+struct PlatformThread
+{
+    pthread_t           thread;
+    PlatformThreadFunc* func;
+    void*               data;
+};
+
+static void*
+unix_thread_start(void* data)
+{
+    PlatformThread* t = (PlatformThread*)data;
+    t->func(t->data);
+    return NULL;
+}
+
+PlatformThread*
+platform_thread_create(PlatformThreadFunc* func, void* data)
+{
+    PlatformThread* t = (PlatformThread*)mlt_calloc(1, sizeof(PlatformThread), "Platform");
+    t->func = func;
+    t->data = data;
+    if ( pthread_create(&t->thread, NULL, unix_thread_start, t) != 0 ) {
+        mlt_free(t, "Platform");
+    }
+    return t;
+}
+
+void
+platform_thread_join(PlatformThread* t)
+{
+    pthread_join(t->thread, NULL);
+    mlt_free(t, "Platform");
+}
+
+void
+platform_thread_yield()
+{
+    sched_yield();
+}
+
+i32
+platform_cpu_count()
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (i32)count : 1;
+}
+
+u64
+platform_peak_memory_bytes()
+{
+    struct rusage usage = {};
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__MACH__)
+    return (u64)usage.ru_maxrss;  // Bytes on macOS, kilobytes elsewhere.
+#else
+    return (u64)usage.ru_maxrss * 1024;
+#endif
+}
+
+// POSIX semaphores are deprecated on macOS. A counter behind a mutex works
+// everywhere.
+struct PlatformSemaphore
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    i32             value;
+};
+
+PlatformSemaphore*
+platform_semaphore_create(i32 value)
+{
+    PlatformSemaphore* sem = (PlatformSemaphore*)mlt_calloc(1, sizeof(PlatformSemaphore), "Platform");
+    pthread_mutex_init(&sem->mutex, NULL);
+    pthread_cond_init(&sem->cond, NULL);
+    sem->value = value;
+    return sem;
+}
+
+void
+platform_semaphore_destroy(PlatformSemaphore* sem)
+{
+    pthread_cond_destroy(&sem->cond);
+    pthread_mutex_destroy(&sem->mutex);
+    mlt_free(sem, "Platform");
+}
+
+void
+platform_semaphore_wait(PlatformSemaphore* sem)
+{
+    pthread_mutex_lock(&sem->mutex);
+    while ( sem->value == 0 ) {
+        pthread_cond_wait(&sem->cond, &sem->mutex);
+    }
+    --sem->value;
+    pthread_mutex_unlock(&sem->mutex);
+}
+
+void
+platform_semaphore_post(PlatformSemaphore* sem)
+{
+    pthread_mutex_lock(&sem->mutex);
+    ++sem->value;
+    pthread_cond_signal(&sem->cond);
+    pthread_mutex_unlock(&sem->mutex);
+}
+
 void
 platform_cursor_hide()
 {
@@ -142,14 +285,31 @@ platform_titlebar_height(PlatformState* p)
     return 20; // TODO: implement on mac and linux
 }
 
+#if !defined(MILTON_RENDER_CLI)
 int
 main(int argc, char** argv)
 {
     char* file_to_open = NULL;
-    if ( argc == 2 ) {
-        file_to_open = argv[1];
+    MiltonStartupFlags startup_flags = {};
+    for ( int i = 1; i < argc; ++i ) {
+        // Input recordings for benchmarks. See replay.h
+        if ( !strcmp(argv[i], "--record") && i + 1 < argc ) {
+            startup_flags.history_debug = HistoryDebug_RECORD;
+            startup_flags.history_file = argv[++i];
+        }
+        else if ( !strcmp(argv[i], "--replay") && i + 1 < argc ) {
+            startup_flags.history_debug = HistoryDebug_REPLAY;
+            startup_flags.history_file = argv[++i];
+        }
+        else if ( !strcmp(argv[i], "--realtime") ) {
+            startup_flags.replay_realtime = true;
+        }
+        else {
+            file_to_open = argv[i];
+        }
     }
-    milton_main(false, file_to_open);
+    milton_main(false, file_to_open, startup_flags);
 }
+#endif
 
 
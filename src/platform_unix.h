@@ -52,6 +52,7 @@
 //#define PATH_STRCAT strcat
 #define PATH_STRNCAT strncat
 #define PATH_SNPRINTF snprintf
+#define PATH_REMOVE remove
 
 #define platform_milton_log unix_log
 #define platform_milton_log_args unix_log_args
@@ -6,6 +6,8 @@
 
 #include "memory.h"
 
+#include <psapi.h>
+
 extern "C" {
 
 static FILE* g_win32_logfile;
@@ -312,6 +314,19 @@ platform_fopen(const PATH_CHAR* fname, const PATH_CHAR* mode)
     return fd;
 }
 
+// Not supported. MoveFileEx can't replace a file that has a mapped view, so
+// saving over a mapped .mlt would fail.
+b32
+platform_map_file(const PATH_CHAR* fname, PlatformFileMapping* mapping)
+{
+    return false;
+}
+
+void
+platform_unmap_file(PlatformFileMapping* mapping)
+{
+}
+
 void*
 platform_allocate(size_t size)
 {
@@ -801,6 +816,98 @@ perf_count_to_sec(u64 counter)
     return sec;
 }
 
+struct PlatformThread
+{
+    HANDLE              handle;
+    PlatformThreadFunc* func;
+    void*               data;
+};
+
+static DWORD WINAPI
+win_thread_start(LPVOID data)
+{
+    PlatformThread* t = (PlatformThread*)data;
+    return (DWORD)t->func(t->data);
+}
+
+PlatformThread*
+platform_thread_create(PlatformThreadFunc* func, void* data)
+{
+    PlatformThread* t = (PlatformThread*)mlt_calloc(1, sizeof(PlatformThread), "Platform");
+    t->func = func;
+    t->data = data;
+    t->handle = CreateThread(NULL, 0, win_thread_start, t, 0, NULL);
+    if ( t->handle == NULL ) {
+        mlt_free(t, "Platform");
+    }
+    return t;
+}
+
+void
+platform_thread_join(PlatformThread* t)
+{
+    WaitForSingleObject(t->handle, INFINITE);
+    CloseHandle(t->handle);
+    mlt_free(t, "Platform");
+}
+
+void
+platform_thread_yield()
+{
+    SwitchToThread();
+}
+
+i32
+platform_cpu_count()
+{
+    SYSTEM_INFO info = {};
+    GetSystemInfo(&info);
+    return max((i32)info.dwNumberOfProcessors, 1);
+}
+
+u64
+platform_peak_memory_bytes()
+{
+    PROCESS_MEMORY_COUNTERS counters = {};
+    // The K32 version lives in kernel32, so there is no psapi.lib to link.
+    if ( !K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ) {
+        return 0;
+    }
+    return (u64)counters.PeakWorkingSetSize;
+}
+
+struct PlatformSemaphore
+{
+    HANDLE handle;
+};
+
+PlatformSemaphore*
+platform_semaphore_create(i32 value)
+{
+    PlatformSemaphore* sem = (PlatformSemaphore*)mlt_calloc(1, sizeof(PlatformSemaphore), "Platform");
+    sem->handle = CreateSemaphore(NULL, value, LONG_MAX, NULL);
+    return sem;
+}
+
+void
+platform_semaphore_destroy(PlatformSemaphore* sem)
+{
+    CloseHandle(sem->handle);
+    mlt_free(sem, "Platform");
+}
+
+void
+platform_semaphore_wait(PlatformSemaphore* sem)
+{
+    WaitForSingleObject(sem->handle, INFINITE);
+}
+
+void
+platform_semaphore_post(PlatformSemaphore* sem)
+{
+    ReleaseSemaphore(sem->handle, 1, NULL);
+}
+
 void
 platform_cursor_hide()
 {
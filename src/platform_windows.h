@@ -123,6 +123,7 @@ float platform_ui_scale(PlatformState* p);
 #define PATH_STRCAT wcscat
 //#define PATH_STRNCAT wcsncat
 #define PATH_SNPRINTF _snwprintf
+#define PATH_REMOVE _wremove
 #define PATH_FPUTS  fputws
 
 }
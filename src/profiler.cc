@@ -1,7 +1,7 @@
 // Copyright (c) 2015 Sergio Gonzalez. All rights reserved.
 // License: https://github.com/serge-rgb/milton#license
 
-#if defined(_WIN32) && MILTON_ENABLE_PROFILING
+#if (defined(_WIN32) || defined(__linux__)) && MILTON_ENABLE_PROFILING
 u64 g_profiler_ticks[PROF_COUNT];
 u64 g_profiler_last[PROF_COUNT];
 u64 g_profiler_count[PROF_COUNT];
@@ -13,7 +13,7 @@ u64 g_profiler_count[PROF_COUNT];
 void
 profiler_reset()
 {
-#if defined(_WIN32) && MILTON_ENABLE_PROFILING
+#if (defined(_WIN32) || defined(__linux__)) && MILTON_ENABLE_PROFILING
     for ( i32 i = 0; i < PROF_COUNT; ++i ) {
         g_profiler_count[i] = 0;
     }
@@ -24,7 +24,7 @@ profiler_reset()
 void
 profiler_init()
 {
-#if defined(_WIN32) && MILTON_ENABLE_PROFILING
+#if (defined(_WIN32) || defined(__linux__)) && MILTON_ENABLE_PROFILING
     for( i64 i=0; i<PROF_COUNT; ++i ) {
         g_profiler_ticks[i] = 0;
         g_profiler_last[i]  = 0;
@@ -34,4 +34,194 @@ profiler_init()
 }
 
 
+#endif
+
+#if MILTON_ENABLE_TRACING
+
+struct TraceEvent
+{
+    const char*     name;
+    u64             start;
+    u64             end;
+    SDL_atomic_t    seq;  // 1 + the index of the event in the slot, or 0 while it is written.
+};
+
+// Written only by its thread. trace_capture_stop reads it while the thread
+// might still be writing, and skips the slots that change under it.
+struct TraceBuffer
+{
+    TraceEvent      events[TRACE_RING_SIZE];
+    SDL_atomic_t    head;  // Events written so far.
+    char            thread_name[64];
+};
+
+struct TraceState
+{
+    u64             capture_start;  // perf_counter()
+
+    SDL_SpinLock    lock;  // For adding threads.
+    TraceBuffer*    buffers[TRACE_MAX_THREADS];
+    SDL_atomic_t    num_buffers;
+    SDL_atomic_t    generation;  // Changes when the buffers are freed.
+};
+
+SDL_atomic_t g_trace_capturing;
+
+static TraceState g_trace;
+
+static thread_local TraceBuffer* t_trace_buffer;
+static thread_local int t_trace_generation;
+static thread_local char t_trace_thread_name[64];
+
+void
+trace_set_thread_name(const char* name)
+{
+    strncpy(t_trace_thread_name, name, sizeof(t_trace_thread_name) - 1);
+    if ( t_trace_buffer && t_trace_generation == SDL_AtomicGet(&g_trace.generation) ) {
+        strncpy(t_trace_buffer->thread_name, name, sizeof(t_trace_buffer->thread_name) - 1);
+    }
+}
+
+// Returns NULL when there are too many threads.
+static TraceBuffer*
+trace_thread_buffer()
+{
+    int generation = SDL_AtomicGet(&g_trace.generation);
+    if ( t_trace_generation != generation ) {
+        t_trace_buffer = NULL;
+        t_trace_generation = generation;
+    }
+    if ( !t_trace_buffer ) {
+        TraceBuffer* b = NULL;
+        SDL_AtomicLock(&g_trace.lock);
+        int n = SDL_AtomicGet(&g_trace.num_buffers);
+        if ( n < TRACE_MAX_THREADS ) {
+            b = (TraceBuffer*)mlt_calloc(1, sizeof(TraceBuffer), "Trace");
+            if ( t_trace_thread_name[0] ) {
+                strcpy(b->thread_name, t_trace_thread_name);
+            }
+            else {
+                snprintf(b->thread_name, sizeof(b->thread_name), "Thread %d", n);
+            }
+            g_trace.buffers[n] = b;
+            SDL_AtomicSet(&g_trace.num_buffers, n + 1);
+        }
+        SDL_AtomicUnlock(&g_trace.lock);
+        t_trace_buffer = b;
+    }
+    return t_trace_buffer;
+}
+
+void
+trace_record(const char* name, u64 start, u64 end)
+{
+    TraceBuffer* b = trace_thread_buffer();
+    if ( b ) {
+        int i = SDL_AtomicGet(&b->head);
+        TraceEvent* e = &b->events[i & (TRACE_RING_SIZE - 1)];
+        SDL_AtomicSet(&e->seq, 0);
+        e->name = name;
+        e->start = start;
+        e->end = end;
+        SDL_AtomicSet(&e->seq, i + 1);
+        SDL_AtomicSet(&b->head, i + 1);
+    }
+}
+
+void
+trace_capture_start()
+{
+    g_trace.capture_start = perf_counter();
+    SDL_AtomicSet(&g_trace_capturing, 1);
+}
+
+b32
+trace_is_capturing()
+{
+    return SDL_AtomicGet(&g_trace_capturing) != 0;
+}
+
+// JSON string contents. Zone names are identifiers, but thread names might
+// not be.
+static void
+trace_write_string(const char* str, FILE* fd)
+{
+    for ( const char* c = str; *c; ++c ) {
+        if ( *c == '"' || *c == '\\' ) {
+            fputc('\\', fd);
+        }
+        if ( (u8)*c >= 0x20 ) {
+            fputc(*c, fd);
+        }
+    }
+}
+
+b32
+trace_capture_stop(const PATH_CHAR* path)
+{
+    SDL_AtomicSet(&g_trace_capturing, 0);
+
+    FILE* fd = platform_fopen(path, TO_PATH_STR("wb"));
+    if ( !fd ) {
+        return false;
+    }
+
+    // Timestamps are in microseconds.
+    double us_per_count = (double)perf_count_to_sec(1<<30) * 1000000.0 / (double)(1<<30);
+
+    fprintf(fd, "{\"traceEvents\":[\n");
+    b32 first = true;
+    int num_buffers = SDL_AtomicGet(&g_trace.num_buffers);
+    for ( int tid = 0; tid < num_buffers; ++tid ) {
+        TraceBuffer* b = g_trace.buffers[tid];
+
+        fprintf(fd, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"", first ? "" : ",\n", tid);
+        trace_write_string(b->thread_name, fd);
+        fprintf(fd, "\"}}");
+        first = false;
+
+        int head = SDL_AtomicGet(&b->head);
+        for ( int i = max(head - TRACE_RING_SIZE, 0); i < head; ++i ) {
+            TraceEvent* slot = &b->events[i & (TRACE_RING_SIZE - 1)];
+            if ( SDL_AtomicGet(&slot->seq) != i + 1 ) {
+                continue;
+            }
+            TraceEvent e = *slot;
+            if ( SDL_AtomicGet(&slot->seq) != i + 1 ) {
+                continue;  // The thread wrapped around while we copied it.
+            }
+            // Zones from earlier captures are still in the ring.
+            if ( e.start < g_trace.capture_start ) {
+                continue;
+            }
+            fprintf(fd, ",\n{\"name\":\"");
+            trace_write_string(e.name, fd);
+            fprintf(fd, "\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                    tid,
+                    (double)(e.start - g_trace.capture_start) * us_per_count,
+                    (double)(e.end - e.start) * us_per_count);
+        }
+    }
+    fprintf(fd, "\n]}\n");
+
+    b32 ok = !ferror(fd);
+    if ( fclose(fd) != 0 ) {
+        ok = false;
+    }
+    return ok;
+}
+
+void
+trace_release()
+{
+    SDL_AtomicSet(&g_trace_capturing, 0);
+    int num_buffers = SDL_AtomicGet(&g_trace.num_buffers);
+    for ( int i = 0; i < num_buffers; ++i ) {
+        mlt_free(g_trace.buffers[i], "Trace");
+    }
+    SDL_AtomicSet(&g_trace.num_buffers, 0);
+    // Threads still point to their old buffers. They look for a new one.
+    SDL_AtomicAdd(&g_trace.generation, 1);
+}
+
 #endif
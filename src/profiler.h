@@ -3,6 +3,7 @@
 
 #pragma once
 
+#include "platform.h"
 
 
 // Profiler
@@ -90,7 +91,18 @@ void profiler_reset();
     #define PROFILE_GRAPH_END(name)  \
             milton->graph_frame.##name = perf_counter() - milton->graph_frame.start
 
+    // Render workers add to the same counters, so these are approximate.
+    #define PROFILE_RASTER_BEGIN(name) \
+            u64 profile_raster_##name##_start = perf_counter();
+
+    #define PROFILE_RASTER_PUSH(name) \
+            g_profiler_ticks[PROF_RASTER_##name] += perf_counter() - profile_raster_##name##_start; \
+            g_profiler_count[PROF_RASTER_##name] += 1;
+
 #elif defined(__linux__) && MILTON_ENABLE_PROFILING
+    extern u64 g_profiler_ticks[PROF_COUNT];
+    extern u64 g_profiler_last[PROF_COUNT];
+    extern u64 g_profiler_count[PROF_COUNT];
 
     #define PROFILE_GRAPH_BEGIN(name) \
             milton->graph_frame.start = perf_counter();
@@ -98,10 +110,81 @@ void profiler_reset();
     #define PROFILE_GRAPH_END(name)  \
             milton->graph_frame.name = perf_counter() - milton->graph_frame.start
 
+    #define PROFILE_RASTER_BEGIN(name) \
+            u64 profile_raster_##name##_start = perf_counter();
+
+    #define PROFILE_RASTER_PUSH(name) \
+            g_profiler_ticks[PROF_RASTER_##name] += perf_counter() - profile_raster_##name##_start; \
+            g_profiler_count[PROF_RASTER_##name] += 1;
+
 #else
 
 #define PROFILE_GRAPH_BEGIN(name)
 #define PROFILE_GRAPH_END(name)
 
+#define PROFILE_RASTER_BEGIN(name)
+#define PROFILE_RASTER_PUSH(name)
+
 #endif
 
+
+// Tracing
+//
+// TRACE_ZONE("name") times the rest of the enclosing scope, and
+// TRACE_FUNCTION() the rest of the function. While a capture is running,
+// each thread records its zones into a ring buffer of its own, and
+// trace_capture_stop writes them as Chrome trace JSON, which
+// chrome://tracing and ui.perfetto.dev can open. Only the last
+// TRACE_RING_SIZE zones of each thread are kept.
+//
+// Outside of a capture a zone is an atomic load and a branch. With
+// MILTON_ENABLE_TRACING set to 0 they compile to nothing.
+
+#define TRACE_RING_SIZE     (1<<14)  // Power of two.
+#define TRACE_MAX_THREADS   128
+
+#if MILTON_ENABLE_TRACING
+    extern SDL_atomic_t g_trace_capturing;
+
+    // `name` must outlive the capture. Usually a string literal.
+    void trace_record(const char* name, u64 start, u64 end);
+
+    struct TraceZone
+    {
+        const char* name;
+        u64         start;
+
+        TraceZone(const char* zone_name)
+        {
+            name = zone_name;
+            start = SDL_AtomicGet(&g_trace_capturing) ? perf_counter() : 0;
+        }
+        ~TraceZone()
+        {
+            if ( start && SDL_AtomicGet(&g_trace_capturing) ) {
+                trace_record(name, start, perf_counter());
+            }
+        }
+    };
+
+    #define TRACE_CONCAT_(a, b) a##b
+    #define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+    #define TRACE_ZONE(name) TraceZone TRACE_CONCAT(trace_zone_, __LINE__)(name)
+    #define TRACE_FUNCTION() TRACE_ZONE(__func__)
+
+    // Shows up as the name of the calling thread's track. Copied.
+    void    trace_set_thread_name(const char* name);
+
+    void    trace_capture_start();
+    b32     trace_is_capturing();
+    // Stops the capture and writes it to `path`. Returns false if it couldn't
+    // be written.
+    b32     trace_capture_stop(const PATH_CHAR* path);
+
+    // Frees the ring buffers. No other thread can be recording.
+    void    trace_release();
+#else
+    #define TRACE_ZONE(name)
+    #define TRACE_FUNCTION()
+#endif
@@ -0,0 +1,419 @@
+// Copyright (c) 2015 Sergio Gonzalez. All rights reserved.
+// License: https://github.com/serge-rgb/milton#license
+
+
+#include "rasterizer.h"
+
+#include "canvas.h"
+#include "jobs.h"
+#include "platform.h"
+#include "profiler.h"
+
+#define RENDER_BLOCK_PIXELS (RENDER_BLOCK_SIZE*RENDER_BLOCK_SIZE)
+
+// Maps the pixels of a block to canvas space, relative to the pan center.
+// Same transform as raster_to_canvas_gl.
+struct BlockTransform
+{
+    f32 cos_scale;
+    f32 sin_scale;
+    f32 origin_x;  // Pixel center of the top-left pixel of the block, relative to the zoom center.
+    f32 origin_y;
+    f32 inv_scale;
+    f32 cos_angle;
+    f32 sin_angle;
+};
+
+struct RasterSegment
+{
+    f32 ax, ay;
+    f32 abx, aby;
+    f32 inv_len2;  // 0 for degenerate segments, so that t is 0.
+    f32 pressure_a;
+    f32 pressure_ab;
+    f32 radius;
+};
+
+static void
+segment_to_block_pixels(BlockTransform* t, f32 left, f32 top, f32 right, f32 bottom,
+                        i32* out_x0, i32* out_y0, i32* out_x1, i32* out_y1)
+{
+    f32 corners[4][2] = {
+        { left, top }, { right, top }, { right, bottom }, { left, bottom },
+    };
+    f32 min_x = FLT_MAX, min_y = FLT_MAX, max_x = -FLT_MAX, max_y = -FLT_MAX;
+    for ( int i = 0; i < 4; ++i ) {
+        f32 x = (corners[i][0]*t->cos_angle + corners[i][1]*t->sin_angle) * t->inv_scale - t->origin_x;
+        f32 y = (corners[i][1]*t->cos_angle - corners[i][0]*t->sin_angle) * t->inv_scale - t->origin_y;
+        min_x = min(min_x, x);
+        min_y = min(min_y, y);
+        max_x = max(max_x, x);
+        max_y = max(max_y, y);
+    }
+    *out_x0 = (i32)clamp(floorf(min_x), 0.0f, (f32)RENDER_BLOCK_SIZE);
+    *out_y0 = (i32)clamp(floorf(min_y), 0.0f, (f32)RENDER_BLOCK_SIZE);
+    *out_x1 = (i32)clamp(ceilf(max_x) + 1, 0.0f, (f32)RENDER_BLOCK_SIZE);
+    *out_y1 = (i32)clamp(ceilf(max_y) + 1, 0.0f, (f32)RENDER_BLOCK_SIZE);
+}
+
+// Coverage for one segment, four pixels at a time. Keeps the smallest
+// distance/radius ratio and the largest covering pressure per pixel, which is
+// what the stroke_info pass does with GL_MIN and GL_MAX blending.
+static void
+segment_coverage_sse2(BlockgroupRenderBackend* b, BlockTransform* t, RasterSegment* s,
+                      i32 x0, i32 y0, i32 x1, i32 y1)
+{
+    const __m128 zero = _mm_set1_ps(0.0f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 four = _mm_set1_ps(4.0f);
+    const __m128 ax = _mm_set1_ps(s->ax);
+    const __m128 ay = _mm_set1_ps(s->ay);
+    const __m128 abx = _mm_set1_ps(s->abx);
+    const __m128 aby = _mm_set1_ps(s->aby);
+    const __m128 inv_len2 = _mm_set1_ps(s->inv_len2);
+    const __m128 pressure_a = _mm_set1_ps(s->pressure_a);
+    const __m128 pressure_ab = _mm_set1_ps(s->pressure_ab);
+    const __m128 radius = _mm_set1_ps(s->radius);
+    const __m128 cos_scale = _mm_set1_ps(t->cos_scale);
+    const __m128 sin_scale = _mm_set1_ps(t->sin_scale);
+
+    x0 &= ~3;
+    for ( i32 j = y0; j < y1; ++j ) {
+        f32 fy = t->origin_y + j;
+        __m128 fx = _mm_add_ps(_mm_set1_ps(t->origin_x + x0), _mm_set_ps(3, 2, 1, 0));
+        __m128 row_x = _mm_set1_ps(-fy * t->sin_scale);
+        __m128 row_y = _mm_set1_ps(fy * t->cos_scale);
+        for ( i32 i = x0; i < x1; i += 4 ) {
+            __m128 px = _mm_add_ps(row_x, _mm_mul_ps(fx, cos_scale));
+            __m128 py = _mm_add_ps(row_y, _mm_mul_ps(fx, sin_scale));
+
+            __m128 dx = _mm_sub_ps(px, ax);
+            __m128 dy = _mm_sub_ps(py, ay);
+            __m128 tt = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(dx, abx), _mm_mul_ps(dy, aby)), inv_len2);
+            tt = _mm_min_ps(_mm_max_ps(tt, zero), one);
+
+            __m128 ex = _mm_sub_ps(dx, _mm_mul_ps(tt, abx));
+            __m128 ey = _mm_sub_ps(dy, _mm_mul_ps(tt, aby));
+            __m128 dist = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(ex, ex), _mm_mul_ps(ey, ey)));
+
+            __m128 pressure = _mm_add_ps(pressure_a, _mm_mul_ps(tt, pressure_ab));
+            __m128 rad = _mm_mul_ps(radius, pressure);
+
+            f32* ratio_ptr = b->info_ratio + j*RENDER_BLOCK_SIZE + i;
+            f32* pressure_ptr = b->info_pressure + j*RENDER_BLOCK_SIZE + i;
+
+            // NaN ratios (0/0) leave the stored ratio untouched.
+            __m128 ratio = _mm_min_ps(_mm_div_ps(dist, rad), _mm_loadu_ps(ratio_ptr));
+            __m128 covered = _mm_and_ps(_mm_cmplt_ps(dist, rad), pressure);
+
+            _mm_storeu_ps(ratio_ptr, ratio);
+            _mm_storeu_ps(pressure_ptr, _mm_max_ps(covered, _mm_loadu_ps(pressure_ptr)));
+
+            fx = _mm_add_ps(fx, four);
+        }
+    }
+}
+
+static inline __m128
+blend_over(__m128 src, __m128 dst)
+{
+    __m128 src_alpha = _mm_shuffle_ps(src, src, _MM_SHUFFLE(3,3,3,3));
+    return _mm_add_ps(src, _mm_mul_ps(dst, _mm_sub_ps(_mm_set1_ps(1.0f), src_alpha)));
+}
+
+// Fills the pixels covered by the stroke into the layer buffer, then clears
+// the coverage buffers for the next stroke.
+static void
+fill_stroke(BlockgroupRenderBackend* b, Stroke* stroke, i32 x0, i32 y0, i32 x1, i32 y1)
+{
+    Brush* brush = &stroke->brush;
+    b32 eraser = stroke->flags & StrokeFlag_ERASER;
+    b32 pressure_to_opacity = stroke->flags & StrokeFlag_PRESSURE_TO_OPACITY;
+    b32 distance_to_opacity = stroke->flags & StrokeFlag_DISTANCE_TO_OPACITY;
+    f32 inv_hardness = 1.0f / brush->hardness;
+    __m128 color = _mm_loadu_ps(brush->color.d);
+
+    for ( i32 j = y0; j < y1; ++j ) {
+        for ( i32 i = x0; i < x1; ++i ) {
+            i32 idx = j*RENDER_BLOCK_SIZE + i;
+            f32 ratio = b->info_ratio[idx];
+            if ( ratio < 1.0f ) {
+                __m128 src;
+                if ( eraser ) {
+                    src = _mm_loadu_ps(b->eraser_pixels[idx].d);
+                }
+                else {
+                    f32 opacity = 1.0f;
+                    if ( pressure_to_opacity ) {
+                        opacity *= (1.0f - brush->pressure_opacity_min) * b->info_pressure[idx] + brush->pressure_opacity_min;
+                    }
+                    if ( distance_to_opacity ) {
+                        opacity *= powf(1.0f - ratio, inv_hardness);
+                    }
+                    src = _mm_mul_ps(color, _mm_set1_ps(opacity));
+                }
+                _mm_storeu_ps(b->layer_pixels[idx].d, blend_over(src, _mm_loadu_ps(b->layer_pixels[idx].d)));
+            }
+            b->info_ratio[idx] = 1.0f;
+            b->info_pressure[idx] = 0.0f;
+        }
+    }
+}
+
+// Returns true if the stroke touched the block.
+static b32
+rasterize_stroke(BlockgroupRenderBackend* b, BlockTransform* t, v2l pan_center,
+                 f32 block_left, f32 block_top, f32 block_right, f32 block_bottom,
+                 Stroke* stroke)
+{
+    i32 touched_x0 = RENDER_BLOCK_SIZE, touched_y0 = RENDER_BLOCK_SIZE;
+    i32 touched_x1 = 0, touched_y1 = 0;
+
+    PROFILE_RASTER_BEGIN(sse2);
+    // Single points are drawn as a segment of length zero, like gpu_cook_stroke does.
+    i64 num_segments = max(stroke->num_points - 1, 1);
+    for ( i64 seg_i = 0; seg_i < num_segments; ++seg_i ) {
+        i64 j = min(seg_i + 1, stroke->num_points - 1);
+        v2l pa = stroke->points[seg_i] - pan_center;
+        v2l pb = stroke->points[j] - pan_center;
+
+        RasterSegment s = {};
+        s.ax = (f32)pa.x;
+        s.ay = (f32)pa.y;
+        s.abx = (f32)(pb.x - pa.x);
+        s.aby = (f32)(pb.y - pa.y);
+        f32 len2 = s.abx*s.abx + s.aby*s.aby;
+        s.inv_len2 = len2 > 0 ? 1.0f / len2 : 0.0f;
+        s.pressure_a = stroke->pressures[seg_i];
+        s.pressure_ab = stroke->pressures[j] - stroke->pressures[seg_i];
+        s.radius = (f32)stroke->brush.radius;
+
+        f32 rad = s.radius * max(stroke->pressures[seg_i], stroke->pressures[j]);
+        f32 left = min(s.ax, s.ax + s.abx) - rad;
+        f32 right = max(s.ax, s.ax + s.abx) + rad;
+        f32 top = min(s.ay, s.ay + s.aby) - rad;
+        f32 bottom = max(s.ay, s.ay + s.aby) + rad;
+        if (    left > block_right || right < block_left
+             || top > block_bottom || bottom < block_top ) {
+            continue;
+        }
+
+        i32 x0, y0, x1, y1;
+        segment_to_block_pixels(t, left, top, right, bottom, &x0, &y0, &x1, &y1);
+        if ( x0 < x1 && y0 < y1 ) {
+            segment_coverage_sse2(b, t, &s, x0, y0, x1, y1);
+            touched_x0 = min(touched_x0, x0 & ~3);
+            touched_y0 = min(touched_y0, y0);
+            touched_x1 = max(touched_x1, (x1 + 3) & ~3);
+            touched_y1 = max(touched_y1, y1);
+        }
+    }
+    PROFILE_RASTER_PUSH(sse2);
+
+    b32 touched = touched_x0 < touched_x1 && touched_y0 < touched_y1;
+    if ( touched ) {
+        PROFILE_RASTER_BEGIN(sampling);
+        fill_stroke(b, stroke, touched_x0, touched_y0, touched_x1, touched_y1);
+        PROFILE_RASTER_PUSH(sampling);
+    }
+    return touched;
+}
+
+static u32
+pixel_to_u32(v4f c)
+{
+    u32 result = 0;
+    for ( int i = 0; i < 4; ++i ) {
+        result |= (u32)(clamp(c.d[i], 0.0f, 1.0f) * 255.0f + 0.5f) << (8*i);
+    }
+    return result;
+}
+
+static void
+render_block(BlockgroupRenderBackend* b)
+{
+    PROFILE_RASTER_BEGIN(work);
+    RenderStack* stack = b->stack;
+    CanvasView* view = stack->view;
+    Rect block = stack->blocks[b->block_start];
+
+    v4f clear_color = {};
+    if ( stack->background_alpha != 0.0f ) {
+        clear_color = { view->background_color.r, view->background_color.g,
+                        view->background_color.b, stack->background_alpha };
+    }
+    for ( i32 i = 0; i < RENDER_BLOCK_PIXELS; ++i ) {
+        b->canvas_pixels[i] = clear_color;
+        b->eraser_pixels[i] = clear_color;
+    }
+
+    BlockTransform t = {};
+    {
+        f32 scale = (f32)view->scale;
+        t.cos_angle = cosf(view->angle);
+        t.sin_angle = sinf(view->angle);
+        t.cos_scale = t.cos_angle * scale;
+        t.sin_scale = t.sin_angle * scale;
+        t.inv_scale = 1.0f / scale;
+        t.origin_x = (f32)(block.left - view->zoom_center.x) + 0.5f;
+        t.origin_y = (f32)(block.top - view->zoom_center.y) + 0.5f;
+    }
+
+    // Canvas-space bounds of the block, one pixel larger on each side.
+    Rect canvas_bounds = raster_to_canvas_bounding_rect(view, (i32)block.left - 1, (i32)block.top - 1,
+                                                        (i32)(block.right - block.left) + 2,
+                                                        (i32)(block.bottom - block.top) + 2,
+                                                        view->scale);
+    f32 block_left = (f32)(canvas_bounds.left - view->pan_center.x);
+    f32 block_right = (f32)(canvas_bounds.right - view->pan_center.x);
+    f32 block_top = (f32)(canvas_bounds.top - view->pan_center.y);
+    f32 block_bottom = (f32)(canvas_bounds.bottom - view->pan_center.y);
+
+    for ( Layer* l = stack->root_layer; l != NULL; l = l->next ) {
+        if ( !(l->flags & LayerFlags_VISIBLE) ) {
+            continue;
+        }
+        PROFILE_RASTER_BEGIN(preamble);
+        stroke_index_query(&l->stroke_index, canvas_bounds, &b->query);
+        PROFILE_RASTER_PUSH(preamble);
+
+        b32 layer_touched = false;
+        for ( i64 i = 0; i < b->query.count; ++i ) {
+            Stroke* s = b->query.data[i]->stroke;
+            Rect bounds = s->bounding_rect;
+            // Strokes smaller than a pixel are not drawn. Same as gpu_clip_strokes_and_update.
+            if ( bounds.right != bounds.left && bounds.bottom != bounds.top && s->num_points > 0 ) {
+                layer_touched |= rasterize_stroke(b, &t, view->pan_center,
+                                                  block_left, block_top, block_right, block_bottom, s);
+            }
+        }
+
+        if ( layer_touched ) {
+            // Blend the layer onto the canvas with its alpha. The result is
+            // what the erasers of the next layer reveal.
+            __m128 alpha = _mm_set1_ps(l->alpha);
+            for ( i32 i = 0; i < RENDER_BLOCK_PIXELS; ++i ) {
+                __m128 src = _mm_mul_ps(_mm_loadu_ps(b->layer_pixels[i].d), alpha);
+                __m128 dst = blend_over(src, _mm_loadu_ps(b->canvas_pixels[i].d));
+                _mm_storeu_ps(b->canvas_pixels[i].d, dst);
+                _mm_storeu_ps(b->eraser_pixels[i].d, dst);
+                b->layer_pixels[i] = {};
+            }
+        }
+    }
+
+    PROFILE_RASTER_BEGIN(gather);
+    i32 buffer_width = view->screen_size.x;
+    for ( i64 j = block.top; j < block.bottom; ++j ) {
+        u32* dst = stack->canvas_buffer + j*buffer_width;
+        v4f* src = b->canvas_pixels + (j - block.top)*RENDER_BLOCK_SIZE;
+        for ( i64 i = block.left; i < block.right; ++i ) {
+            dst[i] = pixel_to_u32(src[i - block.left]);
+        }
+    }
+    PROFILE_RASTER_PUSH(gather);
+    PROFILE_RASTER_PUSH(work);
+}
+
+// Job system callback.
+static void
+render_blocks(void* data, i64 begin, i64 end, i32 worker)
+{
+    TRACE_FUNCTION();
+    PROFILE_RASTER_BEGIN(total_work_loop);
+    RenderStack* stack = (RenderStack*)data;
+    mlt_assert(worker < stack->num_backends);
+    BlockgroupRenderBackend* b = stack->backends + worker;
+    for ( i64 i = begin; i < end; ++i ) {
+        b->block_start = (i32)i;
+        render_block(b);
+    }
+    PROFILE_RASTER_PUSH(total_work_loop);
+}
+
+void
+cpu_render_stack_init(RenderStack* stack, b32 multithreaded)
+{
+    *stack = {};
+
+    stack->multithreaded = multithreaded;
+    stack->num_backends = multithreaded ? jobs_num_threads() : 1;
+    stack->backends = (BlockgroupRenderBackend*)mlt_calloc((size_t)stack->num_backends, sizeof(BlockgroupRenderBackend), "Render");
+    for ( i32 i = 0; i < stack->num_backends; ++i ) {
+        BlockgroupRenderBackend* b = stack->backends + i;
+        b->stack = stack;
+        b->layer_pixels = (v4f*)mlt_calloc(RENDER_BLOCK_PIXELS, sizeof(v4f), "Render");
+        b->canvas_pixels = (v4f*)mlt_calloc(RENDER_BLOCK_PIXELS, sizeof(v4f), "Render");
+        b->eraser_pixels = (v4f*)mlt_calloc(RENDER_BLOCK_PIXELS, sizeof(v4f), "Render");
+        b->info_ratio = (f32*)mlt_calloc(RENDER_BLOCK_PIXELS, sizeof(f32), "Render");
+        b->info_pressure = (f32*)mlt_calloc(RENDER_BLOCK_PIXELS, sizeof(f32), "Render");
+        for ( i32 p = 0; p < RENDER_BLOCK_PIXELS; ++p ) {
+            b->info_ratio[p] = 1.0f;
+        }
+    }
+}
+
+void
+cpu_render_stack_release(RenderStack* stack)
+{
+    for ( i32 i = 0; i < stack->num_backends; ++i ) {
+        BlockgroupRenderBackend* b = stack->backends + i;
+        mlt_free(b->layer_pixels, "Render");
+        mlt_free(b->canvas_pixels, "Render");
+        mlt_free(b->eraser_pixels, "Render");
+        mlt_free(b->info_ratio, "Render");
+        mlt_free(b->info_pressure, "Render");
+        release(&b->query);
+    }
+    mlt_free(stack->backends, "Render");
+    if ( stack->blocks ) {
+        mlt_free(stack->blocks, "Render");
+    }
+    *stack = {};
+}
+
+void
+cpu_render_canvas(RenderStack* stack, CanvasView* view, Layer* root_layer,
+                  u32* pixels, f32 background_alpha)
+{
+    TRACE_FUNCTION();
+    PROFILE_RASTER_BEGIN(render_canvas);
+
+    i32 width = view->screen_size.x;
+    i32 height = view->screen_size.y;
+    i32 blocks_x = (width + RENDER_BLOCK_SIZE - 1) / RENDER_BLOCK_SIZE;
+    i32 blocks_y = (height + RENDER_BLOCK_SIZE - 1) / RENDER_BLOCK_SIZE;
+    i32 num_blocks = blocks_x * blocks_y;
+
+    if ( num_blocks > stack->blocks_capacity ) {
+        if ( stack->blocks ) {
+            mlt_free(stack->blocks, "Render");
+        }
+        stack->blocks = (Rect*)mlt_calloc((size_t)num_blocks, sizeof(Rect), "Render");
+        stack->blocks_capacity = num_blocks;
+    }
+    for ( i32 j = 0; j < blocks_y; ++j ) {
+        for ( i32 i = 0; i < blocks_x; ++i ) {
+            Rect* block = stack->blocks + j*blocks_x + i;
+            block->left = i*RENDER_BLOCK_SIZE;
+            block->top = j*RENDER_BLOCK_SIZE;
+            block->right = min(width, (i + 1)*RENDER_BLOCK_SIZE);
+            block->bottom = min(height, (j + 1)*RENDER_BLOCK_SIZE);
+        }
+    }
+
+    stack->num_blocks = num_blocks;
+    stack->canvas_buffer = pixels;
+    stack->view = view;
+    stack->root_layer = root_layer;
+    stack->background_alpha = background_alpha;
+
+    if ( stack->multithreaded ) {
+        parallel_for(num_blocks, 1, render_blocks, stack);
+    }
+    else {
+        render_blocks(stack, 0, num_blocks, 0);
+    }
+
+    PROFILE_RASTER_PUSH(render_canvas);
+}
@@ -0,0 +1,29 @@
+// Copyright (c) 2015 Sergio Gonzalez. All rights reserved.
+// License: https://github.com/serge-rgb/milton#license
+
+// CPU rasterizer
+//
+// - Renders a canvas without a GPU. The screen is split into
+//   RENDER_BLOCK_SIZE blocks, which are rendered on the job system.
+// - Each block gets its strokes from the layer stroke indices, and composites
+//   them exactly like gpu_render_canvas: distance-to-segment coverage, the
+//   pressure and distance to opacity fills, the eraser and layer alpha.
+// - Layer effects are not applied.
+
+
+#pragma once
+
+#include "render_common.h"
+
+// Allocates the block buffers for every thread of the job system, so it
+// must come after jobs_init. Blocks are rendered on the calling thread alone
+// unless `multithreaded` is set.
+void cpu_render_stack_init(RenderStack* stack, b32 multithreaded);
+
+void cpu_render_stack_release(RenderStack* stack);
+
+// Renders the visible layers as seen by `view` into `pixels`, which has
+// view->screen_size pixels in the same format gpu_render_to_buffer writes:
+// RGBA bytes, top row first.
+void cpu_render_canvas(RenderStack* stack, CanvasView* view, Layer* root_layer,
+                       u32* pixels, f32 background_alpha);
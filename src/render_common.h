@@ -5,32 +5,51 @@
 #pragma once
 
 #include "common.h"
+#include "StrokeIndex.h"
 
-#define RENDER_STACK_SIZE       (1 << 20)
+#define RENDER_BLOCK_SIZE       64  // Width and height in pixels of the blocks rendered by the CPU rasterizer.
+
+struct CanvasView;
+struct Layer;
+struct RenderStack;
 
 // Render Workers:
-//    We have a bunch of workers running on threads, who wait on a lockless
-//    queue to take BlockgroupRenderBackend structures.
-//    When there is work available, they call blockgroup_render_thread with the
-//    appropriate parameters.
+//    Blocks are rendered with a parallel_for. Each thread of the job system
+//    has its own BlockgroupRenderBackend.
+//
+// The block buffers mirror the textures used by the GL renderer.
 struct BlockgroupRenderBackend
 {
-    i32     block_start;
+    i32     block_start;  // Index into RenderStack::blocks of the block being rendered.
+
+    v4f*    layer_pixels;   // Premultiplied, like every buffer here.
+    v4f*    canvas_pixels;
+    v4f*    eraser_pixels;  // Canvas as it was before the current layer. See stroke_eraser.f.glsl
+
+    // Per-stroke values. See stroke_info.f.glsl
+    f32*    info_ratio;     // Smallest distance / radius.
+    f32*    info_pressure;  // Largest pressure of the segments covering the pixel.
+
+    DArray<StrokeIndexEntry*> query;
+
+    RenderStack* stack;
 };
 
 struct RenderStack
 {
     Rect*   blocks;  // Screen areas to render.
     i32     num_blocks;
+    i32     blocks_capacity;
     u32*    canvas_buffer;
 
-    // LIFO work queue
-    SDL_mutex*              mutex;
-    BlockgroupRenderBackend    blockgroup_render_data[RENDER_STACK_SIZE];
-    i32                     index;
+    // Render parameters, read-only while the workers run.
+    CanvasView* view;
+    Layer*      root_layer;
+    f32         background_alpha;
 
-    SDL_sem*   work_available;
-    SDL_sem*   completed_semaphore;
+    BlockgroupRenderBackend*    backends;  // Indexed by job system thread. See jobs_num_threads()
+    i32                         num_backends;
+    b32                         multithreaded;
 };
 
 
@@ -41,9 +60,7 @@ enum MiltonRenderFlags
     MiltonRenderFlags_UI_UPDATED       = 1 << 0,
     MiltonRenderFlags_FULL_REDRAW      = 1 << 1,
     MiltonRenderFlags_FINISHED_STROKE  = 1 << 2,
-    MiltonRenderFlags_PAN_COPY         = 1 << 3,
     MiltonRenderFlags_BRUSH_PREVIEW    = 1 << 4,
     MiltonRenderFlags_BRUSH_HOVER      = 1 << 5,
-    MiltonRenderFlags_DRAW_ITERATIVELY = 1 << 6,
     MiltonRenderFlags_BRUSH_CHANGE     = 1 << 7,
 };
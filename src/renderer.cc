@@ -6,6 +6,7 @@
 #include "color.h"
 #include "gl_helpers.h"
 #include "gui.h"
+#include "jobs.h"
 #include "milton.h"
 #include "vector.h"
 
@@ -33,19 +34,130 @@ enum RenderElementFlags
     RenderElementFlags_PRESSURE_TO_OPACITY  = 1<<1,
     RenderElementFlags_DISTANCE_TO_OPACITY  = 1<<2,
     RenderElementFlags_ERASER               = 1<<3,
+
+    // Markers around the strokes of a layer that has a LayerCache. See
+    // gpu_clip_strokes_and_update.
+    RenderElementFlags_LAYER_CACHE_BEGIN    = 1<<4,
+    RenderElementFlags_LAYER_CACHE_END      = 1<<5,
+    RenderElementFlags_LAYER_CACHE_STRIP    = 1<<6,  // Part of the screen that a shifted cache doesn't cover.
 };
 
-struct RenderElement
+// Each visible layer is rendered to its own texture, which is kept while
+// the view and the strokes below the layer's erasers don't change. Layers
+// that are cached don't have their strokes clipped or drawn. The working
+// stroke is drawn over a copy of its layer's cache.
+//
+// When the view is panned by whole pixels, the texture is shifted and only
+// the strips of the screen that it doesn't cover are drawn.
+//
+// Caches of layers that are not in view are kept until the budget runs out,
+// and then deleted least recently used first.
+#define LAYER_CACHE_BUDGET_BYTES ((i64)256 << 20)
+
+// Full redraws with ClipFlags_DRAW_ITERATIVELY draw a budget of stroke
+// segments per frame into the layer caches, and continue in the next frames.
+// The budget is fit to ITERATIVE_FRAME_BUDGET_MS with the measured time of
+// the frames that draw many segments.
+#define ITERATIVE_FRAME_BUDGET_MS   8.0f
+#define ITERATIVE_MIN_SEGMENTS      (1<<12)
+#define ITERATIVE_MAX_SEGMENTS      (1<<22)
+
+struct LayerCache
 {
-    GLuint  vbo_stroke;
-    GLuint  vbo_pointa;
-    GLuint  vbo_pointb;
-    GLuint  indices;
+    i32    layer_id;
+    GLuint texture;  // Zero for a free slot.
+    i32    width;
+    i32    height;
+    u64    last_used;  // RenderBackend::clip_serial
+
+    // The texture holds the layer's strokes for this key when valid.
+    b32    valid;
+    u64    version;  // Layer::version
+    v2l    pan_center;
+    v2i    zoom_center;
+    i64    scale;
+    f32    angle;
+    b32    has_eraser;  // Erasers copy from the layers below.
+    u64    below_key;
+
+    // While not valid: strokes in view that an iterative redraw already
+    // drew, in the order of clip_layer_strokes.
+    i64    next_stroke;
+};
+
+// Cooked strokes are suballocated from a few large buffers, so that strokes
+// in the same pool can be drawn together. Allocations are in segments.
+// Strokes have at most STROKE_MAX_POINTS-1 segments.
+#define STROKE_POOL_SEGMENTS (1<<16)
+
+// One record per segment. stroke_raster.v.glsl expands it to a box.
+//
+// With instanced arrays the record is read once per instance. Without them,
+// it is stored once per corner and drawn with 6 indices per segment.
+//
+// Per-stroke values are here too, so that they don't need uniform updates
+// between the draws of a batch.
+struct StrokeSegment
+{
+    v2f a;  // Relative to the render center.
+    v2f b;
+    u16 pressure[2];  // Normalized. At a and at b.
+    u16 color[4];     // Normalized, premultiplied.
+    f32 radius;
+    f32 depth;  // See MAX_DEPTH_VALUE
 #if STROKE_DEBUG_VIZ
-    GLuint vbo_debug;
+    v3f debug_color;
 #endif
+};
+
+// Attribute locations shared by all the stroke programs.
+enum StrokeAttrib
+{
+    StrokeAttrib_CORNER,
+    StrokeAttrib_POINTA,
+    StrokeAttrib_POINTB,
+    StrokeAttrib_PRESSURE,
+    StrokeAttrib_COLOR,
+    StrokeAttrib_RADIUS,
+    StrokeAttrib_DEPTH,
+    StrokeAttrib_DEBUG_COLOR,
+};
+
+struct StrokeRange
+{
+    i64 start;
+    i64 count;
+};
+
+struct StrokePool
+{
+    GLuint vbo;  // StrokeSegment records.
+    GLuint ibo;  // 32-bit indices into vbo, without instanced arrays.
 
-    i64     count;
+    i64 capacity;  // In segments.
+    i64 used;
+
+    DArray<StrokeRange> free_ranges;  // Sorted by start. Adjacent ranges are merged.
+};
+
+struct RenderElement
+{
+    // Segments reserved in stroke_pools[pool_i]. Zero when the stroke has no GPU data.
+    i32     pool_i;
+    i64     first_segment;
+    i64     capacity;
+
+    i64     count;  // Number of segments.
+
+    // Working stroke: segments before num_cooked_points-1 are on the GPU and
+    // don't change when points are appended.
+    i64     num_cooked_points;
+
+    Rect    bounding_rect;  // Canvas-space bounds of the stroke.
+
+    // Eviction. See evict_strokes
+    u64     last_clip;   // RenderBackend::clip_serial of the last clip that used it.
+    b32     referenced;  // Used since the clock hand last passed.
 
     union {
         struct {  // For when element is a stroke.
@@ -53,18 +165,82 @@ struct RenderElement
             i32     radius;
             f32     min_opacity;
             f32     hardness;
+            i32     depth;
         };
         struct {  // For when element is layer.
             f32          layer_alpha;
             LayerEffect* effects;
         };
+        struct {  // For layer cache markers.
+            i32          cache_i;
+            b32          cache_valid;     // The strokes of the layer were skipped.
+            b32          cache_complete;  // All strokes in view were clipped.
+            b32          cache_shifted;   // Only the strokes in the strips were clipped.
+            v2i          cache_shift;     // In pixels.
+            b32          cache_resumed;   // Continues the iterative redraw of the last frame.
+        };
+        struct {  // For layer cache strips.
+            Rect         strip;  // In pixels.
+        };
     };
 
     int     flags;  // RenderElementFlags enum;
 };
 
+// Cooking a stroke:
+//   prepare_cook reserves its segments and fills in its RenderElement, on
+//   the GL thread and in clipping order. Its geometry is then built into the
+//   staging arrays on the job system, and uploaded from the main queue.
+struct CookJob
+{
+    Stroke*         stroke;
+    RenderElement*  re;
+    i64             first_new;  // First segment to build.
+    i64             num_new;
+    i64             staging;    // Segment index in the staging arrays.
+    i64             upload;     // Index into RenderBackend::cook_uploads.
+};
+
+// Jobs next to each other in a pool. They are uploaded together, as soon as
+// the last one is built.
+struct CookUpload
+{
+    RenderBackend*  r;
+    i32             pool_i;
+    i64             first_segment;
+    i64             num_segments;
+    i64             staging;
+    SDL_atomic_t    pending;  // Jobs still being built.
+};
+
+// Batches are built on the job system from this many segments.
+#define COOK_PARALLEL_SEGMENTS  1024
+// Staged segments are uploaded from this many, so that an iterative redraw
+// notices the time it takes.
+#define COOK_BATCH_SEGMENTS     (1<<15)
+// Points converted at a time by cook_points.
+#define COOK_CHUNK_POINTS       256
+
+// Layers with at least this many strokes are clipped with a parallel scan of
+// their buckets when at least this fraction of the layer is in view.
+// Otherwise the stroke index is faster. See clip_layer_strokes
+#define CLIP_SCAN_MIN_STROKES   (1<<14)
+#define CLIP_SCAN_MIN_FRACTION  0.25
+
+// A clip_layer_strokes scan.
+struct ClipScan
+{
+    StrokeList*     strokes;
+    Rect            bounds;
+    Stroke**        visible;  // Bucket b writes from b*STROKELIST_BUCKET_COUNT.
+    i64*            offsets;  // Visible strokes in each bucket, then where they go in `out`.
+    Stroke**        out;
+};
+
 struct RenderBackend
 {
+    b32 initialized;  // By gpu_init. Headless Miltons never have GL state to update.
+
     f32 viewport_limits[2];  // OpenGL limits to the framebuffer size.
 
     v2i render_center;
@@ -125,6 +301,51 @@ struct RenderBackend
 
     DArray<RenderElement> clip_array;
 
+    DArray<StrokePool> stroke_pools;
+    b32 instanced_strokes;  // See StrokeSegment.
+
+    // Corner of each vertex in a pool. Only the first four are used with instanced arrays.
+    GLuint vbo_stroke_corners;
+
+    // Strokes waiting for their geometry. See flush_cook_jobs
+    DArray<CookJob>         cook_jobs;
+    DArray<StrokeSegment>   cook_segments;  // Staging, in pool layout.
+    DArray<u32>             cook_indices;   // Staging, when not instanced.
+    DArray<CookUpload>      cook_uploads;
+
+    // Stroke elements that currently own pool segments.
+    DArray<RenderElement*> resident_elements;
+    i64 resident_bytes;
+    i64 stroke_budget;  // In bytes. Strokes are evicted past it. See gpu_set_stroke_budget
+    i64 evict_hand;     // Clock hand in resident_elements.
+
+    // Since gpu_init. A hit is a clipped stroke that was on the GPU.
+    i64 stroke_hits;
+    i64 stroke_misses;
+    i64 stroke_evictions;
+
+    // Scratch for glMultiDrawElements.
+    DArray<GLsizei> batch_counts;
+    DArray<void*>   batch_offsets;
+
+    DArray<LayerCache> layer_caches;
+    u64 clip_serial;
+
+    // See ClipFlags_DRAW_ITERATIVELY
+    i64 iterative_segments;  // Budget per frame.
+    i64 iterative_drawn;     // Segments clipped by the last clip, if iterative.
+    u64 iterative_start;     // perf_counter() at the start of the last clip.
+    b32 render_in_progress;  // The last clip left strokes for the next frames.
+    b32 working_stroke_clipped;
+
+    // Scratch for stroke index queries during clipping.
+    DArray<StrokeIndexEntry*> clip_query;
+    // Visible strokes of the layer being clipped, in the order they were drawn.
+    DArray<Stroke*> clip_strokes;
+    // Scratch for parallel scans. See ClipScan
+    DArray<Stroke*> clip_scan_visible;
+    DArray<i64>     clip_scan_offsets;
+
     // Screen size.
     i32 width;
     i32 height;
@@ -226,6 +447,22 @@ get_render_element(RenderHandle handle)
     return e;
 }
 
+// Must be called before linking a program that uses stroke_raster.v.glsl
+static void
+bind_stroke_attrib_locations(GLuint program)
+{
+    glBindAttribLocation(program, StrokeAttrib_CORNER, "a_corner");
+    glBindAttribLocation(program, StrokeAttrib_POINTA, "a_pointa");
+    glBindAttribLocation(program, StrokeAttrib_POINTB, "a_pointb");
+    glBindAttribLocation(program, StrokeAttrib_PRESSURE, "a_pressure");
+    glBindAttribLocation(program, StrokeAttrib_COLOR, "a_color");
+    glBindAttribLocation(program, StrokeAttrib_RADIUS, "a_radius");
+    glBindAttribLocation(program, StrokeAttrib_DEPTH, "a_depth");
+#if STROKE_DEBUG_VIZ
+    glBindAttribLocation(program, StrokeAttrib_DEBUG_COLOR, "a_debug_color");
+#endif
+}
+
 RenderBackend*
 gpu_allocate_render_backend(Arena* arena)
 {
@@ -237,6 +474,9 @@ gpu_allocate_render_backend(Arena* arena)
 void
 gpu_update_picker(RenderBackend* r, ColorPicker* picker)
 {
+    if ( !r->initialized ) {
+        return;
+    }
     gl::use_program(r->picker_program);
     // Transform to [-1,1]
     v2f a = picker->data.a;
@@ -325,6 +565,9 @@ void
 gpu_update_brush_outline(RenderBackend* r, i32 cx, i32 cy, i32 radius,
                          BrushOutlineEnum outline_enum, v4f color)
 {
+    if ( !r->initialized ) {
+        return;
+    }
     if ( r->vbo_outline == 0 ) {
         mlt_assert(r->vbo_outline_sizes == 0);
         glGenBuffers(1, &r->vbo_outline);
@@ -391,7 +634,10 @@ gpu_init(RenderBackend* r, CanvasView* view, ColorPicker* picker)
         if (glDebugMessageCallback) {  glDebugMessageCallback(milton_gl_debug_callback, NULL); }
     #endif
 
+    r->initialized = true;
     r->stroke_z = MAX_DEPTH_VALUE - 20;
+    r->iterative_segments = 1<<16;  // Fit after the first frames.
+    r->stroke_budget = (i64)DEFAULT_STROKE_MEMORY_MB << 20;
 
     {
         GLfloat viewport_dims[2] = {};
@@ -502,6 +748,7 @@ gpu_init(RenderBackend* r, CanvasView* view, ColorPicker* picker)
 
         r->stroke_program = glCreateProgram();
 
+        bind_stroke_attrib_locations(r->stroke_program);
         gl::link_program(r->stroke_program, objs, array_count(objs));
     }
     // Stroke eraser
@@ -511,6 +758,7 @@ gpu_init(RenderBackend* r, CanvasView* view, ColorPicker* picker)
         objs[1] = gl::compile_shader(g_stroke_eraser_f, GL_FRAGMENT_SHADER);
 
         r->stroke_eraser_program = glCreateProgram();
+        bind_stroke_attrib_locations(r->stroke_eraser_program);
         gl::link_program(r->stroke_eraser_program, objs, array_count(objs));
 
         gl::set_uniform_i(r->stroke_eraser_program, "u_canvas", 0);
@@ -522,6 +770,7 @@ gpu_init(RenderBackend* r, CanvasView* view, ColorPicker* picker)
         objs[1] = gl::compile_shader(g_stroke_info_f, GL_FRAGMENT_SHADER);
 
         r->stroke_info_program = glCreateProgram();
+        bind_stroke_attrib_locations(r->stroke_info_program);
         gl::link_program(r->stroke_info_program, objs, array_count(objs));
 
     }
@@ -534,6 +783,10 @@ gpu_init(RenderBackend* r, CanvasView* view, ColorPicker* picker)
         r->stroke_fill_program_pressure = glCreateProgram();
         r->stroke_fill_program_pressure_distance = glCreateProgram();
 
+        bind_stroke_attrib_locations(r->stroke_fill_program_distance);
+        bind_stroke_attrib_locations(r->stroke_fill_program_pressure);
+        bind_stroke_attrib_locations(r->stroke_fill_program_pressure_distance);
+
         objs[1] = gl::compile_shader(g_stroke_fill_f, GL_FRAGMENT_SHADER);
         gl::link_program(r->stroke_fill_program_pressure, objs, array_count(objs));
 
@@ -559,6 +812,7 @@ gpu_init(RenderBackend* r, CanvasView* view, ColorPicker* picker)
         objs[1] = gl::compile_shader(g_stroke_clear_f, GL_FRAGMENT_SHADER);
 
         r->stroke_clear_program = glCreateProgram();
+        bind_stroke_attrib_locations(r->stroke_clear_program);
         gl::link_program(r->stroke_clear_program, objs, array_count(objs));
     }
     {  // Color picker program
@@ -664,6 +918,23 @@ gpu_init(RenderBackend* r, CanvasView* view, ColorPicker* picker)
         print_framebuffer_status();
         glBindFramebufferEXT(GL_FRAMEBUFFER, 0);
     }
+    // Stroke corners. In triangle strip order.
+    {
+        r->instanced_strokes = gl::check_flags(GLHelperFlags_INSTANCED_ARRAYS);
+
+        i64 num_corners = r->instanced_strokes ? 4 : 4*STROKE_POOL_SEGMENTS;
+        i8* corners = (i8*)mlt_calloc((size_t)num_corners, 2*sizeof(i8), "Render");
+        for ( i64 i = 0; i < num_corners; ++i ) {
+            corners[2*i + 0] = (i % 2) ? 1 : -1;
+            corners[2*i + 1] = (i % 4 >= 2) ? 1 : -1;
+        }
+        glGenBuffers(1, &r->vbo_stroke_corners);
+        glBindBuffer(GL_ARRAY_BUFFER, r->vbo_stroke_corners);
+        DEBUG_gl_mark_buffer(r->vbo_stroke_corners);
+        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(num_corners*2*sizeof(i8)), corners, GL_STATIC_DRAW);
+        mlt_free(corners, "Render");
+    }
+
     // VBO for picker
     glGenBuffers(1, &r->vbo_picker);
     glGenBuffers(1, &r->vbo_picker_norm);
@@ -696,6 +967,9 @@ void
 gpu_update_scale(RenderBackend* r, i32 scale)
 {
     r->scale = scale;
+    if ( !r->initialized ) {
+        return;
+    }
     GLuint ps[] = {
         r->stroke_program,
         r->stroke_eraser_program,
@@ -812,20 +1086,18 @@ gpu_get_num_clipped_strokes(Layer* root_layer)
 {
     i32 count = 0;
     #if MILTON_ENABLE_PROFILING
-    for ( Layer* l = root_layer; l != NULL; l = l->next ) {
-        StrokeList strokes = l->strokes;
-        for ( i64 si = 0; si < strokes.count; ++si ) {
-            Stroke* s = strokes[si];
-            RenderElement* re = get_render_element(s->render_handle);
-            if ( re && re->vbo_stroke != 0 ) {
-                ++count;
-            }
-        }
-    }
+    count = (i32)layer::count_clipped_strokes(root_layer, -1);
     #endif
     return count;
 }
 
+b32
+gpu_stroke_is_cooked(RenderHandle handle)
+{
+    RenderElement* re = get_render_element(handle);
+    return re && re->capacity != 0;
+}
+
 static void
 set_screen_size(RenderBackend* r, float* fscreen)
 {
@@ -869,6 +1141,9 @@ gpu_update_canvas(RenderBackend* r, CanvasState* canvas, CanvasView* view)
         r->render_center = new_render_center;
         gpu_free_strokes(r, canvas);
     }
+    if ( !r->initialized ) {
+        return;
+    }
 
     GLuint ps[] = {
         r->stroke_program,
@@ -900,321 +1175,854 @@ gpu_update_canvas(RenderBackend* r, CanvasState* canvas, CanvasView* view)
     set_screen_size(r, fscreen);
 }
 
+// Records per segment in the vertex buffer of a pool.
+static i64
+stroke_segment_copies(RenderBackend* r)
+{
+    return r->instanced_strokes ? 1 : 4;
+}
+
+// GPU memory taken by a segment.
+static i64
+stroke_segment_bytes(RenderBackend* r)
+{
+    i64 bytes = stroke_segment_copies(r)*(i64)sizeof(StrokeSegment);
+    if ( !r->instanced_strokes ) {
+        bytes += 6*sizeof(u32);
+    }
+    return bytes;
+}
+
 void
-gpu_cook_stroke(Arena* arena, RenderBackend* r, Stroke* stroke, CookStrokeOpt cook_option)
+gpu_get_stroke_memory(RenderBackend* r, GpuStrokeMemory* out)
+{
+    *out = {};
+    out->instanced = r->instanced_strokes;
+    out->bytes_per_segment = stroke_segment_bytes(r);
+    out->bytes_per_segment_quads = 4*(i64)sizeof(StrokeSegment) + 6*(i64)sizeof(u32);
+    for ( i64 i = 0; i < r->stroke_pools.count; ++i ) {
+        StrokePool* pool = &r->stroke_pools[i];
+        out->reserved_bytes += pool->capacity*out->bytes_per_segment;
+        out->num_segments += pool->used;
+    }
+    out->used_bytes = r->resident_bytes;
+    out->budget_bytes = r->stroke_budget;
+    out->num_strokes = r->resident_elements.count;
+    out->hits = r->stroke_hits;
+    out->misses = r->stroke_misses;
+    out->evictions = r->stroke_evictions;
+}
+
+void
+gpu_set_stroke_budget(RenderBackend* r, i64 bytes)
+{
+    r->stroke_budget = bytes;
+}
+
+static StrokePool*
+new_stroke_pool(RenderBackend* r)
+{
+    i64 capacity = STROKE_POOL_SEGMENTS;
+    StrokePool* pool = push(&r->stroke_pools, StrokePool{});
+    pool->capacity = capacity;
+    push(&pool->free_ranges, StrokeRange{ 0, capacity });
+
+    glGenBuffers(1, &pool->vbo);
+    DEBUG_gl_mark_buffer(pool->vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, pool->vbo);
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(stroke_segment_copies(r)*capacity*sizeof(StrokeSegment)), NULL, GL_DYNAMIC_DRAW);
+
+    if ( !r->instanced_strokes ) {
+        glGenBuffers(1, &pool->ibo);
+        DEBUG_gl_mark_buffer(pool->ibo);
+        glBindBuffer(GL_ARRAY_BUFFER, pool->ibo);
+        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(6*capacity*sizeof(u32)), NULL, GL_DYNAMIC_DRAW);
+    }
+
+    milton_log("Created stroke pool with %" PRIi64 " segments.\n", capacity);
+    return pool;
+}
+
+// First fit.
+static b32
+stroke_pool_alloc(StrokePool* pool, i64 count, i64* out_start)
+{
+    b32 found = false;
+    DArray<StrokeRange>* ranges = &pool->free_ranges;
+    for ( i64 i = 0; i < ranges->count; ++i ) {
+        StrokeRange* range = &ranges->data[i];
+        if ( range->count >= count ) {
+            *out_start = range->start;
+            range->start += count;
+            range->count -= count;
+            if ( range->count == 0 ) {
+                memmove(range, range + 1, (size_t)(ranges->count - i - 1)*sizeof(*range));
+                ranges->count -= 1;
+            }
+            pool->used += count;
+            found = true;
+            break;
+        }
+    }
+    return found;
+}
+
+static void
+stroke_pool_free(StrokePool* pool, i64 start, i64 count)
+{
+    DArray<StrokeRange>* ranges = &pool->free_ranges;
+
+    i64 i = 0;
+    while ( i < ranges->count && ranges->data[i].start < start ) {
+        ++i;
+    }
+    b32 merge_prev = i > 0 && ranges->data[i-1].start + ranges->data[i-1].count == start;
+    b32 merge_next = i < ranges->count && start + count == ranges->data[i].start;
+
+    if ( merge_prev && merge_next ) {
+        ranges->data[i-1].count += count + ranges->data[i].count;
+        memmove(&ranges->data[i], &ranges->data[i+1], (size_t)(ranges->count - i - 1)*sizeof(StrokeRange));
+        ranges->count -= 1;
+    }
+    else if ( merge_prev ) {
+        ranges->data[i-1].count += count;
+    }
+    else if ( merge_next ) {
+        ranges->data[i].start = start;
+        ranges->data[i].count += count;
+    }
+    else {
+        push(ranges, StrokeRange{});
+        memmove(&ranges->data[i+1], &ranges->data[i], (size_t)(ranges->count - i - 1)*sizeof(StrokeRange));
+        ranges->data[i] = StrokeRange{ start, count };
+    }
+    pool->used -= count;
+    mlt_assert(pool->used >= 0);
+}
+
+static void
+alloc_stroke_segments(RenderBackend* r, RenderElement* re, i64 count)
+{
+    mlt_assert(re->capacity == 0);
+    mlt_assert(count <= STROKE_POOL_SEGMENTS);
+    i32 pool_i = -1;
+    for ( i64 i = 0; i < r->stroke_pools.count; ++i ) {
+        if ( stroke_pool_alloc(&r->stroke_pools.data[i], count, &re->first_segment) ) {
+            pool_i = (i32)i;
+            break;
+        }
+    }
+    if ( pool_i < 0 ) {
+        pool_i = (i32)r->stroke_pools.count;
+        StrokePool* pool = new_stroke_pool(r);
+        b32 ok = stroke_pool_alloc(pool, count, &re->first_segment);
+        mlt_assert(ok);
+    }
+    re->pool_i = pool_i;
+    re->capacity = count;
+    r->resident_bytes += count*stroke_segment_bytes(r);
+}
+
+static void
+free_stroke_segments(RenderBackend* r, RenderElement* re)
+{
+    if ( re->capacity != 0 ) {
+        stroke_pool_free(&r->stroke_pools[re->pool_i], re->first_segment, re->capacity);
+        r->resident_bytes -= re->capacity*stroke_segment_bytes(r);
+        re->capacity = 0;
+    }
+}
+
+static void
+gpu_free_render_element(RenderBackend* r, RenderElement* re)
+{
+    if ( re && re->capacity != 0 ) {
+        free_stroke_segments(r, re);
+        *re = {};
+    }
+}
+
+// Frees strokes until `bytes` more fit in the budget. The clock hand gives a
+// second chance to strokes that were used since it last passed. Strokes used
+// by the current clip are kept, so a view that needs more than the budget
+// goes over it.
+static void
+evict_strokes(RenderBackend* r, i64 bytes)
+{
+    DArray<RenderElement*>* resident = &r->resident_elements;
+    i64 steps = 2*resident->count;  // The first turn may only clear references.
+    while ( r->resident_bytes + bytes > r->stroke_budget && resident->count > 0 && steps-- > 0 ) {
+        if ( r->evict_hand >= resident->count ) {
+            r->evict_hand = 0;
+        }
+        RenderElement* re = resident->data[r->evict_hand];
+        if ( re->last_clip == r->clip_serial ) {
+            r->evict_hand += 1;
+        }
+        else if ( re->referenced ) {
+            re->referenced = false;
+            r->evict_hand += 1;
+        }
+        else {
+            gpu_free_render_element(r, re);
+            resident->data[r->evict_hand] = resident->data[resident->count - 1];
+            resident->count -= 1;
+            r->stroke_evictions += 1;
+        }
+    }
+}
+
+static int
+render_element_flags(Stroke* stroke)
+{
+    int flags = 0;
+    if (stroke->flags & StrokeFlag_ERASER) {
+        flags |= RenderElementFlags_ERASER;
+    }
+    if (stroke->flags & StrokeFlag_PRESSURE_TO_OPACITY) {
+        flags |= RenderElementFlags_PRESSURE_TO_OPACITY;
+    }
+    if (stroke->flags & StrokeFlag_DISTANCE_TO_OPACITY) {
+        flags |= RenderElementFlags_DISTANCE_TO_OPACITY;
+    }
+    return flags;
+}
+
+// True when the segments of `re` were cooked with the brush of `stroke`.
+static b32
+render_element_has_brush(RenderElement* re, Stroke* stroke)
 {
+    Brush* brush = &stroke->brush;
+    b32 same = re->radius == brush->radius
+               && re->min_opacity == brush->pressure_opacity_min
+               && re->hardness == brush->hardness
+               && re->flags == render_element_flags(stroke);
+    for ( int c = 0; same && c < 4; ++c ) {
+        same = re->color.d[c] == brush->color.d[c];
+    }
+    return same;
+}
 
+// Reserves the segments of a stroke and fills in its RenderElement. Returns
+// true when there is geometry to build, described by `job`.
+static b32
+prepare_cook(Arena* arena, RenderBackend* r, Stroke* stroke, CookStrokeOpt cook_option, CookJob* job)
+{
     RenderElement** p_render_element = reinterpret_cast<RenderElement**>(&stroke->render_handle);
     RenderElement* render_element = *p_render_element;
     if (render_element == NULL) {
         render_element = arena_alloc_elem(arena, RenderElement);
         *p_render_element = render_element;
     }
+    render_element->last_clip = r->clip_serial;
+    render_element->referenced = true;
 
     r->stroke_z = (r->stroke_z + 1) % (MAX_DEPTH_VALUE-1);
     const i32 stroke_z = r->stroke_z + 1;
 
-    if ( cook_option == CookStroke_NEW && render_element->vbo_stroke != 0 ) {
+    b32 build = false;
+    const i64 npoints = stroke->num_points;
+    if ( cook_option == CookStroke_NEW && render_element->capacity != 0 ) {
         // We already have our data cooked
-        mlt_assert(render_element->vbo_pointa != 0);
-        mlt_assert(render_element->vbo_pointb != 0);
-    } else {
-        auto npoints = stroke->num_points;
-        if ( npoints == 1 ) {
-            // Create a 2-point stroke and recurse
-            Stroke duplicate = *stroke;
-            duplicate.num_points = 2;
-            Arena scratch_arena = arena_push(arena);
-            duplicate.points = arena_alloc_array(&scratch_arena, 2, v2l);
-            duplicate.pressures = arena_alloc_array(&scratch_arena, 2, f32);
-            duplicate.points[0] = stroke->points[0];  // It will be set relative to the center in the recursed call.
-            duplicate.points[1] = stroke->points[0];
-            duplicate.pressures[0] = stroke->pressures[0];
-            duplicate.pressures[1] = stroke->pressures[0];
-
-            gpu_cook_stroke(&scratch_arena, r, &duplicate, cook_option);
-
-            // Copy render element to stroke
-            stroke->render_handle = duplicate.render_handle;
-
-            arena_pop(&scratch_arena);
-        }
-        else if ( npoints > 1 ) {
-            // 3 (triangle) *
-            // 2 (two per segment) *
-            // N-1 (segments per stroke)
-            // Reduced to 4 by using indices
-            const size_t count_attribs = 4*((size_t)npoints-1);
-
-            // 6 (3 * 2 from count_attribs)
-            // N-1 (num segments)
-            const size_t count_indices = 6*((size_t)npoints-1);
-
-            size_t count_debug = 0;
-            v3f* bounds;
-            v3f* apoints;
-            v3f* bpoints;
-            v3f* debug = NULL;
-            u16* indices;
-            Arena scratch_arena = arena_push(arena,
-                                             count_attribs*sizeof(decltype(*bounds))  // Bounds
-                                             + 2*count_attribs*sizeof(decltype(*apoints)) // Attributes a,b
-                                             + count_debug*sizeof(decltype(*debug))    // Visualization
-                                             + count_indices*sizeof(decltype(*indices)));  // Interpolation points
-
-            bounds  = arena_alloc_array(&scratch_arena, count_attribs, v3f);
-            apoints = arena_alloc_array(&scratch_arena, count_attribs, v3f);
-            bpoints = arena_alloc_array(&scratch_arena, count_attribs, v3f);
-            indices = arena_alloc_array(&scratch_arena, count_indices, u16);
-#if STROKE_DEBUG_VIZ
-            debug = arena_alloc_array(&scratch_arena, count_debug, v3f);
-#endif
+    }
+    else if ( npoints > 0 ) {
+        // A single point is drawn as a segment of length zero.
+        const i64 num_segments = max(npoints - 1, (i64)1);
 
-            mlt_assert(r->scale > 0);
-
-            size_t bounds_i = 0;
-            size_t apoints_i = 0;
-            size_t bpoints_i = 0;
-            size_t indices_i = 0;
-            size_t debug_i = 0;
-            for ( i64 i=0; i < npoints-1; ++i ) {
-                v2i point_i = relative_to_render_center(r, stroke->points[i]);
-                v2i point_j = relative_to_render_center(r, stroke->points[i+1]);
-
-                Brush brush = stroke->brush;
-                float radius_i = stroke->pressures[i]*brush.radius;
-                float radius_j = stroke->pressures[i+1]*brush.radius;
-
-                u16 idx = (u16)bounds_i;
-                if ( point_i == point_j ) {
-                    i32 min_x = min(point_i.x - radius_i, point_j.x - radius_j);
-                    i32 min_y = min(point_i.y - radius_i, point_j.y - radius_j);
-                    i32 max_x = max(point_i.x + radius_i, point_j.x + radius_j);
-                    i32 max_y = max(point_i.y + radius_i, point_j.y + radius_j);
-
-                    // Bounding geometry and attributes
-
-                    mlt_assert (bounds_i < ((1<<16)-4));
-
-                    bounds[bounds_i++] = { (float)min_x, (float)min_y, (float)stroke_z };
-                    bounds[bounds_i++] = { (float)min_x, (float)max_y, (float)stroke_z };
-                    bounds[bounds_i++] = { (float)max_x, (float)max_y, (float)stroke_z };
-                    bounds[bounds_i++] = { (float)max_x, (float)min_y, (float)stroke_z };
-                } else {
-                    // Points are different. Do a coordinate change for a tighter box.
-                    v2f d = normalized(v2i_to_v2f(point_j - point_i));
-                    auto basis_change = [&d](v2f v) {
-                        v2f res = {
-                            v.x * d.x + v.y * d.y,
-                            v.x * d.y - v.y * d.x,
-                        };
-
-                        return res;
-                    };
-                    v2f a = basis_change(v2i_to_v2f(point_i));
-                    v2f b = basis_change(v2i_to_v2f(point_j));
-
-                    f32 rad = max(radius_i, radius_j);
-
-                    f32 min_x = min(a.x, b.x) - rad;
-                    f32 min_y = min(a.y, b.y) - rad;
-                    f32 max_x = max(a.x, b.x) + rad;
-                    f32 max_y = max(a.y, b.y) + rad;
-
-                    v2f A = basis_change(v2f{ min_x, min_y });
-                    v2f B = basis_change(v2f{ min_x, max_y });
-                    v2f C = basis_change(v2f{ max_x, max_y });
-                    v2f D = basis_change(v2f{ max_x, min_y });
-
-                    mlt_assert (bounds_i < ((1<<16)-4));
-
-                    bounds[bounds_i++] = { A.x, A.y, (float)stroke_z };
-                    bounds[bounds_i++] = { B.x, B.y, (float)stroke_z };
-                    bounds[bounds_i++] = { C.x, C.y, (float)stroke_z };
-                    bounds[bounds_i++] = { D.x, D.y, (float)stroke_z };
-                }
+        mlt_assert(r->scale > 0);
 
-                indices[indices_i++] = (u16)(idx + 0);
-                indices[indices_i++] = (u16)(idx + 1);
-                indices[indices_i++] = (u16)(idx + 2);
+        // The working stroke grows every frame. Reserve room for all of
+        // it, so that it is never moved while it is drawn.
+        if ( render_element->capacity < num_segments ) {
+            i64 reserve = num_segments;
+            if ( cook_option == CookStroke_UPDATE_WORKING_STROKE ) {
+                reserve = max(reserve, (i64)STROKE_MAX_POINTS - 1);
+            }
+            if ( render_element->capacity == 0 ) {
+                push(&r->resident_elements, render_element);
+            }
+            free_stroke_segments(r, render_element);
+            if ( r->resident_bytes + reserve*stroke_segment_bytes(r) > r->stroke_budget ) {
+                evict_strokes(r, reserve*stroke_segment_bytes(r));
+            }
+            alloc_stroke_segments(r, render_element, reserve);
+            render_element->num_cooked_points = 0;
+        }
 
-                indices[indices_i++] = (u16)(idx + 2);
-                indices[indices_i++] = (u16)(idx + 0);
-                indices[indices_i++] = (u16)(idx + 3);
+        // Points are appended to the working stroke. Only the segments
+        // that end in a new point are cooked, so that a frame costs the
+        // same however long the stroke is. The segment of a single point
+        // changes when a second point comes.
+        i64 first_new = 0;
+        if ( cook_option == CookStroke_UPDATE_WORKING_STROKE
+             && render_element->num_cooked_points > 1
+             && render_element->num_cooked_points <= npoints
+             && render_element_has_brush(render_element, stroke) ) {
+            first_new = render_element->num_cooked_points - 1;
+        }
+        else {
+            render_element->depth = stroke_z;
+        }
 
-                float pressure_a = stroke->pressures[i];
-                float pressure_b = stroke->pressures[i+1];
+        RenderElement* re = render_element;
+        re->count = num_segments;
+        re->num_cooked_points = npoints;
+        re->bounding_rect = stroke->bounding_rect;
+        re->color = { stroke->brush.color.r, stroke->brush.color.g, stroke->brush.color.b, stroke->brush.color.a };
+        re->radius = stroke->brush.radius;
+        re->min_opacity = stroke->brush.pressure_opacity_min;
+        re->hardness = stroke->brush.hardness;
+        re->flags = render_element_flags(stroke);
+
+        *job = {};
+        job->stroke = stroke;
+        job->re = re;
+        job->first_new = first_new;
+        job->num_new = num_segments - first_new;
+        build = job->num_new > 0;
+    }
+    return build;
+}
 
-                // Add attributes for each new vertex.
-                for ( int repeat = 0; repeat < 4; ++repeat ) {
-                    apoints[apoints_i++] = { (float)point_i.x, (float)point_i.y, pressure_a };
-                    bpoints[bpoints_i++] = { (float)point_j.x, (float)point_j.y, pressure_b };
-                    #if STROKE_DEBUG_VIZ
-                        v3f debug_color;
+template <typename T>
+static T*
+push_staging(DArray<T>* arr, i64 count)
+{
+    if ( arr->capacity < arr->count + count || arr->data == NULL ) {
+        reserve(arr, max(arr->count + count, 2*arr->capacity));
+    }
+    T* out = arr->data + arr->count;
+    arr->count += count;
+    return out;
+}
 
-                        if ( stroke->debug_flags[i] & Stroke::INTERPOLATED ) {
-                            debug_color = { 1.0f, 0.0f, 0.0f };
-                        }
-                        else {
-                            debug_color = { 0.0f, 1.0f, 0.0f };
-                        }
-                        debug[debug_i++] = debug_color;
-                    #endif
-                }
-            }
+static void
+queue_cook_job(RenderBackend* r, CookJob job)
+{
+    const i64 copies = stroke_segment_copies(r);
+    job.staging = r->cook_segments.count / copies;
+    push_staging(&r->cook_segments, copies*job.num_new);
+    if ( !r->instanced_strokes ) {
+        push_staging(&r->cook_indices, 6*job.num_new);
+    }
+    push(&r->cook_jobs, job);
+}
 
-            mlt_assert(bounds_i == count_attribs);
-            mlt_assert(apoints_i == bpoints_i);
-            mlt_assert(apoints_i == bounds_i);
+// Points of a stroke in the space of the render center, with pressures in
+// 16 bits. Segments share their points, so each one is converted once.
+static void
+cook_points_scalar(v2l* points, f32* pressures, i64 count, v2l origin,
+                   v2f* out_points, u16* out_pressures)
+{
+    for ( i64 i = 0; i < count; ++i ) {
+        out_points[i] = v2i_to_v2f(VEC2I(points[i] - origin));
+        out_pressures[i] = (u16)(clamp(pressures[i], 0.0f, 1.0f)*65535.0f + 0.5f);
+    }
+}
+
+// Same as cook_points_scalar, four points at a time.
+static void
+cook_points(v2l* points, f32* pressures, i64 count, v2l origin,
+            v2f* out_points, u16* out_pressures)
+{
+    const __m128i o = _mm_set_epi64x(origin.y, origin.x);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 scale = _mm_set1_ps(65535.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128i bias = _mm_set1_epi32(32768);
+
+    i64 i = 0;
+    for ( ; i + 4 <= count; i += 4 ) {
+        // Coordinates are cast to 32 bits, like VEC2I: keep the low half.
+        __m128i p[4];
+        for ( int k = 0; k < 4; ++k ) {
+            p[k] = _mm_sub_epi64(_mm_loadu_si128((__m128i*)(points + i + k)), o);
+            p[k] = _mm_shuffle_epi32(p[k], _MM_SHUFFLE(3,1,2,0));
+        }
+        __m128 xy01 = _mm_cvtepi32_ps(_mm_unpacklo_epi64(p[0], p[1]));
+        __m128 xy23 = _mm_cvtepi32_ps(_mm_unpacklo_epi64(p[2], p[3]));
+        _mm_storeu_ps((f32*)(out_points + i), xy01);
+        _mm_storeu_ps((f32*)(out_points + i + 2), xy23);
+
+        __m128 pr = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(pressures + i), zero), one);
+        __m128i pr32 = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(pr, scale), half));
+        // SSE2 only packs with signed saturation. Move to the signed range and back.
+        __m128i pr16 = _mm_packs_epi32(_mm_sub_epi32(pr32, bias), _mm_sub_epi32(pr32, bias));
+        pr16 = _mm_xor_si128(pr16, _mm_set1_epi16((short)0x8000));
+        _mm_storel_epi64((__m128i*)(out_pressures + i), pr16);
+    }
+    cook_points_scalar(points + i, pressures + i, count - i, origin, out_points + i, out_pressures + i);
+}
 
-            // TODO: check for GL_OUT_OF_MEMORY
+// Builds the records of a job into its place in the staging arrays. Runs on
+// any thread. Only reads the stroke and its RenderElement.
+static void
+cook_segments(RenderBackend* r, CookJob* job)
+{
+    Stroke* stroke = job->stroke;
+    RenderElement* re = job->re;
 
-            GLuint vbo_stroke = 0;
-            GLuint vbo_pointa = 0;
-            GLuint vbo_pointb = 0;
-            GLuint indices_buffer = 0;
-            GLuint vbo_debug = 0;
+    // One record per segment when instancing. Otherwise the record is
+    // repeated for the 4 corners and indexed as two triangles.
+    const i64 copies = stroke_segment_copies(r);
+    StrokeSegment* segments = r->cook_segments.data + copies*job->staging;
+    u32* indices = r->instanced_strokes ? NULL : r->cook_indices.data + 6*job->staging;
 
+    const i64 first_record = copies*(re->first_segment + job->first_new);
 
-            GLenum hint = GL_STATIC_DRAW;
-            if ( cook_option == CookStroke_UPDATE_WORKING_STROKE ) {
-                hint = GL_DYNAMIC_DRAW;
-            }
-            if ( render_element->vbo_stroke != 0 ) {
-                vbo_stroke = render_element->vbo_stroke;
-                vbo_pointa = render_element->vbo_pointa;
-                vbo_pointb = render_element->vbo_pointb;
-                indices_buffer = render_element->indices;
-                #if STROKE_DEBUG_VIZ
-                    vbo_debug = render_element->vbo_debug;
-                #endif
-
-                auto clear_array_buffer = [hint](GLint vbo, size_t size) {
-                    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-                    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(size), NULL, hint);
-                };
-                clear_array_buffer(vbo_stroke, bounds_i*sizeof(decltype(*bounds)));
-                clear_array_buffer(vbo_pointa, bounds_i*sizeof(decltype(*apoints)));
-                clear_array_buffer(vbo_pointb, bounds_i*sizeof(decltype(*bpoints)));
-                clear_array_buffer(indices_buffer, indices_i*sizeof(decltype(*indices)));
-                #if STROKE_DEBUG_VIZ
-                    clear_array_buffer(vbo_debug, debug_i*sizeof(decltype(*debug)));
-                #endif
+    u16 color16[4] = {};
+    for ( int c = 0; c < 4; ++c ) {
+        color16[c] = (u16)(clamp(re->color.d[c], 0.0f, 1.0f)*65535.0f + 0.5f);
+    }
+    StrokeSegment seg = {};
+    for ( int c = 0; c < 4; ++c ) {
+        seg.color[c] = color16[c];
+    }
+    seg.radius = (f32)stroke->brush.radius;
+    seg.depth = (f32)re->depth;
+
+    const v2l origin = VEC2L(r->render_center*(1<<RENDER_CHUNK_SIZE_LOG2));
+    v2f points[COOK_CHUNK_POINTS];
+    u16 pressures[COOK_CHUNK_POINTS];
+    i64 chunk = -1;  // Index of the first point in `points`.
+
+    for ( i64 k = 0; k < job->num_new; ++k ) {
+        i64 i = job->first_new + k;
+        i64 j = min(i + 1, stroke->num_points - 1);
+        if ( chunk < 0 || j >= chunk + COOK_CHUNK_POINTS ) {
+            // A chunk starts with the last point of the previous one.
+            chunk = i;
+            cook_points(stroke->points + chunk, stroke->pressures + chunk,
+                        min((i64)COOK_CHUNK_POINTS, stroke->num_points - chunk), origin,
+                        points, pressures);
+        }
+
+        seg.a = points[i - chunk];
+        seg.b = points[j - chunk];
+        seg.pressure[0] = pressures[i - chunk];
+        seg.pressure[1] = pressures[j - chunk];
+        #if STROKE_DEBUG_VIZ
+            if ( stroke->debug_flags[i] & Stroke::INTERPOLATED ) {
+                seg.debug_color = { 1.0f, 0.0f, 0.0f };
             }
             else {
-                glGenBuffers(1, &vbo_stroke);
-                glGenBuffers(1, &vbo_pointa);
-                glGenBuffers(1, &vbo_pointb);
-                glGenBuffers(1, &indices_buffer);
-                #if STROKE_DEBUG_VIZ
-                    glGenBuffers(1, &vbo_debug);
-                #endif
-
-                DEBUG_gl_mark_buffer(vbo_stroke);
-                DEBUG_gl_mark_buffer(vbo_pointa);
-                DEBUG_gl_mark_buffer(vbo_pointb);
-                DEBUG_gl_mark_buffer(indices_buffer);
+                seg.debug_color = { 0.0f, 1.0f, 0.0f };
             }
+        #endif
 
-            /*Send data to GPU*/ {
-                auto send_buffer_data = [hint](GLint vbo, size_t size, void* data) {
-                    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-                    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(size), data, hint);
-                };
+        StrokeSegment* dst = segments + copies*k;
+        for ( i64 repeat = 0; repeat < copies; ++repeat ) {
+            dst[repeat] = seg;
+        }
+
+        if ( indices ) {
+            // Corners are in strip order: (-1,-1), (1,-1), (-1,1), (1,1)
+            u32 idx = (u32)(first_record + 4*k);
+            u32* ind = indices + 6*k;
+            ind[0] = idx + 0;
+            ind[1] = idx + 1;
+            ind[2] = idx + 2;
+
+            ind[3] = idx + 2;
+            ind[4] = idx + 1;
+            ind[5] = idx + 3;
+        }
+    }
+}
+
+// Main queue callback.
+static void
+upload_cooked(void* data)
+{
+    TRACE_FUNCTION();
+    CookUpload* upload = (CookUpload*)data;
+    RenderBackend* r = upload->r;
+    const i64 copies = stroke_segment_copies(r);
+
+    // TODO: check for GL_OUT_OF_MEMORY
+
+    StrokePool* pool = &r->stroke_pools[upload->pool_i];
+    glBindBuffer(GL_ARRAY_BUFFER, pool->vbo);
+    glBufferSubData(GL_ARRAY_BUFFER,
+                    (GLintptr)(copies*upload->first_segment*sizeof(StrokeSegment)),
+                    (GLsizeiptr)(copies*upload->num_segments*sizeof(StrokeSegment)),
+                    r->cook_segments.data + copies*upload->staging);
+    if ( !r->instanced_strokes ) {
+        glBindBuffer(GL_ARRAY_BUFFER, pool->ibo);
+        glBufferSubData(GL_ARRAY_BUFFER,
+                        (GLintptr)(6*upload->first_segment*sizeof(u32)),
+                        (GLsizeiptr)(6*upload->num_segments*sizeof(u32)),
+                        r->cook_indices.data + 6*upload->staging);
+    }
+}
+
+// Job system callback.
+static void
+cook_jobs(void* data, i64 begin, i64 end, i32 worker)
+{
+    TRACE_FUNCTION();
+    RenderBackend* r = (RenderBackend*)data;
+    for ( i64 i = begin; i < end; ++i ) {
+        CookJob* job = &r->cook_jobs.data[i];
+        cook_segments(r, job);
+        CookUpload* upload = &r->cook_uploads.data[job->upload];
+        if ( SDL_AtomicAdd(&upload->pending, -1) == 1 ) {
+            jobs_main_push(upload_cooked, upload);
+        }
+    }
+}
 
-                send_buffer_data(vbo_stroke, bounds_i*sizeof(decltype(*bounds)), bounds);
-                send_buffer_data(vbo_pointa, bounds_i*sizeof(decltype(*apoints)), apoints);
-                send_buffer_data(vbo_pointb, bounds_i*sizeof(decltype(*bpoints)), bpoints);
-                send_buffer_data(indices_buffer, indices_i*sizeof(decltype(*indices)), indices);
-                #if STROKE_DEBUG_VIZ
-                    send_buffer_data(vbo_debug, debug_i*sizeof(decltype(*debug)), debug);
-                #endif
+// Builds the geometry of the queued strokes, on the job system when there is
+// enough of it, and uploads it.
+static void
+flush_cook_jobs(RenderBackend* r)
+{
+    TRACE_FUNCTION();
+    DArray<CookJob>* jobs = &r->cook_jobs;
+    if ( jobs->count > 0 ) {
+        reset(&r->cook_uploads);
+        for ( i64 i = 0; i < jobs->count; ) {
+            CookJob* first = &jobs->data[i];
+            CookUpload upload = {};
+            upload.r = r;
+            upload.pool_i = first->re->pool_i;
+            upload.first_segment = first->re->first_segment + first->first_new;
+            upload.num_segments = first->num_new;
+            upload.staging = first->staging;
+            first->upload = r->cook_uploads.count;
+            i64 next = i + 1;
+            while ( next < jobs->count
+                    && jobs->data[next].re->pool_i == upload.pool_i
+                    && jobs->data[next].re->first_segment + jobs->data[next].first_new == upload.first_segment + upload.num_segments ) {
+                upload.num_segments += jobs->data[next].num_new;
+                jobs->data[next].upload = r->cook_uploads.count;
+                ++next;
             }
+            SDL_AtomicSet(&upload.pending, (int)(next - i));
+            push(&r->cook_uploads, upload);
+            i = next;
+        }
+
+        if ( r->cook_segments.count / stroke_segment_copies(r) >= COOK_PARALLEL_SEGMENTS ) {
+            // We are the main thread, so uploads start while the rest is built.
+            parallel_for(jobs->count, 1, cook_jobs, r);
+        }
+        else {
+            cook_jobs(r, 0, jobs->count, 0);
+        }
+        jobs_main_run();
+
+        reset(jobs);
+        reset(&r->cook_segments);
+        reset(&r->cook_indices);
+    }
+}
+
+void
+gpu_cook_stroke(Arena* arena, RenderBackend* r, Stroke* stroke, CookStrokeOpt cook_option)
+{
+    CookJob job = {};
+    if ( prepare_cook(arena, r, stroke, cook_option, &job) ) {
+        queue_cook_job(r, job);
+    }
+    // Strokes queued by the clip go with it.
+    flush_cook_jobs(r);
+}
+
+void
+gpu_free_strokes(RenderBackend* r, CanvasState* canvas)
+{
+    // Every stroke with GPU data is in the resident list, including the
+    // working stroke and strokes in the undo graveyard. The pools are kept.
+    for ( i64 i = 0; i < r->resident_elements.count; ++i ) {
+        gpu_free_render_element(r, r->resident_elements.data[i]);
+    }
+    reset(&r->resident_elements);
+}
 
-            RenderElement* re = get_render_element(stroke->render_handle);
-            re->vbo_stroke = vbo_stroke;
-            re->vbo_pointa = vbo_pointa;
-            re->vbo_pointb = vbo_pointb;
-            re->indices = indices_buffer;
-            #if STROKE_DEBUG_VIZ
-                re->vbo_debug = vbo_debug;
-            #endif
-            re->count = (i64)(indices_i);
-            re->color = { stroke->brush.color.r, stroke->brush.color.g, stroke->brush.color.b, stroke->brush.color.a };
-            re->radius = stroke->brush.radius;
-            re->min_opacity = stroke->brush.pressure_opacity_min;
-            re->hardness = stroke->brush.hardness;
-
-            re->flags = 0;
-            if (stroke->flags & StrokeFlag_ERASER) {
-                re->flags |= RenderElementFlags_ERASER;
+// Finds the cache of a layer, or makes one if it fits in the budget. To make
+// room, deletes the caches that were not used in this clip, least recently
+// used first. Returns -1 when there is no room.
+static i32
+get_layer_cache(RenderBackend* r, i32 layer_id)
+{
+    i32 cache_i = -1;
+    i32 free_i = -1;
+    i64 total_bytes = 0;
+    for ( i64 i = 0; i < r->layer_caches.count; ++i ) {
+        LayerCache* c = &r->layer_caches[i];
+        if ( c->texture == 0 ) {
+            free_i = (i32)i;
+        }
+        else {
+            if ( c->layer_id == layer_id ) {
+                cache_i = (i32)i;
             }
-            if (stroke->flags & StrokeFlag_PRESSURE_TO_OPACITY) {
-                re->flags |= RenderElementFlags_PRESSURE_TO_OPACITY;
+            total_bytes += (i64)c->width*c->height*4;
+        }
+    }
+    if ( cache_i < 0 ) {
+        i64 bytes = (i64)r->width*r->height*4;
+        while ( bytes > 0 && total_bytes + bytes > LAYER_CACHE_BUDGET_BYTES ) {
+            LayerCache* lru = NULL;
+            for ( i64 i = 0; i < r->layer_caches.count; ++i ) {
+                LayerCache* c = &r->layer_caches[i];
+                if ( c->texture != 0 && c->last_used != r->clip_serial
+                     && (lru == NULL || c->last_used < lru->last_used) ) {
+                    lru = c;
+                }
             }
-            if (stroke->flags & StrokeFlag_DISTANCE_TO_OPACITY) {
-                re->flags |= RenderElementFlags_DISTANCE_TO_OPACITY;
+            if ( lru == NULL ) {
+                break;
             }
+            total_bytes -= (i64)lru->width*lru->height*4;
+            glDeleteTextures(1, &lru->texture);
+            *lru = LayerCache{};
+            free_i = (i32)(lru - r->layer_caches.data);
+        }
+        if ( bytes > 0 && total_bytes + bytes <= LAYER_CACHE_BUDGET_BYTES ) {
+            // Slots are reused instead of removed. Markers refer to caches by index.
+            if ( free_i < 0 ) {
+                push(&r->layer_caches, LayerCache{});
+                free_i = (i32)(r->layer_caches.count - 1);
+            }
+            LayerCache* c = &r->layer_caches[free_i];
+            *c = LayerCache{};
+            c->layer_id = layer_id;
+            c->texture = gl::new_color_texture(r->width, r->height);
+            c->width = r->width;
+            c->height = r->height;
+            cache_i = free_i;
+        }
+    }
+    if ( cache_i >= 0 ) {
+        LayerCache* c = &r->layer_caches[cache_i];
+        c->last_used = r->clip_serial;
+        if ( c->width != r->width || c->height != r->height ) {
+            gl::resize_color_texture(c->texture, r->width, r->height);
+            c->width = r->width;
+            c->height = r->height;
+            c->valid = false;
+        }
+    }
+    return cache_i;
+}
 
-            mlt_assert(re->count > 1);
-
-            arena_pop(&scratch_arena);
+// Returns true if the cache was drawn for a view that only differs from
+// `view` by a translation of whole pixels, and the translation.
+static b32
+layer_cache_shift(LayerCache* c, CanvasView* view, i64 scale, v2i* out_shift)
+{
+    b32 shifted = false;
+    if ( c->scale == scale && c->angle == view->angle ) {
+        // See canvas_to_raster
+        double x = (double)(c->pan_center.x - view->pan_center.x);
+        double y = (double)(c->pan_center.y - view->pan_center.y);
+        double cos_angle = cos(-view->angle);
+        double sin_angle = sin(-view->angle);
+        double dx = (x*cos_angle - y*sin_angle) / scale + (view->zoom_center.x - c->zoom_center.x);
+        double dy = (y*cos_angle + x*sin_angle) / scale + (view->zoom_center.y - c->zoom_center.y);
+        double rx = floor(dx + 0.5);
+        double ry = floor(dy + 0.5);
+        // A shift by a fraction of a pixel would not line up with the strips.
+        if ( fabs(dx - rx) < 1.0/256 && fabs(dy - ry) < 1.0/256
+             && fabs(rx) < c->width && fabs(ry) < c->height ) {
+            *out_shift = v2i{ (i32)rx, (i32)ry };
+            shifted = true;
         }
     }
+    return shifted;
 }
 
-void
-gpu_free_strokes(Stroke* strokes, i64 count, RenderBackend* r)
+// Parts of the screen that are not covered by a cache shifted by `shift`.
+// Returns the number of strips, at most two.
+static i32
+layer_cache_strips(v2i shift, i32 width, i32 height, Rect* out_strips)
 {
-    for ( i64 i = 0; i < count; ++i ) {
-        Stroke* s = &strokes[i];
-        RenderElement* re = get_render_element(s->render_handle);
-        if ( re && re->vbo_stroke != 0 ) {
-            mlt_assert(re->vbo_pointa != 0);
-            mlt_assert(re->vbo_pointb != 0);
-            mlt_assert(re->indices != 0);
+    i32 count = 0;
+    i32 top = max(shift.y, 0);
+    i32 bottom = min(height + shift.y, height);
+    if ( top > 0 ) {
+        out_strips[count++] = rect_from_xywh(0, 0, width, top);
+    }
+    if ( bottom < height ) {
+        out_strips[count++] = rect_from_xywh(0, bottom, width, height - bottom);
+    }
+    if ( shift.x > 0 ) {
+        out_strips[count++] = rect_from_xywh(0, top, shift.x, bottom - top);
+    }
+    else if ( shift.x < 0 ) {
+        out_strips[count++] = rect_from_xywh(width + shift.x, top, -shift.x, bottom - top);
+    }
+    return count;
+}
 
-            DEBUG_gl_validate_buffer(re->vbo_stroke);
-            DEBUG_gl_validate_buffer(re->vbo_pointa);
-            DEBUG_gl_validate_buffer(re->vbo_pointb);
-            DEBUG_gl_validate_buffer(re->indices);
+static b32
+stroke_is_visible(Stroke* s, Rect bounds)
+{
+    Rect stroke_bounds = s->bounding_rect;
+    i32 area = (stroke_bounds.right-stroke_bounds.left) * (stroke_bounds.bottom-stroke_bounds.top);
+    // Area might be 0 if the stroke is smaller than
+    // a pixel. We don't draw it in that case.
+    return area != 0 && rect_intersects_rect(stroke_bounds, bounds);
+}
 
-            glDeleteBuffers(1, &re->vbo_stroke);
-            glDeleteBuffers(1, &re->vbo_pointa);
-            glDeleteBuffers(1, &re->vbo_pointb);
-            glDeleteBuffers(1, &re->indices);
+// Job system callback.
+static void
+clip_scan_buckets(void* data, i64 begin, i64 end, i32 /*worker*/)
+{
+    ClipScan* scan = (ClipScan*)data;
+    StrokeList* list = scan->strokes;
+    for ( i64 b = begin; b < end; ++b ) {
+        StrokeBucket* bucket = list->buckets[b];
+        i64 n = 0;
+        if ( rect_intersects_rect(bucket->bounding_rect, scan->bounds) ) {
+            i64 first = b * STROKELIST_BUCKET_COUNT;
+            i64 last = min(first + STROKELIST_BUCKET_COUNT, list->count);
+            Stroke** visible = scan->visible + first;
+            for ( i64 i = 0; i < last - first; ++i ) {
+                if ( stroke_is_visible(&bucket->data[i], scan->bounds) ) {
+                    visible[n++] = &bucket->data[i];
+                }
+            }
+        }
+        scan->offsets[b] = n;
+    }
+}
 
-            DEBUG_gl_unmark_buffer(re->vbo_stroke);
-            DEBUG_gl_unmark_buffer(re->vbo_pointa);
-            DEBUG_gl_unmark_buffer(re->vbo_pointb);
-            DEBUG_gl_unmark_buffer(re->indices);
+// Job system callback.
+static void
+clip_scan_merge(void* data, i64 begin, i64 end, i32 /*worker*/)
+{
+    ClipScan* scan = (ClipScan*)data;
+    for ( i64 b = begin; b < end; ++b ) {
+        i64 n = scan->offsets[b + 1] - scan->offsets[b];
+        if ( n > 0 ) {
+            memcpy(scan->out + scan->offsets[b],
+                   scan->visible + b * STROKELIST_BUCKET_COUNT,
+                   (size_t)n * sizeof(*scan->out));
+        }
+    }
+}
 
-            *re = {};
+// Fills r->clip_strokes with the strokes of `l` that are visible within
+// `bounds`, in the order in which they were drawn.
+//
+// When most of a large layer is in view, nearly every stroke passes, so its
+// buckets are scanned in parallel instead of querying the index. Each bucket
+// writes its visible strokes to its own part of the scratch array, and a
+// prefix sum over the counts says where they go, so the order is kept.
+static void
+clip_layer_strokes(RenderBackend* r, Layer* l, Rect bounds)
+{
+    TRACE_FUNCTION();
+    reset(&r->clip_strokes);
+
+    StrokeIndexNode* root = l->stroke_index.root;
+    b32 scan = false;
+    if ( root && l->strokes.count >= CLIP_SCAN_MIN_STROKES ) {
+        Rect in_view = rect_intersect(root->bounds, bounds);
+        double layer_area = (double)(root->bounds.right - root->bounds.left) * (double)(root->bounds.bottom - root->bounds.top);
+        double view_area = (double)(in_view.right - in_view.left) * (double)(in_view.bottom - in_view.top);
+        scan = view_area >= layer_area * CLIP_SCAN_MIN_FRACTION;
+    }
+
+    if ( scan ) {
+        StrokeList* list = &l->strokes;
+        i64 num_buckets = (list->count + STROKELIST_BUCKET_COUNT - 1) / STROKELIST_BUCKET_COUNT;
+
+        reserve(&r->clip_scan_visible, list->count);
+        reserve(&r->clip_scan_offsets, num_buckets + 1);
+
+        ClipScan data = {};
+        data.strokes = list;
+        data.bounds = bounds;
+        data.visible = r->clip_scan_visible.data;
+        data.offsets = r->clip_scan_offsets.data;
+        parallel_for(num_buckets, 1, clip_scan_buckets, &data);
+
+        i64 total = 0;
+        for ( i64 b = 0; b < num_buckets; ++b ) {
+            i64 n = data.offsets[b];
+            data.offsets[b] = total;
+            total += n;
+        }
+        data.offsets[num_buckets] = total;
+
+        reserve(&r->clip_strokes, total);
+        r->clip_strokes.count = total;
+        data.out = r->clip_strokes.data;
+        parallel_for(num_buckets, 1, clip_scan_merge, &data);
+    }
+    else {
+        stroke_index_query(&l->stroke_index, bounds, &r->clip_query);
+        for ( i64 i = 0; i < r->clip_query.count; ++i ) {
+            Stroke* s = r->clip_query.data[i]->stroke;
+            if ( stroke_is_visible(s, bounds) ) {
+                push(&r->clip_strokes, s);
+            }
         }
     }
 }
 
-void
-gpu_free_strokes(RenderBackend* r, CanvasState* canvas)
+// Pushes the strokes of a layer that intersect `bounds`, in the order in
+// which they were drawn, starting with the stroke at `first`. With
+// `iterative`, stops when the frame's budget runs out and returns the index
+// of the next stroke. Returns -1 when all the strokes were pushed.
+static i64
+push_layer_strokes(Arena* arena, RenderBackend* r, Layer* l, Rect bounds, LayerCache* cache,
+                   i64 first = 0, b32 iterative = false)
 {
-    if ( canvas->root_layer != NULL ) {
-        for ( Layer* l = canvas->root_layer;
-              l != NULL;
-              l = l->next ) {
-            StrokeList* sl = &l->strokes;
-            StrokeBucket* bucket = &sl->root;
-            i64 count = sl->count;
-            while ( bucket ) {
-                if ( count >= STROKELIST_BUCKET_COUNT ) {
-                    count -= STROKELIST_BUCKET_COUNT;
-                    gpu_free_strokes(bucket->data, STROKELIST_BUCKET_COUNT, r);
-                } else {
-                    gpu_free_strokes(bucket->data, count, r);
-                }
-                bucket = bucket->next;
+    clip_layer_strokes(r, l, bounds);
+
+    for ( i64 i = first; i < r->clip_strokes.count; ++i ) {
+        if ( iterative && r->iterative_drawn > 0 ) {
+            f32 ms = perf_count_to_sec(perf_counter() - r->iterative_start) * 1000.0f;
+            if ( r->iterative_drawn >= r->iterative_segments || ms >= ITERATIVE_FRAME_BUDGET_MS ) {
+                return i;
             }
         }
+        Stroke* s = r->clip_strokes.data[i];
+        RenderElement* cooked = get_render_element(s->render_handle);
+        if ( cooked && cooked->capacity != 0 ) {
+            r->stroke_hits += 1;
+        }
+        else {
+            r->stroke_misses += 1;
+        }
+        CookJob job;
+        if ( prepare_cook(arena, r, s, CookStroke_NEW, &job) ) {
+            queue_cook_job(r, job);
+            if ( r->cook_segments.count / stroke_segment_copies(r) >= COOK_BATCH_SEGMENTS ) {
+                flush_cook_jobs(r);
+            }
+        }
+        RenderElement* re = push(&r->clip_array, *get_render_element(s->render_handle));
+        if ( cache && (s->flags & StrokeFlag_ERASER) ) {
+            cache->has_eraser = true;
+        }
+        if ( iterative ) {
+            r->iterative_drawn += re->count;
+        }
     }
+    return -1;
+}
+
+// Identifies what a layer's erasers copy from: the background and the
+// visible layers below it.
+static u64
+layer_below_key(u64 key, Layer* l)
+{
+    key = key*31 + hash((char*)&l->id, sizeof(l->id));
+    key = key*31 + hash((char*)&l->version, sizeof(l->version));
+    key = key*31 + hash((char*)&l->alpha, sizeof(l->alpha));
+    for ( LayerEffect* e = l->effects; e != NULL; e = e->next ) {
+        key = key*31 + hash((char*)&e->type, sizeof(e->type));
+        key = key*31 + hash((char*)&e->enabled, sizeof(e->enabled));
+        key = key*31 + hash((char*)&e->blur, sizeof(e->blur));
+    }
+    return key;
 }
 
 void
@@ -1225,6 +2033,7 @@ gpu_clip_strokes_and_update(Arena* arena,
                             Layer* root_layer, Stroke* working_stroke,
                             i32 x, i32 y, i32 w, i32 h, ClipFlags flags)
 {
+    TRACE_FUNCTION();
     DArray<RenderElement>* clip_array = &r->clip_array;
 
     RenderElement layer_element = {};
@@ -1234,13 +2043,25 @@ gpu_clip_strokes_and_update(Arena* arena,
 
     reset(clip_array);
 
+    // Marks the strokes and layer caches that this clip uses.
+    r->clip_serial += 1;
+
+    b32 use_caches = (flags & ClipFlags_LAYER_CACHES) != 0;
+    // A cache is only complete if all of the screen was clipped.
+    b32 complete = x == 0 && y == 0 && w == r->width && h == r->height;
+    u64 below_key = hash((char*)&r->background_color, sizeof(r->background_color));
+
+    // Layers are drawn bottom to top. Once the budget runs out, the layers
+    // that don't have a valid cache wait for the next frames.
+    b32 iterative = use_caches && complete && (flags & ClipFlags_DRAW_ITERATIVELY);
+    b32 out_of_budget = false;
+    r->iterative_drawn = 0;
+    r->iterative_start = perf_counter();
+    r->render_in_progress = false;
+    r->working_stroke_clipped = false;
+
     if (screen_bounds.left != screen_bounds.right &&
         screen_bounds.top != screen_bounds.bottom) {
-        #if MILTON_ENABLE_PROFILING
-        {
-            r->clipped_count = 0;
-        }
-        #endif
         for ( Layer* l = root_layer;
               l != NULL;
               l = l->next ) {
@@ -1248,95 +2069,130 @@ gpu_clip_strokes_and_update(Arena* arena,
                 // Skip invisible layers.
                 continue;
             }
+            b32 has_working_stroke = working_stroke->layer_id == l->id && working_stroke->num_points > 0;
 
-            StrokeBucket* bucket = &l->strokes.root;
-            i64 bucket_i = 0;
+            u64 layer_below = below_key;
+            below_key = layer_below_key(below_key, l);
+            if ( has_working_stroke ) {
+                // Changes every frame.
+                below_key = below_key*31 + r->clip_serial;
+            }
 
-            while ( bucket ) {
-                i64 count = 0;
-                if ( l->strokes.count < bucket_i * STROKELIST_BUCKET_COUNT ) {
-                    // There is an allocated bucket but we have already iterated
-                    // through all the actual strokes.
-                    break;
-                }
-                if ( l->strokes.count - bucket_i*STROKELIST_BUCKET_COUNT >= STROKELIST_BUCKET_COUNT ) {
-                    count = STROKELIST_BUCKET_COUNT;
-                } else {
-                    count = l->strokes.count % STROKELIST_BUCKET_COUNT;
+            LayerCache* cache = NULL;
+            i32 cache_i = -1;
+            b32 cache_valid = false;
+            b32 cache_shifted = false;
+            b32 cache_resumed = false;
+            b32 same_strokes = false;
+            v2i cache_shift = {};
+            if ( use_caches ) {
+                cache_i = get_layer_cache(r, l->id);
+                if ( cache_i >= 0 ) {
+                    cache = &r->layer_caches[cache_i];
+                    same_strokes = cache->version == l->version
+                                   && (!cache->has_eraser || cache->below_key == layer_below);
+                    b32 same_view = cache->pan_center == view->pan_center
+                                    && cache->zoom_center == view->zoom_center
+                                    && cache->scale == scale
+                                    && cache->angle == view->angle;
+                    cache_valid = cache->valid && same_strokes && same_view;
+                    cache_resumed = !cache->valid && same_strokes && same_view && complete
+                                    && cache->next_stroke > 0;
                 }
+            }
 
-                Rect bbox = bucket->bounding_rect;
-
-                b32 bucket_outside =   screen_bounds.left   > bbox.right
-                                    || screen_bounds.top    > bbox.bottom
-                                    || screen_bounds.right  < bbox.left
-                                    || screen_bounds.bottom < bbox.top;
-
-                if ( !bucket_outside ) {
-                    for ( i64 i = 0; i < count; ++i ) {
-                        Stroke* s = &bucket->data[i];
-
-                        if ( s != NULL ) {
-                            Rect bounds = s->bounding_rect;
-
-                            b32 stroke_outside =   screen_bounds.left   > bounds.right
-                                                || screen_bounds.top    > bounds.bottom
-                                                || screen_bounds.right  < bounds.left
-                                                || screen_bounds.bottom < bounds.top;
-
-                            i32 area = (bounds.right-bounds.left) * (bounds.bottom-bounds.top);
-                            // Area might be 0 if the stroke is smaller than
-                            // a pixel. We don't draw it in that case.
-                            if ( !stroke_outside && area!=0 ) {
-                                gpu_cook_stroke(arena, r, s);
-                                push(clip_array, *get_render_element(s->render_handle));
-                            }
-                            else if ( stroke_outside && ( flags & ClipFlags_UPDATE_GPU_DATA ) ) {
-                                // If it is far away, delete.
-                                i32 distance = MLT_ABS(bounds.left - x + bounds.top - y);
-                                const i32 min_number_of_screens = 4;
-                                if (    bounds.top    < y - min_number_of_screens*h
-                                     || bounds.bottom > y+h + min_number_of_screens*h
-                                     || bounds.left   > x+w + min_number_of_screens*w
-                                     || bounds.right  < x - min_number_of_screens*w ) {
-                                    gpu_free_strokes(s, 1, r);
-                                }
-                            }
-                        }
+            if ( out_of_budget && !cache_valid ) {
+                r->render_in_progress = true;
+                continue;
+            }
+
+            if ( cache ) {
+                if ( !cache_valid && !cache_resumed ) {
+                    // Panning. Only the strips need to be drawn, and
+                    // only full frames draw all of them.
+                    cache_shifted = cache->valid && same_strokes && complete
+                                    && layer_cache_shift(cache, view, scale, &cache_shift);
+                    if ( !cache_shifted ) {
+                        cache->has_eraser = false;
                     }
+                    cache->valid = false;
+                    cache->next_stroke = 0;
+                    cache->version = l->version;
+                    cache->pan_center = view->pan_center;
+                    cache->zoom_center = view->zoom_center;
+                    cache->scale = scale;
+                    cache->angle = view->angle;
+                    cache->below_key = layer_below;
                 }
-                else if ( flags & ClipFlags_UPDATE_GPU_DATA ) {
-                    gpu_free_strokes(bucket->data, count, r);
+
+                RenderElement* begin = push(clip_array, RenderElement{});
+                begin->flags = RenderElementFlags_LAYER_CACHE_BEGIN;
+                begin->cache_i = cache_i;
+                begin->cache_valid = cache_valid;
+                begin->cache_complete = complete;
+                begin->cache_shifted = cache_shifted;
+                begin->cache_shift = cache_shift;
+                begin->cache_resumed = cache_resumed;
+            }
+
+            b32 layer_complete = complete;
+
+            if ( cache_shifted ) {
+                Rect strips[2];
+                i32 num_strips = layer_cache_strips(cache_shift, r->width, r->height, strips);
+                for ( i32 si = 0; si < num_strips; ++si ) {
+                    RenderElement* strip = push(clip_array, RenderElement{});
+                    strip->flags = RenderElementFlags_LAYER_CACHE_STRIP;
+                    strip->strip = strips[si];
+
+                    Rect sb = strips[si];
+                    Rect strip_bounds = raster_to_canvas_bounding_rect(view, (i32)sb.left, (i32)sb.top,
+                                                                       (i32)(sb.right - sb.left),
+                                                                       (i32)(sb.bottom - sb.top), scale);
+                    push_layer_strokes(arena, r, l, strip_bounds, cache);
                 }
-                #if MILTON_ENABLE_PROFILING
-                {
-                    for ( i64 i = 0; i < count; ++i ) {
-                        Stroke* s = &bucket->data[i];
-                        RenderElement* re = get_render_element(s->render_handle);
-                        if ( re && re->vbo_stroke != 0 ) {
-                            r->clipped_count++;
-                        }
-                    }
+            }
+            else if ( !cache_valid ) {
+                // Only a cache can hold a partial redraw.
+                i64 first = cache_resumed ? cache->next_stroke : 0;
+                i64 next = push_layer_strokes(arena, r, l, screen_bounds, cache,
+                                              first, iterative && cache != NULL);
+                if ( next >= 0 ) {
+                    cache->next_stroke = next;
+                    layer_complete = false;
+                    out_of_budget = true;
+                    r->render_in_progress = true;
                 }
-                #endif
-                bucket = bucket->next;
-                bucket_i += 1;
+            }
+
+            if ( cache ) {
+                RenderElement* end = push(clip_array, RenderElement{});
+                end->flags = RenderElementFlags_LAYER_CACHE_END;
+                end->cache_i = cache_i;
+                end->cache_valid = cache_valid;
+                end->cache_complete = layer_complete;
             }
 
             // Add the working stroke on the current layer.
-            if ( working_stroke->layer_id == l->id ) {
-                if ( working_stroke->num_points > 0 ) {
-                    gpu_cook_stroke(arena, r, working_stroke, CookStroke_UPDATE_WORKING_STROKE);
+            if ( has_working_stroke ) {
+                gpu_cook_stroke(arena, r, working_stroke, CookStroke_UPDATE_WORKING_STROKE);
 
-                    push(clip_array, *get_render_element(working_stroke->render_handle));
-                }
+                push(clip_array, *get_render_element(working_stroke->render_handle));
+                r->working_stroke_clipped = true;
             }
 
             auto* p = push(clip_array, layer_element);
             p->layer_alpha = l->alpha;
             p->effects = l->effects;
         }
+
+        #if MILTON_ENABLE_PROFILING
+        {
+            r->clipped_count = (u64)r->resident_elements.count;
+        }
+        #endif
     }
+    flush_cook_jobs(r);
 }
 
 static void
@@ -1358,6 +2214,56 @@ gpu_fill_with_texture(RenderBackend* r, float alpha = 1.0f)
     }
 }
 
+// Copies `texture` to helper_texture and leaves it attached to the framebuffer.
+static void
+copy_to_helper_texture(RenderBackend* r, GLuint texture)
+{
+    glDisable(GL_BLEND);
+    glDisable(GL_DEPTH_TEST);
+    glFramebufferTexture2DEXT(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              GL_TEXTURE_2D, r->helper_texture, 0);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    gpu_fill_with_texture(r);
+    glBindTexture(GL_TEXTURE_2D, r->eraser_texture);
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+}
+
+// Moves the contents of a cache by `shift` pixels. The cache gets the
+// helper texture, and the helper texture gets the old cache texture.
+static void
+shift_layer_cache(RenderBackend* r, LayerCache* cache, v2i shift)
+{
+    // GL is bottom-left.
+    i32 dx = shift.x;
+    i32 dy = -shift.y;
+    i32 w = cache->width - abs(dx);
+    i32 h = cache->height - abs(dy);
+
+    glFramebufferTexture2DEXT(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              GL_TEXTURE_2D, cache->texture, 0);
+    glBindTexture(GL_TEXTURE_2D, r->helper_texture);
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0,
+                        /*dst*/ max(dx, 0), max(dy, 0),
+                        /*src*/ max(-dx, 0), max(-dy, 0),
+                        w, h);
+    glBindTexture(GL_TEXTURE_2D, r->eraser_texture);
+
+    swap(cache->texture, r->helper_texture);
+}
+
+static b32
+has_enabled_effects(LayerEffect* effects)
+{
+    b32 result = false;
+    for ( LayerEffect* e = effects; e != NULL; e = e->next ) {
+        if ( e->enabled ) {
+            result = true;
+        }
+    }
+    return result;
+}
+
 enum BoxFilterPass
 {
     BoxFilterPass_VERTICAL = 0,
@@ -1382,10 +2288,184 @@ box_filter_pass(RenderBackend* r, int kernel_size, int direction)
     }
 }
 
+static const StrokeAttrib g_segment_attribs[] = {
+    StrokeAttrib_POINTA,
+    StrokeAttrib_POINTB,
+    StrokeAttrib_PRESSURE,
+    StrokeAttrib_COLOR,
+    StrokeAttrib_RADIUS,
+    StrokeAttrib_DEPTH,
+#if STROKE_DEBUG_VIZ
+    StrokeAttrib_DEBUG_COLOR,
+#endif
+};
+
+// Points the per-segment attributes at the record of `first_segment`, in the
+// array buffer that is bound.
+static void
+set_stroke_segment_pointers(RenderBackend* r, i64 first_segment)
+{
+    struct { GLint size; GLenum type; GLboolean normalize; size_t offset; } attribs[] = {
+        { 2, GL_FLOAT,          GL_FALSE, offsetof(StrokeSegment, a) },
+        { 2, GL_FLOAT,          GL_FALSE, offsetof(StrokeSegment, b) },
+        { 2, GL_UNSIGNED_SHORT, GL_TRUE,  offsetof(StrokeSegment, pressure) },
+        { 4, GL_UNSIGNED_SHORT, GL_TRUE,  offsetof(StrokeSegment, color) },
+        { 1, GL_FLOAT,          GL_FALSE, offsetof(StrokeSegment, radius) },
+        { 1, GL_FLOAT,          GL_FALSE, offsetof(StrokeSegment, depth) },
+#if STROKE_DEBUG_VIZ
+        { 3, GL_FLOAT,          GL_FALSE, offsetof(StrokeSegment, debug_color) },
+#endif
+    };
+    static_assert(array_count(attribs) == array_count(g_segment_attribs), "One pointer per segment attribute");
+
+    size_t base = (size_t)(stroke_segment_copies(r)*first_segment)*sizeof(StrokeSegment);
+    for ( sz i = 0; i < array_count(attribs); ++i ) {
+        glVertexAttribPointer(/*attrib location*/ (GLuint)g_segment_attribs[i],
+                              /*size*/ attribs[i].size, attribs[i].type, attribs[i].normalize,
+                              /*stride*/ sizeof(StrokeSegment), /*ptr*/ (GLvoid*)(base + attribs[i].offset));
+    }
+}
+
+// Points the stroke attributes at a pool's buffers.
+static void
+bind_stroke_pool(RenderBackend* r, i32 pool_i)
+{
+    StrokePool* pool = &r->stroke_pools[pool_i];
+    DEBUG_gl_validate_buffer(pool->vbo);
+
+    glBindBuffer(GL_ARRAY_BUFFER, r->vbo_stroke_corners);
+    glEnableVertexAttribArray((GLuint)StrokeAttrib_CORNER);
+    glVertexAttribPointer(/*attrib location*/ (GLuint)StrokeAttrib_CORNER,
+                          /*size*/ 2, GL_BYTE, /*normalize*/ GL_FALSE,
+                          /*stride*/ 0, /*ptr*/ 0);
+
+    glBindBuffer(GL_ARRAY_BUFFER, pool->vbo);
+    if ( !r->instanced_strokes ) {
+        DEBUG_gl_validate_buffer(pool->ibo);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool->ibo);
+    }
+    for ( sz i = 0; i < array_count(g_segment_attribs); ++i ) {
+        glEnableVertexAttribArray((GLuint)g_segment_attribs[i]);
+        if ( r->instanced_strokes ) {
+            glVertexAttribDivisor((GLuint)g_segment_attribs[i], 1);
+        }
+    }
+    set_stroke_segment_pointers(r, 0);
+}
+
+// Leaves the vertex attribute state as the other programs expect it.
+static void
+unbind_stroke_pool(RenderBackend* r, i32* bound_pool)
+{
+    if ( *bound_pool >= 0 ) {
+        for ( sz i = 0; i < array_count(g_segment_attribs); ++i ) {
+            if ( r->instanced_strokes ) {
+                glVertexAttribDivisor((GLuint)g_segment_attribs[i], 0);
+            }
+            glDisableVertexAttribArray((GLuint)g_segment_attribs[i]);
+        }
+        glDisableVertexAttribArray((GLuint)StrokeAttrib_CORNER);
+        *bound_pool = -1;
+    }
+}
+
+// Draws consecutive stroke elements that share a pool with as few calls as
+// possible.
+static void
+draw_stroke_batch(RenderBackend* r, GLuint program, RenderElement* elements, i64 num_elements,
+                  i32* bound_pool)
+{
+    if ( *bound_pool != elements[0].pool_i ) {
+        bind_stroke_pool(r, elements[0].pool_i);
+        *bound_pool = elements[0].pool_i;
+    }
+
+    gl::use_program(program);
+
+    if ( r->instanced_strokes ) {
+        // Elements that are next to each other in the pool are one run of
+        // instances.
+        i64 run_first = elements[0].first_segment;
+        i64 run_count = 0;
+        for ( i64 i = 0; i <= num_elements; ++i ) {
+            RenderElement* re = i < num_elements ? &elements[i] : NULL;
+            if ( re && re->first_segment == run_first + run_count ) {
+                mlt_assert(re->pool_i == *bound_pool);
+                run_count += re->count;
+                continue;
+            }
+            set_stroke_segment_pointers(r, run_first);
+            glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)run_count);
+            if ( re ) {
+                mlt_assert(re->pool_i == *bound_pool);
+                run_first = re->first_segment;
+                run_count = re->count;
+            }
+        }
+    }
+    else {
+        reset(&r->batch_counts);
+        reset(&r->batch_offsets);
+        for ( i64 i = 0; i < num_elements; ++i ) {
+            RenderElement* re = &elements[i];
+            mlt_assert(re->pool_i == *bound_pool);
+            push(&r->batch_counts, (GLsizei)(6*re->count));
+            push(&r->batch_offsets, (void*)(6*re->first_segment*sizeof(u32)));
+        }
+        glMultiDrawElements(GL_TRIANGLES, r->batch_counts.data, GL_UNSIGNED_INT,
+                            r->batch_offsets.data, (GLsizei)num_elements);
+    }
+}
+
+// Strokes that are drawn with a single pass can be batched with their
+// neighbors. Returns 0 for the others.
+static GLuint
+single_pass_program(RenderBackend* r, RenderElement* re)
+{
+    GLuint program = 0;
+    if ( !(re->flags & RenderElementFlags_LAYER) && re->count > 0 ) {
+        if ( re->flags & RenderElementFlags_ERASER ) {
+            program = r->stroke_eraser_program;
+        }
+        else if ( !(re->flags & (RenderElementFlags_PRESSURE_TO_OPACITY | RenderElementFlags_DISTANCE_TO_OPACITY)) ) {
+            program = r->stroke_program;
+        }
+    }
+    return program;
+}
+
+// Strokes with pressure or distance to opacity are drawn with three passes
+// through the stroke info texture. Consecutive strokes can share the passes
+// when they don't overlap and have the same settings.
+#define MAX_INFO_BATCH 64
+
+static b32
+can_share_info_passes(RenderBackend* r, RenderElement* batch, i64 count, RenderElement* re)
+{
+    b32 can_share = count < MAX_INFO_BATCH
+                    && !(re->flags & RenderElementFlags_LAYER)
+                    && re->count > 0
+                    && re->pool_i == batch[0].pool_i
+                    && re->flags == batch[0].flags
+                    && re->min_opacity == batch[0].min_opacity
+                    && re->hardness == batch[0].hardness;
+    if ( can_share ) {
+        // Segment quads can stick out of the bounding rect. Add a radius,
+        // and a pixel for the edges.
+        Rect footprint = rect_enlarge(re->bounding_rect, re->radius + r->scale);
+        for ( i64 i = 0; can_share && i < count; ++i ) {
+            Rect other = rect_enlarge(batch[i].bounding_rect, batch[i].radius + r->scale);
+            can_share = !rect_intersects_rect(footprint, other);
+        }
+    }
+    return can_share;
+}
+
 static void
 gpu_render_canvas(RenderBackend* r, i32 view_x, i32 view_y,
                   i32 view_width, i32 view_height, float background_alpha=1.0f)
 {
+    TRACE_FUNCTION();
     PUSH_GRAPHICS_GROUP("render_canvas");
 
     // FLip it. GL is bottom-left.
@@ -1437,11 +2517,63 @@ gpu_render_canvas(RenderBackend* r, i32 view_x, i32 view_y,
 
     DArray<RenderElement>* clip_array = &r->clip_array;
 
+    // Pool that the stroke attributes point to. Other draws change the
+    // attributes, so it is unbound before each layer.
+    i32 bound_pool = -1;
+
+    // Layer caches are only complete when all of the screen is drawn.
+    b32 full_frame = view_x == 0 && view_y == 0 && view_width == r->width && view_height == r->height;
+
     PUSH_GRAPHICS_GROUP("render elements");
     for ( i64 i = 0; i < (i64)clip_array->count; i++ ) {
         RenderElement* re = &clip_array->data[i];
 
-        if ( re->flags & RenderElementFlags_LAYER ) {
+        if ( re->flags & RenderElementFlags_LAYER_CACHE_BEGIN ) {
+            // Draw the strokes of the layer into its cache, or use it as is.
+            LayerCache* cache = &r->layer_caches[re->cache_i];
+            if ( re->cache_shifted ) {
+                shift_layer_cache(r, cache, re->cache_shift);
+            }
+            layer_texture = cache->texture;
+            glFramebufferTexture2DEXT(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                      texture_target, layer_texture, 0);
+            if ( !re->cache_valid && !re->cache_shifted && !re->cache_resumed ) {
+                glClearColor(0,0,0,0);
+                glClear(GL_COLOR_BUFFER_BIT);
+            }
+        }
+        else if ( re->flags & RenderElementFlags_LAYER_CACHE_STRIP ) {
+            // The strokes that follow are only drawn in the strip.
+            Rect strip = re->strip;
+            glScissor((GLint)strip.left, (GLint)(r->height - strip.bottom),
+                      (GLsizei)(strip.right - strip.left), (GLsizei)(strip.bottom - strip.top));
+            glClearColor(0,0,0,0);
+            glClear(GL_COLOR_BUFFER_BIT);
+        }
+        else if ( re->flags & RenderElementFlags_LAYER_CACHE_END ) {
+            glScissor(x, y, w, h);
+            LayerCache* cache = &r->layer_caches[re->cache_i];
+            if ( !re->cache_valid && re->cache_complete && full_frame ) {
+                cache->valid = true;
+            }
+            b32 has_working_stroke = i + 1 < clip_array->count
+                                     && !(clip_array->data[i + 1].flags & RenderElementFlags_LAYER);
+            if ( has_working_stroke ) {
+                // Draw the working stroke over a copy. The cache only has
+                // finished strokes.
+                unbind_stroke_pool(r, &bound_pool);
+                copy_to_helper_texture(r, cache->texture);
+                layer_texture = r->helper_texture;
+            }
+        }
+        else if ( re->flags & RenderElementFlags_LAYER ) {
+            unbind_stroke_pool(r, &bound_pool);
+
+            if ( layer_texture != r->helper_texture && has_enabled_effects(re->effects) ) {
+                // Effects write to their input. Keep the cache.
+                copy_to_helper_texture(r, layer_texture);
+                layer_texture = r->helper_texture;
+            }
 
             // Layer render element.
             // The current framebuffer's color attachment is layer_texture.
@@ -1522,6 +2654,7 @@ gpu_render_canvas(RenderBackend* r, i32 view_x, i32 view_y,
                 gpu_fill_with_texture(r);
 
                 // Clear the layer texture.
+                layer_texture = r->helper_texture;
                 glFramebufferTexture2DEXT(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
                                           texture_target, layer_texture, 0);
                 glClearColor(0,0,0,0);
@@ -1535,77 +2668,71 @@ gpu_render_canvas(RenderBackend* r, i32 view_x, i32 view_y,
         }
         // If this render element is not a layer, then it is a stroke.
         else {
-            GLuint program_for_stroke = r->stroke_program;
-
-            auto stroke_pass = [r, texture_target](RenderElement* re, GLuint program_for_stroke) {
-                i64 count = re->count;
-                gl::use_program(program_for_stroke);
-                gl::set_uniform_vec4(program_for_stroke, "u_brush_color", 1, re->color.d);
-                gl::set_uniform_i(program_for_stroke, "u_radius", re->radius);
-
-                DEBUG_gl_validate_buffer(re->vbo_stroke);
-                DEBUG_gl_validate_buffer(re->vbo_pointa);
-                DEBUG_gl_validate_buffer(re->vbo_pointb);
-                DEBUG_gl_validate_buffer(re->indices);
-
-                gl::vertex_attrib_v3f(program_for_stroke, "a_pointa", re->vbo_pointa);
-                gl::vertex_attrib_v3f(program_for_stroke, "a_pointb", re->vbo_pointb);
-                gl::vertex_attrib_v3f(program_for_stroke, "a_position", re->vbo_stroke);
-
-                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, re->indices);
-
-                glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_SHORT, 0);
-            };
-
-            if ( re->count > 0 ) {
-                if (re->flags & RenderElementFlags_ERASER) {
+            GLuint batch_program = single_pass_program(r, re);
+            if ( batch_program ) {
+                i64 batch_end = i + 1;
+                while ( batch_end < clip_array->count
+                        && clip_array->data[batch_end].pool_i == re->pool_i
+                        && single_pass_program(r, &clip_array->data[batch_end]) == batch_program ) {
+                    ++batch_end;
+                }
+                if ( re->flags & RenderElementFlags_ERASER ) {
                     glBindTexture(texture_target, r->eraser_texture);
-                    stroke_pass(re, r->stroke_eraser_program);
                 }
-                else if ( (re->flags & (RenderElementFlags_PRESSURE_TO_OPACITY | RenderElementFlags_DISTANCE_TO_OPACITY)) ) {
-                    glFramebufferTexture2DEXT(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-                                              texture_target, r->stroke_info_texture, 0);
+                draw_stroke_batch(r, batch_program, re, batch_end - i, &bound_pool);
+                i = batch_end - 1;
+            }
+            else if ( re->count > 0 ) {
+                i64 batch_end = i + 1;
+                while ( batch_end < clip_array->count
+                        && can_share_info_passes(r, re, batch_end - i, &clip_array->data[batch_end]) ) {
+                    ++batch_end;
+                }
+                i64 batch_count = batch_end - i;
+                i = batch_end - 1;
+
+                auto stroke_pass = [r, batch_count, &bound_pool](RenderElement* re, GLuint program_for_stroke) {
+                    draw_stroke_batch(r, program_for_stroke, re, batch_count, &bound_pool);
+                };
 
+                glFramebufferTexture2DEXT(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                          texture_target, r->stroke_info_texture, 0);
 
-                    glDisable(GL_DEPTH_TEST);
-                    glDisable(GL_BLEND);
-                    stroke_pass(re, r->stroke_clear_program);
 
-                    glEnable(GL_BLEND);
-                    glBlendEquationSeparate(GL_MIN, GL_MAX);
+                glDisable(GL_DEPTH_TEST);
+                glDisable(GL_BLEND);
+                stroke_pass(re, r->stroke_clear_program);
 
-                    stroke_pass(re, r->stroke_info_program);
+                glEnable(GL_BLEND);
+                glBlendEquationSeparate(GL_MIN, GL_MAX);
 
-                    glBlendEquation(GL_FUNC_ADD);
+                stroke_pass(re, r->stroke_info_program);
 
-                    glEnable(GL_DEPTH_TEST);
-                    glFramebufferTexture2DEXT(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-                                              texture_target, layer_texture, 0);
-                    glBindTexture(texture_target, r->stroke_info_texture);
+                glBlendEquation(GL_FUNC_ADD);
 
-                    if ( (re->flags & RenderElementFlags_PRESSURE_TO_OPACITY) &&
-                        !(re->flags & RenderElementFlags_DISTANCE_TO_OPACITY)) {
-                        gl::set_uniform_f(r->stroke_fill_program_pressure, "u_opacity_min", re->min_opacity);
-                        stroke_pass(re, r->stroke_fill_program_pressure);
-                    }
-                    else if ( !(re->flags & RenderElementFlags_PRESSURE_TO_OPACITY) &&
-                               (re->flags & RenderElementFlags_DISTANCE_TO_OPACITY)) {
-                        gl::set_uniform_f(r->stroke_fill_program_distance, "u_hardness", re->hardness);
-                        stroke_pass(re, r->stroke_fill_program_distance);
-                    }
-                    else if ( (re->flags & RenderElementFlags_PRESSURE_TO_OPACITY) &&
-                              (re->flags & RenderElementFlags_DISTANCE_TO_OPACITY)) {
-                        gl::set_uniform_f(r->stroke_fill_program_pressure_distance, "u_opacity_min", re->min_opacity);
-                        gl::set_uniform_f(r->stroke_fill_program_pressure_distance, "u_hardness", re->hardness);
-                        stroke_pass(re, r->stroke_fill_program_pressure_distance);
-                    }
-                    else {
-                        INVALID_CODE_PATH;
-                    }
+                glEnable(GL_DEPTH_TEST);
+                glFramebufferTexture2DEXT(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                          texture_target, layer_texture, 0);
+                glBindTexture(texture_target, r->stroke_info_texture);
+
+                if ( (re->flags & RenderElementFlags_PRESSURE_TO_OPACITY) &&
+                    !(re->flags & RenderElementFlags_DISTANCE_TO_OPACITY)) {
+                    gl::set_uniform_f(r->stroke_fill_program_pressure, "u_opacity_min", re->min_opacity);
+                    stroke_pass(re, r->stroke_fill_program_pressure);
+                }
+                else if ( !(re->flags & RenderElementFlags_PRESSURE_TO_OPACITY) &&
+                           (re->flags & RenderElementFlags_DISTANCE_TO_OPACITY)) {
+                    gl::set_uniform_f(r->stroke_fill_program_distance, "u_hardness", re->hardness);
+                    stroke_pass(re, r->stroke_fill_program_distance);
+                }
+                else if ( (re->flags & RenderElementFlags_PRESSURE_TO_OPACITY) &&
+                          (re->flags & RenderElementFlags_DISTANCE_TO_OPACITY)) {
+                    gl::set_uniform_f(r->stroke_fill_program_pressure_distance, "u_opacity_min", re->min_opacity);
+                    gl::set_uniform_f(r->stroke_fill_program_pressure_distance, "u_hardness", re->hardness);
+                    stroke_pass(re, r->stroke_fill_program_pressure_distance);
                 }
                 else {
-                    // Fast path
-                    stroke_pass(re, r->stroke_program);
+                    INVALID_CODE_PATH;
                 }
             } else {
                 static int n = 0;
@@ -1613,6 +2740,7 @@ gpu_render_canvas(RenderBackend* r, i32 view_x, i32 view_y,
             }
         }
     }
+    unbind_stroke_pool(r, &bound_pool);
     POP_GRAPHICS_GROUP();  // render elements
     glViewport(0, 0, r->width, r->height);
     glScissor(0, 0, r->width, r->height);
@@ -1623,6 +2751,7 @@ gpu_render_canvas(RenderBackend* r, i32 view_x, i32 view_y,
 void
 gpu_render(RenderBackend* r,  i32 view_x, i32 view_y, i32 view_width, i32 view_height)
 {
+    TRACE_FUNCTION();
     PUSH_GRAPHICS_GROUP("gpu_render");
 
     glViewport(0, 0, r->width, r->height);
@@ -1634,6 +2763,17 @@ gpu_render(RenderBackend* r,  i32 view_x, i32 view_y, i32 view_width, i32 view_h
     // TODO: Do less work when idling
     gpu_render_canvas(r, view_x, view_y, view_width, view_height);
 
+    if ( r->iterative_drawn >= ITERATIVE_MIN_SEGMENTS ) {
+        // Wait for the strokes, and fit the budget to the time they took.
+        glFinish();
+        f32 ms = perf_count_to_sec(perf_counter() - r->iterative_start) * 1000.0f;
+        i64 fit = (i64)(r->iterative_drawn * (ITERATIVE_FRAME_BUDGET_MS / max(ms, 0.1f)));
+        r->iterative_segments = (r->iterative_segments + fit) / 2;
+        r->iterative_segments = min(max(r->iterative_segments, (i64)ITERATIVE_MIN_SEGMENTS),
+                                    (i64)ITERATIVE_MAX_SEGMENTS);
+        r->iterative_drawn = 0;
+    }
+
     GLenum texture_target;
     texture_target = GL_TEXTURE_2D;
 
@@ -1762,6 +2902,7 @@ gpu_render(RenderBackend* r,  i32 view_x, i32 view_y, i32 view_width, i32 view_h
 void
 gpu_render_to_buffer(Milton* milton, u8* buffer, i32 scale, i32 x, i32 y, i32 w, i32 h, f32 background_alpha)
 {
+    TRACE_FUNCTION();
     CanvasView saved_view = *milton->view;
     RenderBackend* r = milton->renderer;
     CanvasView* view = milton->view;
@@ -1868,10 +3009,41 @@ gpu_render_to_buffer(Milton* milton, u8* buffer, i32 scale, i32 x, i32 y, i32 w,
     gpu_render(r, 0, 0, r->width, r->height);
 }
 
+b32
+gpu_render_in_progress(RenderBackend* r)
+{
+    return r->render_in_progress;
+}
+
+b32
+gpu_working_stroke_clipped(RenderBackend* r)
+{
+    return r->working_stroke_clipped;
+}
+
 void
 gpu_release_data(RenderBackend* r)
 {
+    release(&r->cook_jobs);
+    release(&r->cook_segments);
+    release(&r->cook_indices);
+    release(&r->cook_uploads);
     release(&r->clip_array);
+    for ( i64 i = 0; i < r->stroke_pools.count; ++i ) {
+        release(&r->stroke_pools.data[i].free_ranges);
+    }
+    release(&r->stroke_pools);
+    release(&r->resident_elements);
+    release(&r->batch_counts);
+    release(&r->batch_offsets);
+    release(&r->clip_query);
+    release(&r->clip_strokes);
+    release(&r->clip_scan_visible);
+    release(&r->clip_scan_offsets);
+    for ( i64 i = 0; i < r->layer_caches.count; ++i ) {
+        glDeleteTextures(1, &r->layer_caches[i].texture);
+    }
+    release(&r->layer_caches);
 }
 
 
@@ -1950,5 +3122,6 @@ gpu_reset_stroke(RenderBackend* r, RenderHandle handle)
     RenderElement* re = get_render_element(handle);
     if (re) {
         re->count = 0;
+        re->num_cooked_points = 0;
     }
 }
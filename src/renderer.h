@@ -60,6 +60,32 @@ void gpu_update_canvas(RenderBackend* renderer, CanvasState* canvas, CanvasView*
 
 void gpu_get_viewport_limits(RenderBackend* renderer, float* out_viewport_limits);
 i32  gpu_get_num_clipped_strokes(Layer* root_layer);
+// Whether the stroke has geometry in GPU memory. Only reads, so it can be
+// called from jobs while the main thread waits.
+b32  gpu_stroke_is_cooked(RenderHandle handle);
+
+// Stroke geometry in GPU memory. For the debug window.
+struct GpuStrokeMemory
+{
+    i64 reserved_bytes;     // Size of the stroke pools.
+    i64 used_bytes;         // Taken by resident strokes.
+    i64 budget_bytes;
+    i64 num_strokes;        // Resident strokes.
+    i64 num_segments;       // About one per point.
+    i64 bytes_per_segment;
+    i64 bytes_per_segment_quads;  // What it would take without instanced arrays.
+    b32 instanced;
+
+    // Since startup. A hit is a clipped stroke that didn't need to be cooked.
+    i64 hits;
+    i64 misses;
+    i64 evictions;
+};
+void gpu_get_stroke_memory(RenderBackend* renderer, GpuStrokeMemory* out);
+
+// Least recently used strokes are freed when cooking another one would take
+// more than `bytes`. Strokes that are drawn in the current frame are kept.
+void gpu_set_stroke_budget(RenderBackend* renderer, i64 bytes);
 
 
 enum CookStrokeOpt
@@ -67,6 +93,8 @@ enum CookStrokeOpt
     CookStroke_NEW                   = 0,
     CookStroke_UPDATE_WORKING_STROKE = 1,
 };
+// The working stroke is cooked incrementally: points that were cooked are
+// assumed not to change. Reset it after moving them.
 void gpu_reset_stroke(RenderBackend* r, RenderHandle handle);
 
 void gpu_cook_stroke(Arena* arena, RenderBackend* renderer, Stroke* stroke,
@@ -75,12 +103,13 @@ void gpu_cook_stroke(Arena* arena, RenderBackend* renderer, Stroke* stroke,
 void gpu_free_strokes(RenderBackend* renderer, CanvasState* canvas);
 
 
-// Creates OpenGL objects for strokes that are in view but are not loaded on the GPU. Deletes
-// content for strokes that are far away.
+// Creates OpenGL objects for strokes that are in view but are not loaded on the GPU. Strokes
+// that don't fit in the budget are evicted. See gpu_set_stroke_budget
 enum ClipFlags
 {
-    ClipFlags_UPDATE_GPU_DATA   = 1<<0,  // Free all strokes that are far away.
     ClipFlags_JUST_CLIP         = 1<<1,
+    ClipFlags_LAYER_CACHES      = 1<<2,  // Skip the strokes of layers with a valid cached render. Shift it when panning.
+    ClipFlags_DRAW_ITERATIVELY  = 1<<3,  // With LAYER_CACHES, spread full redraws over frames. See gpu_render_in_progress
 };
 void gpu_clip_strokes_and_update(Arena* arena,
                                  RenderBackend* renderer,
@@ -90,6 +119,13 @@ void gpu_clip_strokes_and_update(Arena* arena,
 
 void gpu_reset_render_flags(RenderBackend* renderer, int flags);
 
+// True when the last clip with ClipFlags_DRAW_ITERATIVELY left strokes for
+// the next frames. They need full redraws until it is done.
+b32 gpu_render_in_progress(RenderBackend* renderer);
+
+// True when the last clip included the working stroke.
+b32 gpu_working_stroke_clipped(RenderBackend* renderer);
+
 void gpu_render(RenderBackend* renderer,  i32 view_x, i32 view_y, i32 view_width, i32 view_height);
 void gpu_render_to_buffer(Milton* milton, u8* buffer, i32 scale, i32 x, i32 y, i32 w, i32 h, f32 background_alpha);
 
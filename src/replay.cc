@@ -0,0 +1,281 @@
+// Copyright (c) 2015 Sergio Gonzalez. All rights reserved.
+// License: https://github.com/serge-rgb/milton#license
+
+
+#include "replay.h"
+
+#include "milton.h"
+#include "persist.h"
+
+static b32
+replay_write(InputRecorder* rec, void* data, size_t size)
+{
+    if ( !rec->failed && fwrite(data, size, 1, rec->fd) != 1 ) {
+        rec->failed = true;
+    }
+    return !rec->failed;
+}
+
+static b32
+replay_read(InputReplay* replay, void* data, size_t size)
+{
+    return fread(data, size, 1, replay->fd) == 1;
+}
+
+b32
+replay_record_begin(InputRecorder* rec, const PATH_CHAR* path)
+{
+    *rec = {};
+    rec->fd = platform_fopen(path, TO_PATH_STR("wb"));
+    if ( !rec->fd ) {
+        return false;
+    }
+    rec->start = platform_get_walltime();
+    rec->start_ms = (u64)SDL_GetTicks();
+
+    u32 magic = REPLAY_MAGIC;
+    u32 version = REPLAY_VERSION;
+    replay_write(rec, &magic, sizeof(magic));
+    replay_write(rec, &version, sizeof(version));
+    replay_write(rec, &rec->start, sizeof(rec->start));
+    return !rec->failed;
+}
+
+void
+replay_record_frame(InputRecorder* rec, Milton* milton, MiltonInput const* input)
+{
+    TRACE_FUNCTION();
+    u64 ms = (u64)SDL_GetTicks() - rec->start_ms;
+    milton_clock_set(milton, rec->start, ms);
+
+    i32 mode = (i32)input->mode_to_set;
+    i64 pan[2] = { input->pan_delta.x, input->pan_delta.y };
+    v2i pointer = milton->platform ? milton->platform->pointer : v2i{};
+
+    replay_write(rec, &ms, sizeof(ms));
+    replay_write(rec, &milton->view->screen_size, sizeof(v2i));
+    replay_write(rec, &pointer, sizeof(pointer));
+    replay_write(rec, (void*)&input->flags, sizeof(i32));
+    replay_write(rec, &mode, sizeof(mode));
+    replay_write(rec, (void*)&input->click, sizeof(v2i));
+    replay_write(rec, (void*)&input->scale, sizeof(i32));
+    replay_write(rec, pan, sizeof(pan));
+    replay_write(rec, (void*)&input->input_count, sizeof(i32));
+    for ( i32 i = 0; i < input->input_count; ++i ) {
+        // Samples are in screen pixels.
+        i32 point[2] = { (i32)input->points[i].x, (i32)input->points[i].y };
+        replay_write(rec, point, sizeof(point));
+        replay_write(rec, &input->pressures[i], sizeof(f32));
+    }
+    rec->num_frames += 1;
+}
+
+b32
+replay_record_end(InputRecorder* rec)
+{
+    b32 ok = false;
+    if ( rec->fd ) {
+        ok = !rec->failed && !ferror(rec->fd);
+        if ( fclose(rec->fd) != 0 ) {
+            ok = false;
+        }
+        rec->fd = NULL;
+    }
+    return ok;
+}
+
+b32
+replay_open(InputReplay* replay, const PATH_CHAR* path, ReplaySpeed speed)
+{
+    *replay = {};
+    replay->speed = speed;
+    replay->fd = platform_fopen(path, TO_PATH_STR("rb"));
+    if ( !replay->fd ) {
+        return false;
+    }
+    u32 magic = 0;
+    u32 version = 0;
+    b32 ok = replay_read(replay, &magic, sizeof(magic)) &&
+             replay_read(replay, &version, sizeof(version)) &&
+             replay_read(replay, &replay->start, sizeof(replay->start)) &&
+             magic == REPLAY_MAGIC &&
+             version == REPLAY_VERSION;
+    if ( !ok ) {
+        fclose(replay->fd);
+        replay->fd = NULL;
+    }
+    return ok;
+}
+
+b32
+replay_begin_frame(InputReplay* replay, Milton* milton, MiltonInput* input)
+{
+    TRACE_FUNCTION();
+    if ( replay->frame_ms.count == 0 ) {
+        replay->playback_begin = perf_counter();
+        replay->bytes_written_begin = milton->persist->bytes_written;
+    }
+
+    u64 ms = 0;
+    if ( !replay_read(replay, &ms, sizeof(ms)) ) {
+        return false;  // End of the recording.
+    }
+
+    *input = {};
+    v2i screen_size = {};
+    v2i pointer = {};
+    i32 mode = 0;
+    i64 pan[2] = {};
+    b32 ok = replay_read(replay, &screen_size, sizeof(screen_size)) &&
+             replay_read(replay, &pointer, sizeof(pointer)) &&
+             replay_read(replay, &input->flags, sizeof(i32)) &&
+             replay_read(replay, &mode, sizeof(mode)) &&
+             replay_read(replay, &input->click, sizeof(v2i)) &&
+             replay_read(replay, &input->scale, sizeof(i32)) &&
+             replay_read(replay, pan, sizeof(pan)) &&
+             replay_read(replay, &input->input_count, sizeof(i32)) &&
+             input->input_count >= 0;
+
+    reset(&replay->points);
+    reset(&replay->pressures);
+    reset(&replay->times);
+    for ( i32 i = 0; ok && i < input->input_count; ++i ) {
+        i32 point[2] = {};
+        f32 pressure = 0.0f;
+        ok = replay_read(replay, point, sizeof(point)) &&
+             replay_read(replay, &pressure, sizeof(pressure));
+        push(&replay->points, v2l{ point[0], point[1] });
+        push(&replay->pressures, pressure);
+    }
+    if ( !ok ) {
+        replay->failed = true;
+        return false;
+    }
+
+    if ( replay->speed == ReplaySpeed_REALTIME ) {
+        u64 elapsed_ms = (u64)(perf_count_to_sec(perf_counter() - replay->playback_begin) * 1000.0f);
+        if ( ms > elapsed_ms ) {
+            SDL_Delay((u32)(ms - elapsed_ms));
+        }
+    }
+    replay->frame_begin = perf_counter();
+
+    // Latency is measured from when the sample is fed to the update.
+    for ( i32 i = 0; i < input->input_count; ++i ) {
+        push(&replay->times, replay->frame_begin);
+    }
+    input->mode_to_set = (MiltonMode)mode;
+    input->pan_delta = { pan[0], pan[1] };
+    input->points = replay->points.data;
+    input->pressures = replay->pressures.data;
+    input->times = replay->times.data;
+
+    // The update reads the hover position from the platform.
+    if ( !milton->platform ) {
+        milton->platform = &replay->platform;
+    }
+    milton->platform->pointer = pointer;
+
+    milton_clock_set(milton, replay->start, ms);
+    if (    input->pan_delta.x != 0
+         || input->pan_delta.y != 0
+         || !(screen_size == milton->view->screen_size) ) {
+        milton_resize_and_pan(milton, input->pan_delta, screen_size);
+    }
+    return true;
+}
+
+void
+replay_end_frame(InputReplay* replay)
+{
+    push(&replay->frame_ms, perf_count_to_sec(perf_counter() - replay->frame_begin) * 1000.0f);
+}
+
+static int
+compare_frame_ms(const void* a, const void* b)
+{
+    f32 fa = *(f32*)a;
+    f32 fb = *(f32*)b;
+    return (fa > fb) - (fa < fb);
+}
+
+void
+replay_report(InputReplay* replay, Milton* milton, ReplayReport* report)
+{
+    *report = {};
+    i64 n = replay->frame_ms.count;
+    report->num_frames = n;
+    if ( n > 0 ) {
+        f32* sorted = (f32*)mlt_calloc((size_t)n, sizeof(f32), "Replay");
+        for ( i64 i = 0; i < n; ++i ) {
+            sorted[i] = replay->frame_ms[i];
+            report->total_ms += sorted[i];
+        }
+        qsort(sorted, (size_t)n, sizeof(f32), compare_frame_ms);
+        // Nearest rank.
+        report->p50_ms = sorted[max((50 * n + 99) / 100, (i64)1) - 1];
+        report->p95_ms = sorted[max((95 * n + 99) / 100, (i64)1) - 1];
+        report->max_ms = sorted[n - 1];
+        mlt_free(sorted, "Replay");
+    }
+
+#if MILTON_SAVE_ASYNC
+    SDL_LockMutex(milton->save_mutex);
+#endif
+    report->bytes_written = milton->persist->bytes_written - replay->bytes_written_begin;
+#if MILTON_SAVE_ASYNC
+    SDL_UnlockMutex(milton->save_mutex);
+#endif
+
+    report->peak_memory = platform_peak_memory_bytes();
+    report->num_strokes = layer::count_strokes(milton->canvas->root_layer);
+}
+
+void
+replay_log_report(ReplayReport* r)
+{
+    milton_log("Replayed %" PRIi64 " frames in %.2f ms. Frame time p50 %.3f ms, p95 %.3f ms, max %.3f ms.\n",
+               r->num_frames, r->total_ms, r->p50_ms, r->p95_ms, r->max_ms);
+    milton_log("Saves wrote %" PRIu64 " bytes. Peak memory %" PRIu64 " KB. %" PRIi64 " strokes.\n",
+               r->bytes_written, r->peak_memory / 1024, r->num_strokes);
+}
+
+void
+replay_close(InputReplay* replay)
+{
+    if ( replay->fd ) {
+        fclose(replay->fd);
+        replay->fd = NULL;
+    }
+    release(&replay->points);
+    release(&replay->pressures);
+    release(&replay->times);
+    release(&replay->frame_ms);
+}
+
+b32
+replay_run(Milton* milton, const PATH_CHAR* path, ReplaySpeed speed, ReplayReport* report)
+{
+    TRACE_FUNCTION();
+    InputReplay replay = {};
+    if ( !replay_open(&replay, path, speed) ) {
+        return false;
+    }
+    // Saves are part of the frame time, and write the same bytes every time.
+    u32 sync_saves = milton->flags & MiltonStateFlags_SYNC_SAVES;
+    milton->flags |= MiltonStateFlags_SYNC_SAVES;
+
+    MiltonInput input = {};
+    while ( replay_begin_frame(&replay, milton, &input) ) {
+        milton_update_and_render(milton, &input);
+        replay_end_frame(&replay);
+    }
+    milton->flags = (milton->flags & ~MiltonStateFlags_SYNC_SAVES) | sync_saves;
+    b32 ok = !replay.failed;
+    replay_report(&replay, milton, report);
+    replay_close(&replay);
+    if ( milton->platform == &replay.platform ) {
+        milton->platform = NULL;
+    }
+    return ok;
+}
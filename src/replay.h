@@ -0,0 +1,105 @@
+// Copyright (c) 2015 Sergio Gonzalez. All rights reserved.
+// License: https://github.com/serge-rgb/milton#license
+
+// Replay
+//
+// Records the MiltonInput of every frame to a file, with the frame's time and
+// screen size, and plays it back through milton_update_and_render. Both sides
+// set milton->clock to the frame time, so a replay sees the same times as the
+// session did. See MiltonClock
+//
+// Replays start from whatever canvas is open, so benchmarks should start from
+// a copy of the canvas the session started with. Changes that the GUI makes
+// to Milton directly, instead of through MiltonInput, are not recorded.
+//
+// Besides MiltonInput, the update reads the pointer position from
+// PlatformState, so that is recorded too.
+//
+// File: header, then frames until the end of the file. Native byte order.
+//   u32 magic, u32 version, WallTime start
+//   Frame: u64 ms, i32 width, i32 height, i32 pointer x y, i32 flags, i32 mode_to_set,
+//          i32 click x y, i32 scale, i64 pan_delta x y, i32 input_count,
+//          then input_count times: i32 x, i32 y, f32 pressure
+
+
+#pragma once
+
+#include "common.h"
+#include "DArray.h"
+#include "platform.h"
+
+#define REPLAY_MAGIC    0x52544C4D  // "MLTR"
+#define REPLAY_VERSION  1
+
+struct Milton;
+struct MiltonInput;
+
+struct InputRecorder
+{
+    FILE*       fd;
+    WallTime    start;
+    u64         start_ms;  // SDL_GetTicks() when recording started.
+    i64         num_frames;
+    b32         failed;
+};
+
+enum ReplaySpeed
+{
+    ReplaySpeed_FULL,      // Frames back to back.
+    ReplaySpeed_REALTIME,  // Each frame waits for its time in the recording.
+};
+
+struct InputReplay
+{
+    FILE*       fd;
+    ReplaySpeed speed;
+    WallTime    start;
+    b32         failed;  // The file ended in the middle of a frame.
+
+    PlatformState platform;  // For milton->platform when there is none, as in headless replays.
+
+    u64         playback_begin;  // perf_counter()
+    u64         frame_begin;
+
+    // Samples of the current frame.
+    DArray<v2l> points;
+    DArray<f32> pressures;
+    DArray<u64> times;
+
+    DArray<f32> frame_ms;
+    u64         bytes_written_begin;  // MiltonPersist::bytes_written
+};
+
+struct ReplayReport
+{
+    i64 num_frames;
+    f32 total_ms;
+    f32 p50_ms;
+    f32 p95_ms;
+    f32 max_ms;
+    u64 bytes_written;    // By saves during the replay.
+    u64 peak_memory;      // Of the whole process.
+    i64 num_strokes;      // In the canvas at the end.
+};
+
+// Starts writing to `path`. Returns false if it can't be created.
+b32     replay_record_begin(InputRecorder* rec, const PATH_CHAR* path);
+// Call right before milton_update_and_render. Sets the clock to the frame time.
+void    replay_record_frame(InputRecorder* rec, Milton* milton, MiltonInput const* input);
+// Returns false if some write failed.
+b32     replay_record_end(InputRecorder* rec);
+
+b32     replay_open(InputReplay* replay, const PATH_CHAR* path, ReplaySpeed speed);
+// Reads the next frame into `input`, which points into `replay` until the next
+// call. Sets the clock and applies the frame's resize and pan, like the
+// platform layer would. Returns false at the end of the recording.
+b32     replay_begin_frame(InputReplay* replay, Milton* milton, MiltonInput* input);
+// Call after the frame is done.
+void    replay_end_frame(InputReplay* replay);
+void    replay_report(InputReplay* replay, Milton* milton, ReplayReport* report);
+void    replay_log_report(ReplayReport* report);
+void    replay_close(InputReplay* replay);
+
+// Plays a whole recording, saving on this thread. Works headless, with
+// MiltonInit_FOR_TEST.
+b32     replay_run(Milton* milton, const PATH_CHAR* path, ReplaySpeed speed, ReplayReport* report);
@@ -9,8 +9,10 @@
 #include "milton.h"
 #include "gl_helpers.h"
 #include "gui.h"
+#include "jobs.h"
 #include "persist.h"
 #include "bindings.h"
+#include "replay.h"
 
 
 static void
@@ -51,6 +53,28 @@ get_current_keyboard_layout()
     return layout;
 }
 
+#if MILTON_ENABLE_TRACING
+// Ctrl+Shift+F12 starts a capture, and again writes it next to the settings.
+static void
+trace_toggle_capture()
+{
+    if ( !trace_is_capturing() ) {
+        milton_log("Capturing trace...\n");
+        trace_capture_start();
+    }
+    else {
+        PATH_CHAR fname[MAX_PATH] = TO_PATH_STR("milton_trace.json");
+        platform_fname_at_config(fname, MAX_PATH);
+        if ( trace_capture_stop(fname) ) {
+            milton_log("Wrote trace to %s\n", fname);
+        }
+        else {
+            milton_log("Could not write trace to %s\n", fname);
+        }
+    }
+}
+#endif
+
 void
 shortcut_handle_key(Milton* milton, PlatformState* platform, SDL_Event* event, MiltonInput* input, b32 is_keyup)
 {
@@ -152,6 +176,12 @@ shortcut_handle_key(Milton* milton, PlatformState* platform, SDL_Event* event, M
         }
         // keydown
         else  {
+#if MILTON_ENABLE_TRACING
+            if ( k == SDLK_F12 && !event->key.repeat
+                 && active_modifiers == (Modifier_CTRL | Modifier_SHIFT) ) {
+                trace_toggle_capture();
+            }
+#endif
             for (sz i = 0; i < Action_COUNT; ++i) {
                 Binding* b = &bindings->bindings[i];
 
@@ -214,9 +244,59 @@ panning_update(PlatformState* platform)
     }
 }
 
+b32
+input_ring_push(InputRing* ring, InputSample sample)
+{
+    b32 pushed = false;
+    int head = SDL_AtomicGet(&ring->head);
+    if ( head - SDL_AtomicGet(&ring->tail) < INPUT_RING_SIZE ) {
+        ring->samples[head & (INPUT_RING_SIZE - 1)] = sample;
+        // The sample is written before the consumer sees it.
+        SDL_MemoryBarrierRelease();
+        SDL_AtomicSet(&ring->head, head + 1);
+        pushed = true;
+    }
+    else {
+        SDL_AtomicAdd(&ring->dropped, 1);
+    }
+    return pushed;
+}
+
+i64
+input_ring_pop(InputRing* ring, InputSample* out, i64 max_count)
+{
+    int tail = SDL_AtomicGet(&ring->tail);
+    int head = SDL_AtomicGet(&ring->head);
+    i64 count = min((i64)(head - tail), max_count);
+    SDL_MemoryBarrierAcquire();
+    for ( i64 i = 0; i < count; ++i ) {
+        out[i] = ring->samples[(tail + i) & (INPUT_RING_SIZE - 1)];
+    }
+    // The samples are read before the producer can reuse their slots.
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&ring->tail, tail + (int)count);
+    return count;
+}
+
+// `event_ticks` is the SDL timestamp of the event, so that the time the
+// event spent in the queue counts as latency.
+static void
+push_input_sample(PlatformState* platform, v2l point, f32 pressure, u32 event_ticks)
+{
+    u64 time = perf_counter();
+    u32 age_ms = SDL_GetTicks() - event_ticks;
+    if ( age_ms < 1000 ) {
+        static f32 counts_per_ms = (f32)(1<<20) / (perf_count_to_sec(1<<20) * 1000.0f);
+        time -= min((u64)(age_ms * counts_per_ms), time);
+    }
+    InputSample sample = { point, pressure, time };
+    input_ring_push(platform->input_ring, sample);
+}
+
 MiltonInput
 sdl_event_loop(Milton* milton, PlatformState* platform)
 {
+    TRACE_FUNCTION();
     MiltonInput milton_input = {};
     milton_input.mode_to_set = MiltonMode::MODE_COUNT;
 
@@ -224,8 +304,6 @@ sdl_event_loop(Milton* milton, PlatformState* platform)
 
     v2i input_point = {};
 
-    platform->num_pressure_results = 0;
-    platform->num_point_results = 0;
     platform->keyboard_layout = get_current_keyboard_layout();
 
     SDL_Event event;
@@ -280,12 +358,7 @@ sdl_event_loop(Milton* milton, PlatformState* platform)
                             platform_point_to_pixel(platform, &point);
 
                             if ( point.x >= 0 && point.y >= 0 ) {
-                                if ( platform->num_point_results < MAX_INPUT_BUFFER_ELEMS ) {
-                                    milton_input.points[platform->num_point_results++] = point;
-                                }
-                                if ( platform->num_pressure_results < MAX_INPUT_BUFFER_ELEMS ) {
-                                    milton_input.pressures[platform->num_pressure_results++] = EasyTab->Pressure[pi];
-                                }
+                                push_input_sample(platform, point, EasyTab->Pressure[pi], event.common.timestamp);
                             }
                         }
                     }
@@ -336,12 +409,7 @@ sdl_event_loop(Milton* milton, PlatformState* platform)
                             platform->pointer = point;
                             platform->is_middle_button_down = (event.button.button == SDL_BUTTON_MIDDLE);
 
-                            if ( platform->num_point_results < MAX_INPUT_BUFFER_ELEMS ) {
-                                milton_input.points[platform->num_point_results++] = VEC2L(point);
-                            }
-                            if ( platform->num_pressure_results < MAX_INPUT_BUFFER_ELEMS ) {
-                                milton_input.pressures[platform->num_pressure_results++] = NO_PRESSURE_INFO;
-                            }
+                            push_input_sample(platform, VEC2L(point), NO_PRESSURE_INFO, event.common.timestamp);
                         }
                     }
                 }
@@ -384,12 +452,7 @@ sdl_event_loop(Milton* milton, PlatformState* platform)
                     if (platform->is_pointer_down) {
                         if (!platform->is_panning &&
                             (input_point.x >= 0 && input_point.y >= 0)) {
-                            if (platform->num_point_results < MAX_INPUT_BUFFER_ELEMS) {
-                                milton_input.points[platform->num_point_results++] = VEC2L(input_point);
-                            }
-                            if (platform->num_pressure_results < MAX_INPUT_BUFFER_ELEMS) {
-                                milton_input.pressures[platform->num_pressure_results++] = NO_PRESSURE_INFO;
-                            }
+                            push_input_sample(platform, VEC2L(input_point), NO_PRESSURE_INFO, event.common.timestamp);
                         }
                     }
                 }
@@ -433,8 +496,7 @@ sdl_event_loop(Milton* milton, PlatformState* platform)
                 switch ( event.window.event ) {
                     // Just handle every event that changes the window size.
                 case SDL_WINDOWEVENT_MOVED:
-                    platform->num_point_results = 0;
-                    platform->num_pressure_results = 0;
+                    platform->drop_samples = true;
                     platform->is_pointer_down = false;
                     break;
                 case SDL_WINDOWEVENT_RESIZED:
@@ -483,20 +545,11 @@ sdl_event_loop(Milton* milton, PlatformState* platform)
     }  // ---- End of SDL event loop
 
     if ( pointer_up ) {
-        // Add final point
+        // The samples up to here end the stroke.
         if ( !platform->is_panning && platform->is_pointer_down ) {
             milton_input.flags |= MiltonInputFlags_END_STROKE;
-            input_point = { event.button.x, event.button.y };
-
-            platform_point_to_pixel_i(platform, &input_point);
-
-            if ( platform->num_point_results < MAX_INPUT_BUFFER_ELEMS ) {
-                milton_input.points[platform->num_point_results++] = VEC2L(input_point);
-            }
         }
         platform->is_pointer_down = false;
-
-        platform->num_point_results = 0;
     }
 
     return milton_input;
@@ -505,7 +558,7 @@ sdl_event_loop(Milton* milton, PlatformState* platform)
 // ---- milton_main
 
 int
-milton_main(bool is_fullscreen, char* file_to_open)
+milton_main(bool is_fullscreen, char* file_to_open, MiltonStartupFlags startup_flags)
 {
     {
         static char* release_string
@@ -523,7 +576,18 @@ milton_main(bool is_fullscreen, char* file_to_open)
     SDL_Init(SDL_INIT_VIDEO);
     milton_log("Done.\n");
 
+    jobs_init(-1);
+#if MILTON_ENABLE_TRACING
+    trace_set_thread_name("Main");
+#endif
+
     PlatformState platform = {};
+    platform.input_ring = (InputRing*)mlt_calloc(1, sizeof(InputRing), "Input");
+
+    // Samples of the current frame, taken from the input ring.
+    DArray<v2l> input_points = {};
+    DArray<f32> input_pressures = {};
+    DArray<u64> input_times = {};
 
     PlatformSettings prefs = {};
 
@@ -758,6 +822,30 @@ milton_main(bool is_fullscreen, char* file_to_open)
         cursor_set_and_show(platform.cursor_default);
     }
 
+    // Input recording. See replay.h
+    HistoryDebug history_debug = startup_flags.history_debug;
+    InputRecorder recorder = {};
+    InputReplay replay = {};
+    if ( history_debug != HistoryDebug_NOTHING ) {
+        PATH_CHAR history_path[MAX_PATH] = {};
+        str_to_path_char(startup_flags.history_file, history_path, sizeof(history_path));
+        b32 ok = false;
+        if ( history_debug == HistoryDebug_RECORD ) {
+            ok = replay_record_begin(&recorder, history_path);
+        }
+        else {
+            ok = replay_open(&replay, history_path,
+                             startup_flags.replay_realtime ? ReplaySpeed_REALTIME : ReplaySpeed_FULL);
+            if ( ok && !startup_flags.replay_realtime ) {
+                SDL_GL_SetSwapInterval(0);
+            }
+        }
+        if ( !ok ) {
+            milton_log("Could not open input recording %s\n", startup_flags.history_file);
+            history_debug = HistoryDebug_NOTHING;
+        }
+    }
+
     // ---- Main loop ----
 
     while ( !platform.should_quit ) {
@@ -891,7 +979,7 @@ milton_main(bool is_fullscreen, char* file_to_open)
 
         // Clear our pointer input because we captured an ImGui widget!
         if ( ImGui::GetIO().WantCaptureMouse ) {
-            platform.num_point_results = 0;
+            platform.drop_samples = true;
             platform.is_pointer_down = false;
             input_flags |= MiltonInputFlags_IMGUI_GRABBED_INPUT;
         }
@@ -904,28 +992,44 @@ milton_main(bool is_fullscreen, char* file_to_open)
         }
         else if ( platform.is_panning ) {
             input_flags |= MiltonInputFlags_PANNING;
-            platform.num_point_results = 0;
+            platform.drop_samples = true;
         }
         else if ( platform.was_panning ) {
             // Just finished panning. Refresh the screen.
             input_flags |= MiltonInputFlags_FULL_REFRESH;
         }
 
-        if ( platform.num_pressure_results < platform.num_point_results ) {
-            platform.num_point_results = platform.num_pressure_results;
-        }
-
         milton_input.flags = (MiltonInputFlags)( input_flags | (int)milton_input.flags );
 
-        mlt_assert (platform.num_point_results <= platform.num_pressure_results);
-
-        milton_input.input_count = platform.num_point_results;
+        // Take every sample since the last frame.
+        reset(&input_points);
+        reset(&input_pressures);
+        reset(&input_times);
+        {
+            InputSample samples[256];
+            for ( i64 n = input_ring_pop(platform.input_ring, samples, array_count(samples));
+                  n > 0;
+                  n = input_ring_pop(platform.input_ring, samples, array_count(samples)) ) {
+                for ( i64 i = 0; i < n && !platform.drop_samples; ++i ) {
+                    push(&input_points, samples[i].point);
+                    push(&input_pressures, samples[i].pressure);
+                    push(&input_times, samples[i].time);
+                }
+            }
+            platform.drop_samples = false;
+        }
+        milton_input.points = input_points.data;
+        milton_input.pressures = input_pressures.data;
+        milton_input.times = input_times.data;
+        milton_input.input_count = (i32)input_points.count;
 
         v2l pan_delta = platform.pan_point - platform.pan_start;
-        if (    pan_delta.x != 0
-             || pan_delta.y != 0
-             || platform.width != milton->view->screen_size.x
-             || platform.height != milton->view->screen_size.y ) {
+        // Replays resize and pan to what was recorded.
+        if (    history_debug != HistoryDebug_REPLAY
+             && (    pan_delta.x != 0
+                  || pan_delta.y != 0
+                  || platform.width != milton->view->screen_size.x
+                  || platform.height != milton->view->screen_size.y ) ) {
             milton_resize_and_pan(milton, pan_delta, {platform.width, platform.height});
         }
         milton_input.pan_delta = pan_delta;
@@ -936,11 +1040,33 @@ milton_main(bool is_fullscreen, char* file_to_open)
         // ==== Update and render
         PROFILE_GRAPH_END(polling);
         PROFILE_GRAPH_BEGIN(GL);
+        jobs_main_run();  // Work that other threads left for the main thread.
+        if ( history_debug == HistoryDebug_RECORD ) {
+            replay_record_frame(&recorder, milton, &milton_input);
+        }
+        else if ( history_debug == HistoryDebug_REPLAY ) {
+            platform.force_next_frame = true;
+            if ( !replay_begin_frame(&replay, milton, &milton_input) ) {
+                ReplayReport report = {};
+                replay_report(&replay, milton, &report);
+                replay_log_report(&report);
+                if ( replay.failed ) {
+                    milton_log("The input recording ends in the middle of a frame.\n");
+                }
+                replay_close(&replay);
+                history_debug = HistoryDebug_NOTHING;
+                milton_try_quit(milton);
+            }
+        }
         milton_update_and_render(milton, &milton_input);
         if ( !(milton->flags & MiltonStateFlags_RUNNING) ) {
             platform.should_quit = true;
         }
+        if ( milton->render_settings.render_in_progress ) {
+            platform.force_next_frame = true;
+        }
         {
+            TRACE_ZONE("imgui_render");
             ImGuiIO& io = ImGui::GetIO(); (void)io;
             ImGui::Render();
             SDL_GL_MakeCurrent(window, gl_context);
@@ -950,7 +1076,14 @@ milton_main(bool is_fullscreen, char* file_to_open)
         }
         PROFILE_GRAPH_END(GL);
         PROFILE_GRAPH_BEGIN(system);
-        SDL_GL_SwapWindow(window);
+        {
+            TRACE_ZONE("SDL_GL_SwapWindow");
+            SDL_GL_SwapWindow(window);
+        }
+        latency_presented(milton->latency, perf_counter());
+        if ( history_debug == HistoryDebug_REPLAY ) {
+            replay_end_frame(&replay);
+        }
 
         platform_event_tick();
 
@@ -958,7 +1091,7 @@ milton_main(bool is_fullscreen, char* file_to_open)
         u64 frame_time_us = perf_counter() - frame_start_us;
 
         f32 expected_us = (f32)1000000 / display_hz;
-        if ( frame_time_us < expected_us ) {
+        if ( frame_time_us < expected_us && history_debug != HistoryDebug_REPLAY ) {
             f32 to_sleep_us = expected_us - frame_time_us;
             //  milton_log("Sleeping at least %d ms\n", (u32)(to_sleep_us/1000));
             SDL_Delay((u32)(to_sleep_us/1000));
@@ -975,8 +1108,36 @@ milton_main(bool is_fullscreen, char* file_to_open)
         }
     }
 
+    if ( history_debug == HistoryDebug_RECORD ) {
+        if ( replay_record_end(&recorder) ) {
+            milton_log("Recorded %" PRIi64 " frames to %s\n", recorder.num_frames, startup_flags.history_file);
+        }
+        else {
+            milton_log("Could not write the input recording %s\n", startup_flags.history_file);
+        }
+    }
+    else if ( history_debug == HistoryDebug_REPLAY ) {
+        replay_close(&replay);  // Quit before the end.
+    }
+
     platform_deinit(&platform);
+    jobs_release();
+#if MILTON_ENABLE_TRACING
+    if ( trace_is_capturing() ) {
+        trace_toggle_capture();
+    }
+    trace_release();
+#endif
+
+    release(&input_points);
+    release(&input_pressures);
+    release(&input_times);
+    if ( SDL_AtomicGet(&platform.input_ring->dropped) > 0 ) {
+        milton_log("Dropped %d input samples.\n", SDL_AtomicGet(&platform.input_ring->dropped));
+    }
+    mlt_free(platform.input_ring, "Input");
 
+    latency_release(milton->latency);
     arena_free(&milton->root_arena);
 
     // Save preferences.
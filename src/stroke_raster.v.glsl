@@ -1,12 +1,21 @@
 // Copyright (c) 2015 Sergio Gonzalez. All rights reserved.
 // License: https://github.com/serge-rgb/milton#license
 
-in vec3 a_position;
-in vec3 a_pointa;
-in vec3 a_pointb;
+// One segment per instance. The vertices of the instance are the corners of
+// a box around the segment.
+in vec2 a_corner;  // (-1,-1), (1,-1), (-1,1) or (1,1)
+
+in vec2 a_pointa;
+in vec2 a_pointb;
+in vec2 a_pressure;  // At a and at b.
+in vec4 a_color;
+in float a_radius;
+in float a_depth;
 
 out vec3 v_pointa;
 out vec3 v_pointb;
+out vec4 v_color;
+out float v_radius;
 
 #if STROKE_DEBUG_VIZ
 in vec3 a_debug_color;
@@ -19,15 +28,28 @@ out vec3 v_debug_color;
 void
 main()
 {
-    v_pointa = a_pointa;
-    v_pointb = a_pointb;
+    v_pointa = vec3(a_pointa, a_pressure.x);
+    v_pointb = vec3(a_pointb, a_pressure.y);
+    v_color = a_color;
+    v_radius = a_radius;
 
 #if STROKE_DEBUG_VIZ
     v_debug_color = a_debug_color;
 #endif
-    gl_Position.xy = canvas_to_raster_gl(a_position.xy);
+
+    // Box aligned with the segment, enlarged by the largest radius.
+    float rad = a_radius * max(a_pressure.x, a_pressure.y);
+    vec2 ab = a_pointb - a_pointa;
+    vec2 d = vec2(1.0, 0.0);
+    if ( length(ab) > 0.0 ) {
+        d = normalize(ab);
+    }
+    vec2 n = vec2(-d.y, d.x);
+    vec2 position = (a_corner.x < 0.0) ? a_pointa - d*rad : a_pointb + d*rad;
+    position += n * (rad * a_corner.y);
+
+    gl_Position.xy = canvas_to_raster_gl(position);
     gl_Position.w = 1;
 
-    gl_Position.z = a_position.z / MAX_DEPTH_VALUE;
+    gl_Position.z = a_depth / MAX_DEPTH_VALUE;
 }
-
@@ -69,11 +69,758 @@ test_save_load()
 
     EXPECT_TRUE( COMPARE_BYTES_COUNT(milton.brushes, loaded_milton.brushes, BrushEnum_COUNT) );
     EXPECT_TRUE( COMPARE_BYTES_COUNT(milton.brush_sizes, loaded_milton.brush_sizes, BrushEnum_COUNT) );
+
+    // The save threads point at these.
+    milton_kill_save_thread(&milton);
+    milton_kill_save_thread(&loaded_milton);
+}
+
+void
+test_stroke_index()
+{
+    Arena arena = arena_init();
+
+    StrokeIndex index = {};
+    index.arena = &arena;
+
+    Stroke strokes[4] = {};
+    strokes[0].bounding_rect = rect_from_xywh(0, 0, 10, 10);
+    strokes[1].bounding_rect = rect_from_xywh(100000, 100000, 10, 10);
+    strokes[2].bounding_rect = rect_from_xywh(-50000, -50000, 100000, 100000);  // Big stroke over the origin.
+    strokes[3].bounding_rect = rect_from_xywh(5, 5, 10, 10);
+
+    for ( i64 i = 0; i < 4; ++i ) {
+        stroke_index_insert(&index, &strokes[i], i);
+    }
+
+    DArray<StrokeIndexEntry*> result = {};
+
+    stroke_index_query(&index, rect_from_xywh(0, 0, 20, 20), &result);
+    EXPECT_TRUE( result.count == 3 );
+    EXPECT_TRUE( result.count == 3 && result.data[0]->stroke == &strokes[0]
+                                   && result.data[1]->stroke == &strokes[2]
+                                   && result.data[2]->stroke == &strokes[3] );
+
+    stroke_index_query(&index, rect_from_xywh(99990, 99990, 20, 20), &result);
+    EXPECT_TRUE( result.count == 1 && result.data[0]->stroke == &strokes[1] );
+
+    stroke_index_pop(&index, &strokes[3], 3);
+    stroke_index_pop(&index, &strokes[2], 2);
+    stroke_index_query(&index, rect_from_xywh(0, 0, 20, 20), &result);
+    EXPECT_TRUE( result.count == 1 && result.data[0]->stroke == &strokes[0] );
+
+    release(&result);
+    arena_free(&arena);
+}
+
+void
+test_journal_replay()
+{
+    Milton milton = {};
+
+    PATH_CHAR* path = TO_PATH_STR("TEST_journal.mlt");
+
+    milton_init(&milton, 0, 0, 1, path, MiltonInit_FOR_TEST);
+    milton_reset_canvas_and_set_default(&milton);
+    milton.persist->mlt_file_path = path;
+    milton_save(&milton);
+
+    // Add two strokes and undo one, through the journal only.
+    v2l points[2] = { {0, 0}, {100, 100} };
+    f32 pressures[2] = { 1.0f, 1.0f };
+
+    Layer* l = milton.canvas->working_layer;
+
+    Stroke stroke = {};
+    stroke.brush = default_brush();
+    stroke.points = points;
+    stroke.pressures = pressures;
+    stroke.num_points = 2;
+    stroke.layer_id = l->id;
+
+    JournalRecord records[] = {
+        { JournalRecord_STROKE_ADD, l->id, 0, stroke },
+        { JournalRecord_STROKE_ADD, l->id, 1, stroke },
+        { JournalRecord_STROKE_POP, l->id, 1 },
+    };
+    milton_journal_append(&milton, records, array_count(records));
+
+    Milton loaded_milton = {};
+
+    milton_init(&loaded_milton, 0, 0, 1, path, MiltonInit_FOR_TEST);
+    milton_load(&loaded_milton);
+
+    EXPECT_TRUE( layer::count_strokes(loaded_milton.canvas->root_layer) == 1 );
+    EXPECT_TRUE( loaded_milton.canvas->history.count == 1 );
+    EXPECT_TRUE( loaded_milton.persist->snapshot_id == milton.persist->snapshot_id );
+
+    milton_kill_save_thread(&milton);
+    milton_kill_save_thread(&loaded_milton);
+}
+
+void
+test_save_load_sections()
+{
+    Milton milton = {};
+
+    PATH_CHAR* path = TO_PATH_STR("TEST_sections.mlt");
+
+    milton_init(&milton, 0, 0, 1, path, MiltonInit_FOR_TEST);
+    milton_reset_canvas_and_set_default(&milton);
+    milton.persist->mlt_file_path = path;
+
+    // Enough strokes for more than one block, and a second layer.
+    v2l points[2] = { {0, 0}, {100, 100} };
+    f32 pressures[2] = { 1.0f, 0.5f };
+
+    const i32 num_strokes = MLT_STROKES_PER_BLOCK + 3;
+    for ( i32 i = 0; i < num_strokes; ++i ) {
+        Stroke stroke = {};
+        stroke.brush = default_brush();
+        stroke.points = points;
+        stroke.pressures = pressures;
+        stroke.num_points = 2;
+        stroke.layer_id = milton.canvas->working_layer->id;
+        stroke.bounding_rect = bounding_box_for_stroke(&stroke);
+        layer::layer_push_stroke(milton.canvas->working_layer, stroke);
+    }
+    milton_new_layer(&milton);
+    milton_save(&milton);
+
+    Milton loaded_milton = {};
+
+    milton_init(&loaded_milton, 0, 0, 1, path, MiltonInit_FOR_TEST);
+    milton_load(&loaded_milton);
+
+    Layer* root = loaded_milton.canvas->root_layer;
+    EXPECT_TRUE( layer::number_of_layers(root) == 2 );
+    EXPECT_TRUE( root->strokes.count == num_strokes );
+    EXPECT_TRUE( get(&root->strokes, num_strokes - 1)->pressures[1] == 0.5f );
+#if !defined(_WIN32)
+    // Point data is used in place.
+    PlatformFileMapping* mapped = &loaded_milton.canvas->mapped_file;
+    u8* first_points = (u8*)get(&root->strokes, 0)->points;
+    EXPECT_TRUE( first_points >= mapped->data && first_points < mapped->data + mapped->size );
+    EXPECT_TRUE( ((u64)first_points & 7) == 0 );
+#endif
+    EXPECT_TRUE( loaded_milton.view->working_layer_id == milton.view->working_layer_id );
+    EXPECT_TRUE( loaded_milton.canvas->layer_guid == milton.canvas->layer_guid );
+
+    milton_kill_save_thread(&milton);
+    milton_kill_save_thread(&loaded_milton);
+}
+
+static b32
+test_read_section_table(PATH_CHAR* path, DArray<MltSection>* table)
+{
+    b32 ok = false;
+    FILE* fd = platform_fopen(path, TO_PATH_STR("rb"));
+    if ( fd ) {
+        u32 magic = 0;
+        u32 version = 0;
+        ok = fread_checked(&magic, sizeof(magic), 1, fd) &&
+             fread_checked(&version, sizeof(version), 1, fd) &&
+             read_section_table(fd, table);
+        fclose(fd);
+    }
+    return ok;
+}
+
+void
+test_save_load_packed()
+{
+    Milton milton = {};
+
+    PATH_CHAR* path = TO_PATH_STR("TEST_packed.mlt");
+
+    milton_init(&milton, 0, 0, 1, path, MiltonInit_FOR_TEST);
+    milton_reset_canvas_and_set_default(&milton);
+    milton.persist->mlt_file_path = path;
+    milton.settings->compress_canvas = true;
+
+    v2l points[4] = { {-5, 7}, {1LL << 40, -(1LL << 40)}, {3, 3}, {4, -2} };
+    f32 pressures[4] = { 0.0f, 0.25f, 1.0f, 0.5f };
+
+    Stroke stroke = {};
+    stroke.brush = default_brush();
+    stroke.points = points;
+    stroke.pressures = pressures;
+    stroke.num_points = array_count(points);
+    stroke.layer_id = milton.canvas->working_layer->id;
+    stroke.bounding_rect = bounding_box_for_stroke(&stroke);
+    for ( i32 i = 0; i < MLT_STROKES_PER_BLOCK; ++i ) {
+        layer::layer_push_stroke(milton.canvas->working_layer, stroke);
+    }
+    // Away from the origin, in a block of its own.
+    v2l far_points[4] = {};
+    for ( i32 i = 0; i < array_count(points); ++i ) {
+        far_points[i] = points[i] + v2l{ 100, 1LL << 41 };
+    }
+    Stroke far_stroke = stroke;
+    far_stroke.points = far_points;
+    far_stroke.bounding_rect = bounding_box_for_stroke(&far_stroke);
+    layer::layer_push_stroke(milton.canvas->working_layer, far_stroke);
+
+    PATH_CHAR* unpacked_path = TO_PATH_STR("TEST_unpacked.mlt");
+    milton.settings->compress_canvas = false;
+    milton.persist->mlt_file_path = unpacked_path;
+    milton_save(&milton);
+    milton.settings->compress_canvas = true;
+    milton.persist->mlt_file_path = path;
+    milton_save(&milton);
+
+    // Packed and unpacked blocks have the same bounds, and so do their layers.
+    DArray<MltSection> packed_table = {};
+    DArray<MltSection> unpacked_table = {};
+    EXPECT_TRUE( test_read_section_table(path, &packed_table) );
+    EXPECT_TRUE( test_read_section_table(unpacked_path, &unpacked_table) );
+    EXPECT_TRUE( packed_table.count == unpacked_table.count );
+    for ( i64 i = 0; i < min(packed_table.count, unpacked_table.count); ++i ) {
+        EXPECT_TRUE( packed_table[i].num_points == unpacked_table[i].num_points );
+        EXPECT_TRUE( COMPARE_BYTES(&packed_table[i].bounds, &unpacked_table[i].bounds) );
+    }
+    if ( packed_table.count > 0 ) {
+        EXPECT_TRUE( COMPARE_BYTES(&packed_table[packed_table.count - 1].bounds, &far_stroke.bounding_rect) );
+    }
+    release(&packed_table);
+    release(&unpacked_table);
+
+    Milton loaded_milton = {};
+
+    milton_init(&loaded_milton, 0, 0, 1, path, MiltonInit_FOR_TEST);
+    milton_load(&loaded_milton);
+
+    Layer* root = loaded_milton.canvas->root_layer;
+    EXPECT_TRUE( root->strokes.count == MLT_STROKES_PER_BLOCK + 1 );
+    Stroke* loaded = get(&root->strokes, MLT_STROKES_PER_BLOCK - 1);
+    EXPECT_TRUE( loaded->num_points == stroke.num_points );
+    EXPECT_TRUE( COMPARE_BYTES_COUNT(loaded->points, points, array_count(points)) );
+    EXPECT_TRUE( COMPARE_BYTES_COUNT(loaded->pressures, pressures, array_count(pressures)) );
+    loaded = get(&root->strokes, MLT_STROKES_PER_BLOCK);
+    EXPECT_TRUE( loaded->num_points == far_stroke.num_points );
+    EXPECT_TRUE( COMPARE_BYTES_COUNT(loaded->points, far_points, array_count(far_points)) );
+    EXPECT_TRUE( COMPARE_BYTES_COUNT(loaded->pressures, pressures, array_count(pressures)) );
+
+    milton_kill_save_thread(&milton);
+    milton_kill_save_thread(&loaded_milton);
+}
+
+void
+test_cpu_rasterizer()
+{
+    Milton milton = {};
+
+    milton_init(&milton, 0, 0, 1, TO_PATH_STR("TEST_raster.mlt"), MiltonInit_FOR_TEST);
+    milton_reset_canvas_and_set_default(&milton);
+
+    // One canvas unit per pixel, so pixel (x, y) is centered at (x+0.5, y+0.5).
+    CanvasView view = *milton.view;
+    view.screen_size = { 100, 70 };
+    view.scale = 1;
+    view.zoom_center = {};
+    view.pan_center = {};
+    view.angle = 0.0f;
+    view.background_color = { 1, 1, 1 };
+
+    Layer* layer = milton.canvas->working_layer;
+
+    v2l points[2] = { {10, 10}, {90, 10} };
+    f32 pressures[2] = { 1.0f, 1.0f };
+
+    Stroke stroke = {};
+    stroke.brush = default_brush();
+    stroke.brush.radius = 5;
+    stroke.brush.color = { 1, 0, 0, 1 };
+    stroke.points = points;
+    stroke.pressures = pressures;
+    stroke.num_points = array_count(points);
+    stroke.layer_id = layer->id;
+    stroke.bounding_rect = bounding_box_for_stroke(&stroke);
+    layer::layer_push_stroke(layer, stroke);
+
+    v2l eraser_points[1] = { {30, 10} };
+    Stroke eraser = stroke;
+    eraser.flags = StrokeFlag_ERASER;
+    eraser.brush.radius = 3;
+    eraser.points = eraser_points;
+    eraser.num_points = array_count(eraser_points);
+    eraser.bounding_rect = bounding_box_for_stroke(&eraser);
+    layer::layer_push_stroke(layer, eraser);
+
+    layer->alpha = 0.5f;
+
+    u32* single = (u32*)mlt_calloc(100*70, sizeof(u32), "Bitmap");
+    u32* multi = (u32*)mlt_calloc(100*70, sizeof(u32), "Bitmap");
+
+    RenderStack stack = {};
+    cpu_render_stack_init(&stack, false);
+    cpu_render_canvas(&stack, &view, milton.canvas->root_layer, single, 1.0f);
+    cpu_render_stack_release(&stack);
+
+    EXPECT_TRUE( single[10*100 + 50] == 0xff8080ff );  // Half red over white.
+    EXPECT_TRUE( single[10*100 + 80] == 0xff8080ff );  // Second block.
+    EXPECT_TRUE( single[10*100 + 30] == 0xffffffff );  // Erased.
+    EXPECT_TRUE( single[20*100 + 50] == 0xffffffff );
+    EXPECT_TRUE( single[69*100 + 99] == 0xffffffff );
+
+    jobs_init(3);
+    cpu_render_stack_init(&stack, true);
+    cpu_render_canvas(&stack, &view, milton.canvas->root_layer, multi, 1.0f);
+    cpu_render_stack_release(&stack);
+    jobs_release();
+
+    EXPECT_TRUE( COMPARE_BYTES_COUNT(single, multi, 100*70) );
+
+    mlt_free(single, "Bitmap");
+    mlt_free(multi, "Bitmap");
+    milton_kill_save_thread(&milton);
+}
+
+void
+test_stroke_list()
+{
+    Arena arena = arena_init();
+
+    StrokeList* list = arena_alloc_elem(&arena, StrokeList);
+    list->arena = &arena;
+    strokelist_init_bucket(&list->root);
+
+    const i32 num_strokes = 3*STROKELIST_BUCKET_COUNT + 7;
+    for ( i32 i = 0; i < num_strokes; ++i ) {
+        Stroke s = {};
+        s.id = i;
+        push(list, s);
+    }
+    Stroke* first = get(list, 0);
+
+    b32 ids_match = true;
+    for ( i32 i = 0; i < num_strokes; ++i ) {
+        ids_match = ids_match && get(list, i)->id == i;
+    }
+    EXPECT_TRUE( ids_match );
+    EXPECT_TRUE( count(list) == num_strokes );
+
+    EXPECT_TRUE( pop(list).id == num_strokes - 1 );
+    EXPECT_TRUE( peek(list)->id == num_strokes - 2 );
+    EXPECT_TRUE( get(list, 0) == first );
+
+    // Frozen view survives an undo followed by a new stroke.
+    FrozenStrokeList frozen = {};
+    strokelist_freeze(list, &frozen, &arena);
+    pop(list);
+    strokelist_preserve(list, &frozen, count(list));
+    Stroke replacement = {};
+    replacement.id = -1;
+    push(list, replacement);
+    EXPECT_TRUE( peek(list)->id == -1 );
+    EXPECT_TRUE( strokelist_frozen_get(&frozen, frozen.count - 1).id == num_strokes - 2 );
+    EXPECT_TRUE( strokelist_frozen_get(&frozen, 0).id == 0 );
+    strokelist_unfreeze(list, &frozen);
+
+    arena_free(&arena);
+}
+
+void
+test_cook_points()
+{
+    const i64 num_points = 1<<16;
+    v2l* points = (v2l*)mlt_calloc(num_points, sizeof(v2l), "Test");
+    f32* pressures = (f32*)mlt_calloc(num_points, sizeof(f32), "Test");
+    u32 seed = 1;
+    for ( i64 i = 0; i < num_points; ++i ) {
+        seed = seed*1664525 + 1013904223;
+        points[i] = { (i64)(i32)seed * 3, -(i64)(seed >> 3) };  // Some don't fit in 32 bits.
+        pressures[i] = (f32)(seed % 1000) / 800.0f - 0.1f;  // Some out of [0,1].
+    }
+    v2l origin = { 1<<20, -(1<<20) };
+
+    v2f* simd_points = (v2f*)mlt_calloc(num_points, sizeof(v2f), "Test");
+    v2f* scalar_points = (v2f*)mlt_calloc(num_points, sizeof(v2f), "Test");
+    u16* simd_pressures = (u16*)mlt_calloc(num_points, sizeof(u16), "Test");
+    u16* scalar_pressures = (u16*)mlt_calloc(num_points, sizeof(u16), "Test");
+
+    // Every remainder for the scalar tail.
+    for ( i64 count = 0; count < 9; ++count ) {
+        cook_points(points, pressures, count, origin, simd_points, simd_pressures);
+        cook_points_scalar(points, pressures, count, origin, scalar_points, scalar_pressures);
+        EXPECT_TRUE( COMPARE_BYTES_COUNT(simd_points, scalar_points, count) );
+        EXPECT_TRUE( COMPARE_BYTES_COUNT(simd_pressures, scalar_pressures, count) );
+    }
+
+    const int reps = 64;
+    u64 start = perf_counter();
+    for ( int rep = 0; rep < reps; ++rep ) {
+        cook_points_scalar(points, pressures, num_points, origin, scalar_points, scalar_pressures);
+    }
+    f32 scalar_sec = perf_count_to_sec(perf_counter() - start);
+    start = perf_counter();
+    for ( int rep = 0; rep < reps; ++rep ) {
+        cook_points(points, pressures, num_points, origin, simd_points, simd_pressures);
+    }
+    f32 simd_sec = perf_count_to_sec(perf_counter() - start);
+    EXPECT_TRUE( COMPARE_BYTES_COUNT(simd_points, scalar_points, num_points) );
+    EXPECT_TRUE( COMPARE_BYTES_COUNT(simd_pressures, scalar_pressures, num_points) );
+
+    milton_log("Cooked points per second: %.1fM scalar, %.1fM SSE2\n",
+               reps*num_points / (scalar_sec*1e6f), reps*num_points / (simd_sec*1e6f));
+
+    mlt_free(points, "Test");
+    mlt_free(pressures, "Test");
+    mlt_free(simd_points, "Test");
+    mlt_free(scalar_points, "Test");
+    mlt_free(simd_pressures, "Test");
+    mlt_free(scalar_pressures, "Test");
+}
+
+static int
+input_ring_producer(void* data)
+{
+    InputRing* ring = (InputRing*)data;
+    for ( i64 i = 0; i < 100000; ) {
+        InputSample sample = { { i, -i }, 0.5f, (u64)i };
+        if ( input_ring_push(ring, sample) ) {
+            ++i;
+        }
+    }
+    return 0;
+}
+
+void
+test_input_ring()
+{
+    InputRing* ring = (InputRing*)mlt_calloc(1, sizeof(InputRing), "Test");
+    InputSample samples[100];
+
+    // Fill it, wrapping around.
+    for ( i64 i = 0; i < 10; ++i ) {
+        input_ring_push(ring, InputSample{});
+    }
+    EXPECT_TRUE( input_ring_pop(ring, samples, array_count(samples)) == 10 );
+    b32 pushed_all = true;
+    for ( i64 i = 0; i < INPUT_RING_SIZE; ++i ) {
+        InputSample sample = { { i, 0 }, 1.0f, (u64)i };
+        pushed_all = pushed_all && input_ring_push(ring, sample);
+    }
+    EXPECT_TRUE( pushed_all );
+    EXPECT_TRUE( !input_ring_push(ring, InputSample{}) );
+    EXPECT_TRUE( SDL_AtomicGet(&ring->dropped) == 1 );
+
+    b32 in_order = true;
+    i64 popped = 0;
+    for ( i64 n = input_ring_pop(ring, samples, array_count(samples)); n > 0; n = input_ring_pop(ring, samples, array_count(samples)) ) {
+        for ( i64 i = 0; i < n; ++i ) {
+            in_order = in_order && samples[i].time == (u64)(popped + i) && samples[i].point.x == popped + i;
+        }
+        popped += n;
+    }
+    EXPECT_TRUE( in_order );
+    EXPECT_TRUE( popped == INPUT_RING_SIZE );
+
+    // Concurrent producer.
+    SDL_Thread* thread = SDL_CreateThread(input_ring_producer, "Input producer", ring);
+    popped = 0;
+    in_order = true;
+    while ( popped < 100000 ) {
+        i64 n = input_ring_pop(ring, samples, array_count(samples));
+        for ( i64 i = 0; i < n; ++i ) {
+            in_order = in_order && samples[i].point.x == popped + i && samples[i].point.y == -(popped + i);
+        }
+        popped += n;
+    }
+    SDL_WaitThread(thread, NULL);
+    EXPECT_TRUE( in_order );
+
+    mlt_free(ring, "Test");
+}
+
+struct JobsTest
+{
+    SDL_atomic_t    sum;
+    SDL_atomic_t    in_use[JOBS_MAX_WORKERS + 2];  // Per `worker`.
+    SDL_atomic_t    shared_worker;  // Set if two threads got the same `worker`.
+    SDL_atomic_t    main_jobs;
+};
+
+// Like JobsTest::in_use, across every parallel_for running at the same time.
+static SDL_atomic_t g_jobs_test_in_use[JOBS_MAX_WORKERS + 2];
+static SDL_atomic_t g_jobs_test_shared_worker;
+
+static void
+jobs_test_main(void* data)
+{
+    JobsTest* t = (JobsTest*)data;
+    SDL_AtomicAdd(&t->main_jobs, 1);
+}
+
+static void
+jobs_test_range(void* data, i64 begin, i64 end, i32 worker)
+{
+    JobsTest* t = (JobsTest*)data;
+    if ( SDL_AtomicAdd(&t->in_use[worker], 1) != 0 ) {
+        SDL_AtomicSet(&t->shared_worker, 1);
+    }
+    if ( SDL_AtomicAdd(&g_jobs_test_in_use[worker], 1) != 0 ) {
+        SDL_AtomicSet(&g_jobs_test_shared_worker, 1);
+    }
+    int sum = 0;
+    for ( i64 i = begin; i < end; ++i ) {
+        sum += (int)i;
+    }
+    SDL_AtomicAdd(&t->sum, sum);
+    if ( begin == 0 ) {
+        jobs_main_push(jobs_test_main, t);
+    }
+    SDL_AtomicAdd(&g_jobs_test_in_use[worker], -1);
+    SDL_AtomicAdd(&t->in_use[worker], -1);
+}
+
+static void
+jobs_test_nested(void* data, i64 begin, i64 end, i32 worker)
+{
+    JobsTest* tests = (JobsTest*)data;
+    for ( i64 i = begin; i < end; ++i ) {
+        parallel_for(1000, 10, jobs_test_range, tests + i);
+    }
+}
+
+static int
+jobs_test_thread(void* data)
+{
+    parallel_for(1000, 7, jobs_test_range, data);
+    return 0;
+}
+
+void
+test_jobs()
+{
+    jobs_init(3);
+    EXPECT_TRUE( jobs_num_threads() == 5 );
+
+    JobsTest t = {};
+    parallel_for(1000, 1, jobs_test_range, &t);
+    EXPECT_TRUE( SDL_AtomicGet(&t.sum) == 999*1000/2 );
+    EXPECT_TRUE( !SDL_AtomicGet(&t.shared_worker) );
+    // Runs while the main thread waits, or here.
+    jobs_main_run();
+    EXPECT_TRUE( SDL_AtomicGet(&t.main_jobs) == 1 );
+
+    // Nested, and from two threads that aren't workers.
+    JobsTest nested[8] = {};
+    JobsTest other = {};
+    JobsTest other2 = {};
+    PlatformThread* thread = platform_thread_create(jobs_test_thread, &other);
+    PlatformThread* thread2 = platform_thread_create(jobs_test_thread, &other2);
+    EXPECT_TRUE( thread != NULL && thread2 != NULL );
+    parallel_for(array_count(nested), 1, jobs_test_nested, nested);
+    platform_thread_join(thread);
+    platform_thread_join(thread2);
+    jobs_main_run();
+    for ( i64 i = 0; i < array_count(nested); ++i ) {
+        EXPECT_TRUE( SDL_AtomicGet(&nested[i].sum) == 999*1000/2 );
+        EXPECT_TRUE( !SDL_AtomicGet(&nested[i].shared_worker) );
+        EXPECT_TRUE( SDL_AtomicGet(&nested[i].main_jobs) == 1 );
+    }
+    EXPECT_TRUE( SDL_AtomicGet(&other.sum) == 999*1000/2 );
+    EXPECT_TRUE( !SDL_AtomicGet(&other.shared_worker) );
+    EXPECT_TRUE( SDL_AtomicGet(&other2.sum) == 999*1000/2 );
+    EXPECT_TRUE( !SDL_AtomicGet(&g_jobs_test_shared_worker) );
+
+    jobs_release();
+}
+
+void
+test_latency()
+{
+    LatencyStats* stats = (LatencyStats*)mlt_calloc(1, sizeof(LatencyStats), "Latency");
+    u64 ms = (u64)(0.001 / perf_count_to_sec(1<<20) * (1<<20));
+    u64 t = 1000*ms;
+
+    // Samples 1..100 ms old when rendered, swapped 1 ms later.
+    for ( i64 i = 100; i >= 1; --i ) {
+        latency_input(stats, t - (u64)i*ms);
+    }
+    latency_rendered(stats, true, true, t);
+    latency_presented(stats, t + ms);
+
+    LatencyPercentiles p = latency_percentiles(stats, LatencyStage_RENDER);
+    EXPECT_TRUE( p.count == 100 );
+    EXPECT_TRUE( fabsf(p.p50 - 50.0f) < 0.1f );
+    EXPECT_TRUE( fabsf(p.p95 - 95.0f) < 0.1f );
+    EXPECT_TRUE( fabsf(p.p99 - 99.0f) < 0.1f );
+    p = latency_percentiles(stats, LatencyStage_SWAP);
+    EXPECT_TRUE( fabsf(p.p50 - 51.0f) < 0.1f );
+
+    // Not drawn: waits while the stroke goes on, dropped when it is gone.
+    latency_input(stats, t);
+    latency_rendered(stats, false, true, t + ms);
+    latency_rendered(stats, false, false, t + 2*ms);
+    latency_rendered(stats, true, true, t + 3*ms);
+    latency_presented(stats, t + 4*ms);
+    EXPECT_TRUE( stats->count == 100 );
+
+    PATH_CHAR* path = TO_PATH_STR("TEST_latency.csv");
+    EXPECT_TRUE( latency_export_csv(stats, path) );
+
+    latency_release(stats);
+    mlt_free(stats, "Latency");
+}
+
+// Draws two strokes in a session that is recorded, and plays the recording on
+// another canvas.
+void
+test_replay()
+{
+    PATH_CHAR* path = TO_PATH_STR("TEST_replay.mlt");
+    PATH_CHAR* replayed_path = TO_PATH_STR("TEST_replayed.mlt");
+    PATH_CHAR* recording = TO_PATH_STR("TEST_replay.mrec");
+
+    Milton milton = {};
+    milton_init(&milton, 0, 0, 1, path, MiltonInit_FOR_TEST);
+    milton_reset_canvas_and_set_default(&milton);
+    milton.persist->mlt_file_path = path;
+    milton_resize_and_pan(&milton, {}, {640, 480});
+
+    // Recordings come from the app, which has a platform.
+    PlatformState platform = {};
+    platform.pointer = { 320, 240 };
+    milton.platform = &platform;
+
+    InputRecorder rec = {};
+    EXPECT_TRUE( replay_record_begin(&rec, recording) );
+    for ( i32 frame = 0; frame < 20; ++frame ) {
+        v2l points[4];
+        f32 pressures[4];
+        for ( i32 i = 0; i < 4; ++i ) {
+            points[i] = { 300 + 10*frame + 2*i, 200 + 5*frame };
+            pressures[i] = 0.5f + 0.02f*i;
+        }
+        MiltonInput input = {};
+        input.mode_to_set = milton.current_mode;
+        if ( frame != 9 && frame != 19 ) {
+            input.points = points;
+            input.pressures = pressures;
+            input.input_count = 4;
+        }
+        else {
+            input.flags = MiltonInputFlags_END_STROKE;
+        }
+        replay_record_frame(&rec, &milton, &input);
+        milton_update_and_render(&milton, &input);
+    }
+    EXPECT_TRUE( replay_record_end(&rec) );
+    EXPECT_TRUE( rec.num_frames == 20 );
+    EXPECT_TRUE( milton.clock.fixed );
+
+    Milton replayed = {};
+    milton_init(&replayed, 0, 0, 1, replayed_path, MiltonInit_FOR_TEST);
+    milton_reset_canvas_and_set_default(&replayed);
+    replayed.persist->mlt_file_path = replayed_path;
+
+    ReplayReport report = {};
+    EXPECT_TRUE( replay_run(&replayed, recording, ReplaySpeed_FULL, &report) );
+    EXPECT_TRUE( report.num_frames == 20 );
+    EXPECT_TRUE( report.num_strokes == 2 );
+    EXPECT_TRUE( replayed.platform == NULL );
+    EXPECT_TRUE( replayed.view->screen_size == milton.view->screen_size );
+    EXPECT_TRUE( replayed.clock.ms == milton.clock.ms );
+
+    Layer* a = milton.canvas->working_layer;
+    Layer* b = replayed.canvas->working_layer;
+    EXPECT_TRUE( count(&a->strokes) == 2 && count(&b->strokes) == 2 );
+    for ( i64 i = 0; i < min(count(&a->strokes), count(&b->strokes)); ++i ) {
+        Stroke* sa = get(&a->strokes, i);
+        Stroke* sb = get(&b->strokes, i);
+        EXPECT_TRUE( sa->num_points > 0 && sa->num_points == sb->num_points );
+        EXPECT_TRUE( COMPARE_BYTES_COUNT(sa->points, sb->points, sa->num_points) );
+        EXPECT_TRUE( COMPARE_BYTES_COUNT(sa->pressures, sb->pressures, sa->num_points) );
+    }
+
+    // Not a recording.
+    EXPECT_TRUE( !replay_run(&replayed, path, ReplaySpeed_FULL, &report) );
+
+    milton_kill_save_thread(&milton);
+    milton_kill_save_thread(&replayed);
+}
+
+#if MILTON_ENABLE_TRACING
+// Job system callback.
+static void
+trace_test_range(void* data, i64 begin, i64 end, i32 worker)
+{
+    TRACE_ZONE("trace_test_range");
+}
+
+// Occurrences of `needle` in the trace at `path`.
+static i64
+trace_test_count(PATH_CHAR* path, char* needle)
+{
+    i64 count = 0;
+    FILE* fd = platform_fopen(path, TO_PATH_STR("rb"));
+    EXPECT_TRUE( fd != NULL );
+    fseek(fd, 0, SEEK_END);
+    long size = ftell(fd);
+    fseek(fd, 0, SEEK_SET);
+    char* json = (char*)mlt_calloc((size_t)size + 1, 1, "Trace");
+    EXPECT_TRUE( fread(json, (size_t)size, 1, fd) == 1 );
+    fclose(fd);
+    EXPECT_TRUE( strstr(json, "{\"traceEvents\":[") == json );
+    EXPECT_TRUE( strcmp(json + size - 4, "\n]}\n") == 0 );
+    for ( char* c = strstr(json, needle); c; c = strstr(c + 1, needle) ) {
+        ++count;
+    }
+    mlt_free(json, "Trace");
+    return count;
+}
+
+void
+test_trace()
+{
+    PATH_CHAR* path = TO_PATH_STR("TEST_trace.json");
+    jobs_init(3);
+    trace_set_thread_name("Main \"test\"");
+
+    trace_capture_start();
+    {
+        TRACE_ZONE("trace_test_outer");
+        parallel_for(64, 1, trace_test_range, NULL);
+    }
+    EXPECT_TRUE( trace_capture_stop(path) );
+    EXPECT_TRUE( !trace_is_capturing() );
+    EXPECT_TRUE( trace_test_count(path, "\"name\":\"trace_test_range\"") == 64 );
+    EXPECT_TRUE( trace_test_count(path, "\"name\":\"trace_test_outer\"") == 1 );
+    EXPECT_TRUE( trace_test_count(path, "Main \\\"test\\\"") == 1 );
+
+    // Zones from the first capture are still in the rings, but not in this one.
+    trace_capture_start();
+    {
+        TRACE_ZONE("trace_test_second");
+    }
+    EXPECT_TRUE( trace_capture_stop(path) );
+    EXPECT_TRUE( trace_test_count(path, "trace_test_range") == 0 );
+    EXPECT_TRUE( trace_test_count(path, "trace_test_second") == 1 );
+
+    jobs_release();
+    trace_release();
 }
+#endif
 
 extern "C" int
 main()
 {
     test_save_load();
+    test_journal_replay();
+    test_save_load_sections();
+    test_save_load_packed();
+    test_cpu_rasterizer();
+    test_stroke_list();
+    test_stroke_index();
+    test_cook_points();
+    test_input_ring();
+    test_jobs();
+    test_latency();
+    test_replay();
+#if MILTON_ENABLE_TRACING
+    test_trace();
+#endif
     return 0;
 }
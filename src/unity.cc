@@ -1,18 +1,23 @@
 // Copyright (c) 2015 Sergio Gonzalez. All rights reserved.
 // License: https://github.com/serge-rgb/milton#license
 
+#include "StrokeIndex.cc"
 #include "StrokeList.cc"
 #include "bindings.cc"
 #include "canvas.cc"
 #include "color.cc"
 #include "gl_helpers.cc"
 #include "gui.cc"
+#include "jobs.cc"
+#include "latency.cc"
 #include "localization.cc"
 #include "memory.cc"
 #include "milton.cc"
 #include "persist.cc"
 #include "profiler.cc"
+#include "rasterizer.cc"
 #include "renderer.cc"
+#include "replay.cc"
 #include "sdl_milton.cc"
 #include "utils.cc"
 #include "vector.cc"
@@ -26,7 +31,9 @@
     #include "platform_unix.cc"
     #include "platform_mac.mm"
 #endif
-#if !defined(TESTING)
+#if defined(MILTON_RENDER_CLI)
+    #include "milton_render.cc"
+#elif !defined(TESTING)
     #if defined(_WIN32)
        #include "platform_main_windows.cc"
     #elif defined(__linux__)
@@ -0,0 +1,2 @@
+#define MILTON_RENDER_CLI
+#include "unity.cc"